@@ -12,6 +12,7 @@
 
 extern int pce_server_main(int argc, char **argv);
 extern int pce_client_main(int argc, char **argv);
+extern int pce_convert_main(int argc, char **argv);
 
 static void pce_usage(FILE * out)
 {
@@ -21,6 +22,7 @@ static void pce_usage(FILE * out)
 		"Commands:                            \n"
 		"  server    run pce server (PCE)     \n"
 		"  client    run pce client (PCC)     \n"
+		"  convert   build a binary topology  \n"
 		"  help      show this help and exit\n\n"
 		"Examples:                            \n"
 		"  pce server -d -p 4189              \n"
@@ -42,6 +44,10 @@ int main(int argc, char *argv[])
 		argc--;
 		argv++;
 		pce_client_main(argc, argv);
+	} else if (argc > 1 && (strcmp(argv[1], "convert") == 0)) {
+		argc--;
+		argv++;
+		pce_convert_main(argc, argv);
 	} else if (argc > 1 && (strcmp(argv[1], "help") == 0)) {
 		pce_usage(stderr);
 		exit(EXIT_FAILURE);
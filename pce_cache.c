@@ -0,0 +1,248 @@
+/*
+ * pce_cache.c - PCE computed path cache
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "pce_log.h"
+#include "pce_cspf.h"
+#include "pce_cache.h"
+
+/*
+ * pce_cache_create - Create a cache of size entries (a power of 2)
+ */
+struct pce_cache *pce_cache_create(uint32_t size)
+{
+	struct pce_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		goto err;
+	cache->mask = size - 1;
+	cache->entries = calloc(size, sizeof(*cache->entries));
+	cache->buckets = malloc(size * sizeof(*cache->buckets));
+	if (!cache->entries || !cache->buckets)
+		goto err1;
+	memset(cache->buckets, 0xff, size * sizeof(*cache->buckets));
+
+	return cache;
+
+err1:
+	pce_cache_delete(cache);
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_cache_delete - Release a cache
+ */
+void pce_cache_delete(struct pce_cache *cache)
+{
+	free(cache->entries);
+	free(cache->buckets);
+	free(cache);
+}
+
+/*
+ * pce_cache_hash - Hash bucket of a request
+ */
+static uint32_t pce_cache_hash(const struct pce_cache *cache,
+	const struct pce_cspf_req *req)
+{
+	uint64_t h;
+	uint32_t bw;
+
+	memcpy(&bw, &req->bw, sizeof(bw));
+	h = ((uint64_t)req->src << 32 | req->dst) * 0x9e3779b97f4a7c15ULL;
+	h ^= ((uint64_t)bw << 32 | (uint32_t)req->metric) *
+		0xc2b2ae3d27d4eb4fULL;
+	h ^= ((uint64_t)req->exclude_any << 32 | req->include_any) *
+		0x165667b19e3779f9ULL;
+	h ^= req->include_all * 0x27d4eb2f165667c5ULL;
+
+	return (uint32_t)(h ^ h >> 32) & cache->mask;
+}
+
+/*
+ * pce_cache_key_eq - Check whether two requests have the same constraints
+ */
+static inline int pce_cache_key_eq(const struct pce_cspf_req *a,
+	const struct pce_cspf_req *b)
+{
+	return a->src == b->src && a->dst == b->dst &&
+		!memcmp(&a->bw, &b->bw, sizeof(a->bw)) &&
+		a->metric == b->metric && a->exclude_any == b->exclude_any &&
+		a->include_any == b->include_any &&
+		a->include_all == b->include_all;
+}
+
+/*
+ * pce_cache_find - Find the entry of a request, whatever its generation
+ */
+static struct pce_cache_entry *pce_cache_find(struct pce_cache *cache,
+	const struct pce_cspf_req *req, uint32_t bucket)
+{
+	struct pce_cache_entry *ent;
+	uint32_t i;
+
+	for (i = cache->buckets[bucket]; i != PCE_CACHE_NONE; i = ent->next) {
+		ent = &cache->entries[i];
+		if (pce_cache_key_eq(&ent->key, req))
+			return ent;
+	}
+
+	return NULL;
+}
+
+/*
+ * pce_cache_lookup - Look up the result of a request computed on the given
+ * topology generation
+ *
+ * The entry returned is valid until the next insertion.
+ */
+const struct pce_cache_entry *pce_cache_lookup(struct pce_cache *cache,
+	const struct pce_cspf_req *req, unsigned long gen)
+{
+	struct pce_cache_entry *ent;
+
+	ent = pce_cache_find(cache, req, pce_cache_hash(cache, req));
+	if (!ent || ent->gen != gen)
+		return NULL;
+	ent->ref = 1;
+
+	return ent;
+}
+
+/*
+ * pce_cache_unlink - Remove an entry from its hash bucket
+ */
+static void pce_cache_unlink(struct pce_cache *cache,
+	struct pce_cache_entry *ent)
+{
+	uint32_t i = ent - cache->entries;
+	uint32_t *p = &cache->buckets[pce_cache_hash(cache, &ent->key)];
+
+	while (*p != i)
+		p = &cache->entries[*p].next;
+	*p = ent->next;
+	ent->used = 0;
+}
+
+/*
+ * pce_cache_victim - Pick the entry to reuse, advancing the CLOCK hand
+ */
+static struct pce_cache_entry *pce_cache_victim(struct pce_cache *cache,
+	unsigned long gen)
+{
+	struct pce_cache_entry *ent;
+
+	while (1) {
+		ent = &cache->entries[cache->hand];
+		cache->hand = (cache->hand + 1) & cache->mask;
+		if (!ent->used)
+			return ent;
+		if (ent->ref && ent->gen == gen) {
+			ent->ref = 0;
+			continue;
+		}
+		pce_cache_unlink(cache, ent);
+		return ent;
+	}
+}
+
+/*
+ * pce_cache_insert - Record the result of a request computed on the given
+ * topology generation, path is NULL if there is no path
+ */
+void pce_cache_insert(struct pce_cache *cache,
+	const struct pce_cspf_req *req, unsigned long gen,
+	const struct pce_cspf_path *path)
+{
+	struct pce_cache_entry *ent;
+	uint32_t bucket;
+
+	if (path && path->num_hops > PCE_CACHE_HOPS_MAX)
+		return;
+
+	/* a stale result of the same request is refreshed in place */
+	bucket = pce_cache_hash(cache, req);
+	ent = pce_cache_find(cache, req, bucket);
+	if (!ent) {
+		ent = pce_cache_victim(cache, gen);
+		ent->key = *req;
+		ent->next = cache->buckets[bucket];
+		cache->buckets[bucket] = ent - cache->entries;
+		ent->used = 1;
+	}
+	ent->gen = gen;
+	ent->ref = 0;
+	ent->found = !!path;
+	if (path) {
+		ent->num_hops = path->num_hops;
+		ent->cost = path->cost;
+		memcpy(ent->hops, path->hops,
+			path->num_hops * sizeof(*path->hops));
+	}
+}
+
+/*
+ * pce_cache_crosses - Check whether a cached path goes through a link
+ *
+ * The hops don't tell parallel links apart, any of them is a match.
+ */
+static int pce_cache_crosses(const struct pce_cache_entry *ent,
+	uint32_t src, uint32_t dst)
+{
+	uint32_t i;
+
+	for (i = 1; i < ent->num_hops; i++)
+		if (ent->hops[i - 1] == src && ent->hops[i] == dst)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * pce_cache_revalidate - Carry the results still right over to a new
+ * topology generation, after the given links (router ids of their ends)
+ * only got worse
+ *
+ * A NO-PATH stays a NO-PATH, and a path not going through the links keeps
+ * its cost while every other one can only get longer. The entries of
+ * old_gen left behind are the results the changes affected.
+ *
+ * Returns the number of results affected, num_valid is set to the number
+ * of results of old_gen.
+ */
+uint32_t pce_cache_revalidate(struct pce_cache *cache,
+	const uint32_t *srcs, const uint32_t *dsts, uint32_t num_links,
+	unsigned long old_gen, unsigned long gen, uint32_t *num_valid)
+{
+	struct pce_cache_entry *ent;
+	uint32_t i, j, num = 0, affected = 0;
+
+	for (i = 0; i <= cache->mask; i++) {
+		ent = &cache->entries[i];
+		if (!ent->used || ent->gen != old_gen)
+			continue;
+		num++;
+
+		for (j = 0; ent->found && j < num_links; j++)
+			if (pce_cache_crosses(ent, srcs[j], dsts[j]))
+				break;
+		if (ent->found && j < num_links)
+			affected++;
+		else
+			ent->gen = gen;
+	}
+	*num_valid = num;
+
+	return affected;
+}
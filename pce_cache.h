@@ -0,0 +1,65 @@
+/*
+ * pce_cache.h - PCE computed path cache interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_CACHE_H
+#define PCE_CACHE_H
+
+#include <stdint.h>
+
+#include "pce_cspf.h"
+
+/*
+ * A fixed size cache of computation results (paths and NO-PATHs) keyed by
+ * the whole set of request constraints, owned by a single engine so it
+ * needs no locking. Entries are chained in hash buckets by index and
+ * evicted in CLOCK order: the hand clears the reference bit of the recent
+ * entries and takes the first one not referenced since its last pass.
+ *
+ * Every entry is stamped with the topology generation it was computed on,
+ * so a topology change invalidates the whole cache without touching it:
+ * stale entries are misses, and the first ones the hand reclaims. When
+ * links only got worse, the entries not going through them are still
+ * right and are carried over to the new generation instead.
+ */
+
+#define PCE_CACHE_HOPS_MAX 32	/* longer paths are not cached */
+#define PCE_CACHE_NONE     (~0U)
+
+struct pce_cache_entry {
+	struct pce_cspf_req key;
+	unsigned long gen;
+	uint32_t next;		/* in the hash bucket */
+	unsigned char used;
+	unsigned char ref;
+	unsigned char found;	/* 0: NO-PATH */
+	uint32_t num_hops;
+	uint64_t cost;
+	uint32_t hops[PCE_CACHE_HOPS_MAX];
+};
+
+struct pce_cache {
+	uint32_t mask;		/* entries and buckets, minus 1 */
+	uint32_t hand;
+	uint32_t *buckets;
+	struct pce_cache_entry *entries;
+};
+
+extern struct pce_cache *pce_cache_create(uint32_t size);
+extern void pce_cache_delete(struct pce_cache *cache);
+
+extern const struct pce_cache_entry *pce_cache_lookup(
+	struct pce_cache *cache, const struct pce_cspf_req *req,
+	unsigned long gen);
+extern void pce_cache_insert(struct pce_cache *cache,
+	const struct pce_cspf_req *req, unsigned long gen,
+	const struct pce_cspf_path *path);
+extern uint32_t pce_cache_revalidate(struct pce_cache *cache,
+	const uint32_t *srcs, const uint32_t *dsts, uint32_t num_links,
+	unsigned long old_gen, unsigned long gen, uint32_t *num_valid);
+
+#endif /* PCE_CACHE_H */
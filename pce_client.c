@@ -16,8 +16,10 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "pce_log.h"
+#include "pcep_encoder.h"
 
 #define PCE_SERVICE "4189"
 #define PCE_HOSTNAME "localhost"
@@ -29,52 +31,83 @@ struct pce_client_data {
 };
 
 /*
- * pce_client_send - PCE client send
+ * pce_client_sendv - PCE client send of a segment list
  */
-int pcep_client_send(struct pce_client_data *data, const void *buf, size_t count)
+static int pce_client_sendv(struct pce_client_data *data, struct iovec *iov,
+	int iovcnt)
 {
-	int n, ret;
-	const char *ptr;
+	ssize_t n;
+	int ret = 0;
 
-	ptr = buf;
-	for (ret = 0; ret < count; ) {
-		n = write(data->fd, ptr, count - ret);
+	while (iovcnt) {
+		n = writev(data->fd, iov, iovcnt);
 		if (n <= 0) {
 			if (n == -1 && errno == EINTR)
-				continue; /* interrupted, restart write() */
+				continue; /* interrupted, restart writev() */
 			else
 				return -1; /* some other error */
 		}
 		ret += n;
-		ptr += n;
+
+		/* skip what has been written */
+		while (iovcnt && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
 	}
 	return ret;
 }
 
+/*
+ * pce_client_msg - Encode a PCEP message (optionally with one object) and
+ * send it
+ */
+static int pce_client_msg(struct pce_client_data *data, int type,
+	int o_class, const void *body, size_t len)
+{
+	char buf[64];
+	struct pcep_encoder enc;
+	struct iovec *iov;
+	int iovcnt;
+
+	pcep_encoder_init(&enc, buf, sizeof(buf));
+	pcep_encoder_msg_begin(&enc, type);
+	if (o_class) {
+		pcep_encoder_obj_begin(&enc, o_class, 1, 0, 0);
+		pcep_encoder_append(&enc, body, len);
+		pcep_encoder_obj_end(&enc);
+	}
+	pcep_encoder_msg_end(&enc);
+
+	iovcnt = pcep_encoder_iov(&enc, &iov);
+	if (iovcnt < 0)
+		return -1;
+
+	return pce_client_sendv(data, iov, iovcnt);
+}
+
 /*
  * pce_client_session - PCE client dummy session
  */
 static int pce_client_session(struct pce_client_data *data)
 {
-	const char pcep_open[] = {
-		0x20, 0x01, 0x00, 0x0C,
-		0x01, 0x10, 0x00, 0x08,
-		0x20, 0x00, 0x00, 0x00,
-	};
-	const char pcep_keepalive[] = {
-		0x20, 0x02, 0x00, 0x04,
-	};
-	const char pcep_close[] = {
-		0x20, 0x07, 0x00, 0x0C,
-		0x0F, 0x10, 0x00, 0x08,
-		0x00, 0x00, 0x00, 0x00,
-	};
-
-	pcep_client_send(data, pcep_open, sizeof(pcep_open));
+	/* version 1, no keepalive, no dead timer, session id 0 */
+	const char pcep_open[] = { 0x20, 0x00, 0x00, 0x00 };
+	/* no flags, no specified reason */
+	const char pcep_close[] = { 0x00, 0x00, 0x00, 0x00 };
+
+	pce_client_msg(data, PCEP_MSG_TYPE_OPEN, PCEP_OBJ_CLASS_OPEN,
+		pcep_open, sizeof(pcep_open));
 	sleep(1);
-	pcep_client_send(data, pcep_keepalive, sizeof(pcep_keepalive));
+	pce_client_msg(data, PCEP_MSG_TYPE_KEEPALIVE, 0, NULL, 0);
 	sleep(2);
-	pcep_client_send(data, pcep_close, sizeof(pcep_close));
+	pce_client_msg(data, PCEP_MSG_TYPE_CLOSE, PCEP_OBJ_CLASS_CLOSE,
+		pcep_close, sizeof(pcep_close));
 	sleep(3);
 
 	return 0;
@@ -0,0 +1,115 @@
+/*
+ * pce_convert.c - PCE topology converter application
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "pce_log.h"
+#include "pce_ted.h"
+
+static void pce_convert_usage(FILE * out)
+{
+	static const char usage_str[] =
+		("Usage:                                                \n"
+		"  pce convert [options]                              \n\n"
+		"Options:                                               \n"
+		"  -i | --input      text edge list to read             \n"
+		"  -o | --output     binary TED file to write           \n"
+		"  -d | --debug      PCE converter debug mode           \n"
+		"  -v | --version    show the program version and exit  \n"
+		"  -h | --help       show this help and exit          \n\n"
+		"Examples:                                              \n"
+		"  pce convert -i topology.txt -o topology.ted        \n\n");
+
+	fprintf(out, "%s", usage_str);
+	fflush(out);
+	return;
+}
+
+static void pce_convert_version(FILE * out)
+{
+	static const char prog_str[] = "pce convert";
+	static const char ver_str[] = "1.1";
+	static const char author_str[] = "Paolo Rovelli";
+
+	fprintf(out, "%s %s written by %s\n", prog_str, ver_str, author_str);
+	fflush(out);
+	return;
+}
+
+static const struct option pce_convert_options[] = {
+	{"input", required_argument, NULL, 'i'},
+	{"output", required_argument, NULL, 'o'},
+	{"debug", no_argument, NULL, 'd'},
+	{"version", no_argument, NULL, 'v'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+int pce_convert_main(int argc, char *argv[])
+{
+	int err = 0, opt;
+	int debug = 0;
+	char *input = NULL;
+	char *output = NULL;
+	struct pce_ted *ted;
+
+	/* parse PCE converter command line options */
+	while ((opt = getopt_long(argc, argv, "di:o:vh", pce_convert_options,
+				NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			debug = 1;
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'v':
+			pce_convert_version(stdout);
+			exit(EXIT_SUCCESS);
+		case 'h':
+			pce_convert_usage(stdout);
+			exit(EXIT_SUCCESS);
+		default:
+			pce_convert_usage(stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!input || !output) {
+		pce_convert_usage(stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	/* init PCE logger, errors go to the terminal */
+	pce_log_open(LOG_PERROR);
+	pce_log_level(debug ? LOG_DEBUG : LOG_ERR);
+
+	/* a binary input is accepted as well (e.g. to rewrite it) */
+	ted = pce_ted_load(input);
+	if (!ted) {
+		err = EINVAL;
+		goto out;
+	}
+	pce_log(LOG_DEBUG, "%u nodes, %u links\n", ted->num_nodes,
+		ted->num_links);
+
+	if (pce_ted_save(ted, output))
+		err = EIO;
+	pce_ted_delete(ted);
+
+out:
+	pce_log_close();
+	exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,432 @@
+/*
+ * pce_cspf.c - PCE constrained shortest path first
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "pce_log.h"
+#include "pce_ted.h"
+#include "pce_cspf.h"
+#include "pce_cache.h"
+#include "pce_spt.h"
+#include "pce_disjoint.h"
+#include "pce_ksp.h"
+
+/*
+ * pce_cspf_create - Create a CSPF engine for the given topology, with a
+ * cache of cache_size results (a power of 2, 0: no cache)
+ */
+struct pce_cspf *pce_cspf_create(const struct pce_ted *ted,
+	uint32_t cache_size)
+{
+	struct pce_cspf *c;
+	uint32_t n = ted->num_nodes ? ted->num_nodes : 1;
+	int d;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		goto err;
+	c->ted = ted;
+	c->size = n;
+
+	for (d = 0; d < 2; d++) {
+		c->dir[d].nodes = calloc(n, sizeof(*c->dir[d].nodes));
+		c->dir[d].heap = malloc(n * sizeof(*c->dir[d].heap));
+		if (!c->dir[d].nodes || !c->dir[d].heap)
+			goto err1;
+	}
+	c->hops = malloc(n * sizeof(*c->hops));
+	c->changed = malloc(3 * PCE_TED_CHANGES * sizeof(*c->changed));
+	if (!c->hops || !c->changed)
+		goto err1;
+	c->ted_gen = pce_ted_gen(ted);
+	c->spt = pce_spt_create(ted);
+	if (!c->spt) {
+		pce_cspf_delete(c);
+		return NULL;
+	}
+	if (cache_size) {
+		c->cache = pce_cache_create(cache_size);
+		if (!c->cache) {
+			pce_cspf_delete(c);
+			return NULL;
+		}
+	}
+
+	return c;
+
+err1:
+	pce_cspf_delete(c);
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_cspf_delete - Release a CSPF engine
+ */
+void pce_cspf_delete(struct pce_cspf *c)
+{
+	int d;
+
+	for (d = 0; d < 2; d++) {
+		free(c->dir[d].nodes);
+		free(c->dir[d].heap);
+	}
+	free(c->hops);
+	free(c->changed);
+	if (c->cache)
+		pce_cache_delete(c->cache);
+	if (c->spt)
+		pce_spt_delete(c->spt);
+	if (c->disjoint)
+		pce_disjoint_delete(c->disjoint);
+	if (c->ksp)
+		pce_ksp_delete(c->ksp);
+	free(c);
+}
+
+/*
+ * pce_cspf_label - Label a node reached with the given distance
+ *
+ * Returns 1 if the label improved.
+ */
+static inline int pce_cspf_label(struct pce_cspf_dir *h, uint32_t gen,
+	uint32_t v, uint32_t prev, uint64_t dist)
+{
+	struct pce_cspf_node *w = &h->nodes[v];
+
+	if (w->gen != gen) {
+		w->gen = gen;
+		w->dist = dist;
+		w->prev = prev;
+		w->pos = h->heap_len++;
+		h->heap[w->pos] = v;
+		pce_cspf_heap_up(h, w->pos);
+		return 1;
+	}
+	if (w->pos == PCE_CSPF_DONE || dist >= w->dist)
+		return 0;
+
+	w->dist = dist;
+	w->prev = prev;
+	pce_cspf_heap_up(h, w->pos);
+	return 1;
+}
+
+/*
+ * pce_cspf_reset - Invalidate all the node labels
+ */
+static void pce_cspf_reset(struct pce_cspf *c)
+{
+	int d;
+
+	/* a generation wrap needs a real reset, once in 4G computations */
+	if (++c->gen == 0) {
+		for (d = 0; d < 2; d++)
+			memset(c->dir[d].nodes, 0,
+				c->size * sizeof(*c->dir[d].nodes));
+		c->gen = 1;
+	}
+	for (d = 0; d < 2; d++)
+		c->dir[d].heap_len = 0;
+}
+
+/*
+ * pce_cspf_search - Run the bidirectional search of a request
+ *
+ * The direction with the closest unsettled node goes on, and the search
+ * stops once no path through unsettled nodes can beat the best one seen
+ * where the two searches met.
+ */
+static int pce_cspf_search(struct pce_cspf *c, const struct pce_cspf_req *req,
+	struct pce_cspf_path *path)
+{
+	const struct pce_ted *ted = c->ted;
+	struct pce_cspf_dir *fwd = &c->dir[PCE_CSPF_FWD];
+	struct pce_cspf_dir *bwd = &c->dir[PCE_CSPF_BWD];
+	struct pce_cspf_dir *h, *o;
+	const uint32_t *metric;
+	uint32_t u, v, e, i, end, n, meet = PCE_CSPF_DONE;
+	uint64_t dist, best = PCE_CSPF_INF;
+	long src, dst;
+
+	src = pce_ted_node(ted, req->src);
+	dst = pce_ted_node(ted, req->dst);
+	if (src < 0 || dst < 0)
+		return -1;
+
+	switch (req->metric) {
+	case PCE_CSPF_METRIC_IGP:
+		metric = ted->igp_metric;
+		break;
+	case PCE_CSPF_METRIC_HOPS:
+		metric = NULL;
+		break;
+	default:
+		metric = ted->te_metric;
+		break;
+	}
+
+	pce_cspf_reset(c);
+	pce_cspf_label(fwd, c->gen, src, src, 0);
+	pce_cspf_label(bwd, c->gen, dst, dst, 0);
+	if (src == dst) {
+		meet = src;
+		best = 0;
+	}
+
+	while (fwd->heap_len && bwd->heap_len) {
+		if (pce_cspf_heap_top(fwd) + pce_cspf_heap_top(bwd) >= best)
+			break;
+
+		if (pce_cspf_heap_top(fwd) <= pce_cspf_heap_top(bwd)) {
+			h = fwd;
+			o = bwd;
+		} else {
+			h = bwd;
+			o = fwd;
+		}
+		u = pce_cspf_heap_pop(h);
+
+		if (h == fwd) {
+			i = ted->row[u];
+			end = ted->row[u + 1];
+		} else {
+			i = ted->rev_row[u];
+			end = ted->rev_row[u + 1];
+		}
+		for (; i < end; i++) {
+			if (h == fwd) {
+				e = i;
+				v = ted->dst[i];
+			} else {
+				e = ted->rev_link[i];
+				v = ted->rev_src[i];
+			}
+			if (!pce_cspf_link_ok(ted, req, e))
+				continue;
+
+			dist = h->nodes[u].dist + (metric ? metric[e] : 1);
+			if (!pce_cspf_label(h, c->gen, v, u, dist))
+				continue;
+
+			/* reached by the other search too */
+			if (o->nodes[v].gen == c->gen &&
+				dist + o->nodes[v].dist < best) {
+				best = dist + o->nodes[v].dist;
+				meet = v;
+			}
+		}
+	}
+
+	if (meet == PCE_CSPF_DONE)
+		return -1;
+
+	/* source to meeting node, backwards */
+	n = 0;
+	for (v = meet; v != (uint32_t)src; v = fwd->nodes[v].prev)
+		n++;
+	for (v = meet, i = n; ; v = fwd->nodes[v].prev) {
+		c->hops[i] = ted->node_id[v];
+		if (!i--)
+			break;
+	}
+
+	/* meeting node to destination */
+	for (v = meet; v != (uint32_t)dst; ) {
+		v = bwd->nodes[v].prev;
+		c->hops[++n] = ted->node_id[v];
+	}
+
+	path->hops = c->hops;
+	path->num_hops = n + 1;
+	path->cost = best;
+
+	return 0;
+}
+
+/*
+ * pce_cspf_solve - Answer a request from a tree if possible, otherwise
+ * search
+ */
+static int pce_cspf_solve(struct pce_cspf *c, const struct pce_cspf_req *req,
+	struct pce_cspf_path *path)
+{
+	long src, dst;
+	int ret;
+
+	/* only the links down count without constraints */
+	if (req->bw <= 0 && !req->exclude_any && !req->include_any &&
+		!req->include_all) {
+		src = pce_ted_node(c->ted, req->src);
+		dst = pce_ted_node(c->ted, req->dst);
+		if (src < 0 || dst < 0)
+			return -1;
+		ret = pce_spt_path(c->spt, src, dst, req->metric, c->hops,
+			path);
+		if (ret >= 0)
+			return ret ? 0 : -1;
+	}
+
+	return pce_cspf_search(c, req, path);
+}
+
+/*
+ * pce_cspf_sync - Catch up with the topology changes since the last
+ * computation
+ *
+ * The trees are repaired. The cached results are all dropped, unless the
+ * links only got worse: then only the paths through them are.
+ */
+static void pce_cspf_sync(struct pce_cspf *c, unsigned long gen)
+{
+	const struct pce_ted *ted = c->ted;
+	const struct pce_ted_change *ch;
+	uint32_t *links = c->changed;
+	uint32_t *srcs = links + PCE_TED_CHANGES;
+	uint32_t *dsts = srcs + PCE_TED_CHANGES;
+	uint32_t i, n = 0, num_valid = 0, affected = 0;
+	unsigned long g;
+	int worse = 1, trees;
+
+	if (gen - c->ted_gen >= PCE_TED_CHANGES)
+		goto lost;
+	for (g = c->ted_gen + 1; g != gen + 1; g++) {
+		ch = &ted->changes[g % PCE_TED_CHANGES];
+		links[n++] = __atomic_load_n(&ch->link, __ATOMIC_RELAXED);
+		worse &= __atomic_load_n(&ch->worse, __ATOMIC_RELAXED);
+	}
+
+	/*
+	 * the slots read may have been reused meanwhile: the one of the
+	 * oldest change is, as soon as the newest is a ring away from it
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (pce_ted_gen(ted) - c->ted_gen >= PCE_TED_CHANGES)
+		goto lost;
+
+	trees = pce_spt_repair(c->spt, links, n);
+	if (c->cache && worse) {
+		for (i = 0; i < n; i++) {
+			srcs[i] = ted->node_id[pce_ted_link_src(ted, links[i])];
+			dsts[i] = ted->node_id[ted->dst[links[i]]];
+		}
+		affected = pce_cache_revalidate(c->cache, srcs, dsts, n,
+			c->ted_gen, gen, &num_valid);
+	}
+	if (worse)
+		pce_log(LOG_DEBUG, "%u topology changes: %d trees repaired, "
+			"%u of %u cached results affected\n", n, trees,
+			affected, num_valid);
+	else
+		pce_log(LOG_DEBUG, "%u topology changes: %d trees repaired, "
+			"all cached results affected\n", n, trees);
+	c->ted_gen = gen;
+	return;
+
+lost:
+	pce_log(LOG_DEBUG, "topology changes lost: trees and cached results "
+		"dropped\n");
+	pce_spt_reset(c->spt);
+	c->ted_gen = gen;
+}
+
+/*
+ * pce_cspf_catch_up - Catch up with the topology, unless a batch keeps
+ * the generation it began with
+ */
+static void pce_cspf_catch_up(struct pce_cspf *c)
+{
+	unsigned long gen;
+
+	if (c->batch)
+		return;
+	gen = pce_ted_gen(c->ted);
+	if (gen != c->ted_gen)
+		pce_cspf_sync(c, gen);
+}
+
+/*
+ * pce_cspf_batch_begin - Start computing a batch of requests on the
+ * current topology generation
+ */
+void pce_cspf_batch_begin(struct pce_cspf *c)
+{
+	pce_cspf_catch_up(c);
+	c->batch = 1;
+}
+
+/*
+ * pce_cspf_batch_end - Done with a batch of requests
+ */
+void pce_cspf_batch_end(struct pce_cspf *c)
+{
+	c->batch = 0;
+}
+
+/*
+ * pce_cspf_retry - Tell whether a computation begun at seq (see
+ * pce_ted_read_begin()) read links while they changed, and must be done
+ * again
+ *
+ * The trees grown meanwhile may hold half of a change: they are dropped.
+ */
+static int pce_cspf_retry(struct pce_cspf *c, unsigned long seq)
+{
+	if (!pce_ted_read_retry(c->ted, seq))
+		return 0;
+	pce_spt_reset(c->spt);
+
+	return 1;
+}
+
+/*
+ * pce_cspf_compute - Compute the shortest path meeting the constraints
+ *
+ * The result of a request already computed on the same topology comes
+ * from the cache, path->cached tells whether it did even if there is no
+ * path.
+ *
+ * Returns 0 and fills path, or -1 if there is no such path.
+ */
+int pce_cspf_compute(struct pce_cspf *c, const struct pce_cspf_req *req,
+	struct pce_cspf_path *path)
+{
+	const struct pce_cache_entry *ent;
+	unsigned long gen, seq;
+	int err;
+
+	pce_cspf_catch_up(c);
+	gen = c->ted_gen;
+
+	path->cached = 0;
+	if (c->cache) {
+		ent = pce_cache_lookup(c->cache, req, gen);
+		if (ent) {
+			path->cached = 1;
+			if (!ent->found)
+				return -1;
+			path->hops = ent->hops;
+			path->num_hops = ent->num_hops;
+			path->cost = ent->cost;
+			return 0;
+		}
+	}
+
+	do {
+		seq = pce_ted_read_begin(c->ted);
+		err = pce_cspf_solve(c, req, path);
+	} while (pce_cspf_retry(c, seq));
+
+	if (c->cache)
+		pce_cache_insert(c->cache, req, gen, err ? NULL : path);
+
+	return err;
+}
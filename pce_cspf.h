@@ -0,0 +1,215 @@
+/*
+ * pce_cspf.h - PCE constrained shortest path first interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_CSPF_H
+#define PCE_CSPF_H
+
+#include <stdint.h>
+
+#include "pce_ted.h"
+
+struct pce_cache;
+struct pce_spt_set;
+struct pce_disjoint;
+struct pce_ksp;
+
+/*
+ * A CSPF engine runs a bidirectional Dijkstra over a topology (from the
+ * source along the links, from the destination against them, until the
+ * two searches meet), skipping the links that don't meet the request
+ * constraints. Every event loop owns its engine: the scratch memory (node
+ * labels, heaps, path) is sized once for the topology and reused by every
+ * computation, and it is reset lazily by bumping a generation number, so
+ * a computation only touches the nodes it actually reaches. An engine may
+ * also keep a cache of the results it computed (see pce_cache.h) and the
+ * shortest path trees of its hot sources (see pce_spt.h), both brought
+ * up to date with the topology changes before the next computation.
+ *
+ * The requests of a batch (e.g. a PCReq message) are computed on the
+ * same topology generation: the engine catches up once when the batch
+ * begins, and the changes made meanwhile wait for the next computation
+ * after the batch.
+ */
+
+/* metric to minimize (PCEP METRIC object types) */
+#define PCE_CSPF_METRIC_IGP   1
+#define PCE_CSPF_METRIC_TE    2
+#define PCE_CSPF_METRIC_HOPS  3
+
+/* children per heap node */
+#define PCE_CSPF_HEAP_ARITY   4
+
+struct pce_cspf_req {
+	uint32_t src;		/* router ids (IPv4, host order) */
+	uint32_t dst;
+	float bw;		/* bytes per second, 0: any */
+	int metric;
+	uint32_t exclude_any;	/* affinity constraints (LSPA object) */
+	uint32_t include_any;
+	uint32_t include_all;
+};
+
+/* default computed path cache entries, 0 disables the cache */
+#define PCE_CSPF_CACHE_SIZE   4096
+
+/* a computed path, valid until the next computation of the engine */
+struct pce_cspf_path {
+	const uint32_t *hops;	/* router ids, from source to destination */
+	uint32_t num_hops;
+	uint64_t cost;
+	int cached;		/* result found in the cache, path or not */
+	float bw;		/* share of the bandwidth, load balancing only */
+};
+
+/* per node label */
+struct pce_cspf_node {
+	uint64_t dist;
+	uint32_t prev;		/* previous (forward) or next (backward) node */
+	uint32_t gen;		/* label valid for this generation only */
+	uint32_t pos;		/* heap position, PCE_CSPF_DONE once settled */
+	uint32_t link;		/* link reaching the node, if tracked */
+};
+
+#define PCE_CSPF_DONE (~0U)
+#define PCE_CSPF_INF  (~0ULL)
+
+/* search directions */
+#define PCE_CSPF_FWD 0
+#define PCE_CSPF_BWD 1
+
+/* labels and d-ary heap of a search direction */
+struct pce_cspf_dir {
+	struct pce_cspf_node *nodes;
+	uint32_t *heap;
+	uint32_t heap_len;
+};
+
+struct pce_cspf {
+	const struct pce_ted *ted;
+	uint32_t size;		/* nodes the scratch memory is sized for */
+	uint32_t gen;
+
+	struct pce_cspf_dir dir[2];
+	uint32_t *hops;
+
+	struct pce_cache *cache;	/* NULL if disabled */
+	struct pce_spt_set *spt;
+	struct pce_disjoint *disjoint;	/* allocated on first use */
+	struct pce_ksp *ksp;		/* allocated on first use */
+
+	/* topology generation caught up with, and the changes since */
+	unsigned long ted_gen;
+	int batch;		/* generation kept until the batch ends */
+	uint32_t *changed;	/* links, then their source and destination */
+};
+
+/*
+ * pce_cspf_heap_up - Move a heap entry towards the root
+ */
+static inline void pce_cspf_heap_up(struct pce_cspf_dir *h, uint32_t pos)
+{
+	struct pce_cspf_node *nodes = h->nodes;
+	uint32_t v = h->heap[pos], parent;
+	uint64_t dist = nodes[v].dist;
+
+	while (pos) {
+		parent = (pos - 1) / PCE_CSPF_HEAP_ARITY;
+		if (nodes[h->heap[parent]].dist <= dist)
+			break;
+		h->heap[pos] = h->heap[parent];
+		nodes[h->heap[pos]].pos = pos;
+		pos = parent;
+	}
+	h->heap[pos] = v;
+	nodes[v].pos = pos;
+}
+
+/*
+ * pce_cspf_heap_down - Move a heap entry towards the leaves
+ */
+static inline void pce_cspf_heap_down(struct pce_cspf_dir *h, uint32_t pos)
+{
+	struct pce_cspf_node *nodes = h->nodes;
+	uint32_t v = h->heap[pos], child, last, best, i;
+	uint64_t dist = nodes[v].dist;
+
+	while (1) {
+		child = pos * PCE_CSPF_HEAP_ARITY + 1;
+		if (child >= h->heap_len)
+			break;
+		last = child + PCE_CSPF_HEAP_ARITY;
+		if (last > h->heap_len)
+			last = h->heap_len;
+		best = child;
+		for (i = child + 1; i < last; i++)
+			if (nodes[h->heap[i]].dist < nodes[h->heap[best]].dist)
+				best = i;
+		if (nodes[h->heap[best]].dist >= dist)
+			break;
+		h->heap[pos] = h->heap[best];
+		nodes[h->heap[pos]].pos = pos;
+		pos = best;
+	}
+	h->heap[pos] = v;
+	nodes[v].pos = pos;
+}
+
+/*
+ * pce_cspf_heap_pop - Remove the closest node from the heap
+ */
+static inline uint32_t pce_cspf_heap_pop(struct pce_cspf_dir *h)
+{
+	uint32_t v = h->heap[0];
+
+	h->nodes[v].pos = PCE_CSPF_DONE;
+	if (--h->heap_len) {
+		h->heap[0] = h->heap[h->heap_len];
+		pce_cspf_heap_down(h, 0);
+	}
+
+	return v;
+}
+
+/*
+ * pce_cspf_heap_top - Distance of the closest node in the heap
+ */
+static inline uint64_t pce_cspf_heap_top(struct pce_cspf_dir *h)
+{
+	return h->heap_len ? h->nodes[h->heap[0]].dist : PCE_CSPF_INF;
+}
+
+/*
+ * pce_cspf_link_ok - Check a link against the request constraints
+ */
+static inline int pce_cspf_link_ok(const struct pce_ted *ted,
+	const struct pce_cspf_req *req, uint32_t e)
+{
+	uint32_t aff = ted->affinity[e];
+
+	if (ted->te_metric[e] == PCE_TED_METRIC_DOWN)
+		return 0;
+	if (ted->unrsv_bw[e] < req->bw)
+		return 0;
+	if (aff & req->exclude_any)
+		return 0;
+	if (req->include_any && !(aff & req->include_any))
+		return 0;
+
+	return (aff & req->include_all) == req->include_all;
+}
+
+extern struct pce_cspf *pce_cspf_create(const struct pce_ted *ted,
+	uint32_t cache_size);
+extern void pce_cspf_delete(struct pce_cspf *c);
+
+extern void pce_cspf_batch_begin(struct pce_cspf *c);
+extern void pce_cspf_batch_end(struct pce_cspf *c);
+extern int pce_cspf_compute(struct pce_cspf *c,
+	const struct pce_cspf_req *req, struct pce_cspf_path *path);
+
+#endif /* PCE_CSPF_H */
@@ -0,0 +1,352 @@
+/*
+ * pce_disjoint.c - PCE disjoint paths
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "pce_log.h"
+#include "pce_ted.h"
+#include "pce_cspf.h"
+#include "pce_disjoint.h"
+
+#define PCE_DISJOINT_NONE (~0U)
+
+/* entry and exit states of a node */
+#define pce_disjoint_in(v)  (2 * (v))
+#define pce_disjoint_out(v) (2 * (v) + 1)
+
+/*
+ * pce_disjoint_create - Allocate the scratch memory of an engine, on its
+ * first disjoint paths computation
+ */
+static struct pce_disjoint *pce_disjoint_create(const struct pce_ted *ted)
+{
+	struct pce_disjoint *dj;
+	uint32_t n = ted->num_nodes ? ted->num_nodes : 1;
+	uint32_t m = ted->num_links ? ted->num_links : 1;
+
+	dj = calloc(1, sizeof(*dj));
+	if (!dj)
+		goto err;
+	dj->d.nodes = calloc(2 * (size_t)n, sizeof(*dj->d.nodes));
+	dj->d.heap = malloc(2 * (size_t)n * sizeof(*dj->d.heap));
+	dj->pot = malloc(2 * (size_t)n * sizeof(*dj->pot));
+	dj->flow = calloc(m, sizeof(*dj->flow));
+	dj->used = calloc(n, sizeof(*dj->used));
+	dj->flow_links = malloc(m * sizeof(*dj->flow_links));
+	dj->hops = malloc(PCE_DISJOINT_MAX * (size_t)n * sizeof(*dj->hops));
+	if (!dj->d.nodes || !dj->d.heap || !dj->pot || !dj->flow ||
+		!dj->used || !dj->flow_links || !dj->hops)
+		goto err1;
+
+	return dj;
+
+err1:
+	pce_disjoint_delete(dj);
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_disjoint_delete - Release the scratch memory of an engine
+ */
+void pce_disjoint_delete(struct pce_disjoint *dj)
+{
+	free(dj->d.nodes);
+	free(dj->d.heap);
+	free(dj->pot);
+	free(dj->flow);
+	free(dj->used);
+	free(dj->flow_links);
+	free(dj->hops);
+	free(dj);
+}
+
+/*
+ * pce_disjoint_weight - Weight of a link for a metric
+ */
+static inline int64_t pce_disjoint_weight(const struct pce_ted *ted,
+	int metric, uint32_t e)
+{
+	switch (metric) {
+	case PCE_CSPF_METRIC_IGP:
+		return ted->igp_metric[e];
+	case PCE_CSPF_METRIC_HOPS:
+		return 1;
+	default:
+		return ted->te_metric[e];
+	}
+}
+
+/*
+ * pce_disjoint_link_ok - Check a link against the constraints of all the
+ * requests
+ */
+static inline int pce_disjoint_link_ok(const struct pce_ted *ted,
+	const struct pce_cspf_req *reqs, int num_reqs, uint32_t e)
+{
+	int i;
+
+	for (i = 0; i < num_reqs; i++)
+		if (!pce_cspf_link_ok(ted, &reqs[i], e))
+			return 0;
+
+	return 1;
+}
+
+/*
+ * pce_disjoint_relax - Reach state y from the settled state x, through
+ * link e (PCE_DISJOINT_NONE within a node)
+ */
+static inline void pce_disjoint_relax(struct pce_disjoint *dj, uint32_t x,
+	uint32_t y, uint32_t e, int64_t cost)
+{
+	struct pce_cspf_dir *d = &dj->d;
+	struct pce_cspf_node *w = &d->nodes[y];
+	uint64_t dist;
+	int64_t rc;
+
+	/* reduced cost, never negative with exact potentials */
+	rc = cost + dj->pot[x] - dj->pot[y];
+	dist = d->nodes[x].dist + (rc > 0 ? rc : 0);
+
+	if (w->gen != dj->gen) {
+		w->gen = dj->gen;
+		w->pos = d->heap_len++;
+		d->heap[w->pos] = y;
+	} else if (w->pos == PCE_CSPF_DONE || dist >= w->dist) {
+		return;
+	}
+	w->dist = dist;
+	w->prev = x;
+	w->link = e;
+	pce_cspf_heap_up(d, w->pos);
+}
+
+/*
+ * pce_disjoint_round - Find the shortest path on the residual graph
+ *
+ * Returns 0 and updates the potentials, or -1 if there is no path.
+ */
+static int pce_disjoint_round(struct pce_cspf *c, struct pce_disjoint *dj,
+	const struct pce_cspf_req *reqs, int num_reqs, int mode,
+	uint32_t src, uint32_t dst)
+{
+	const struct pce_ted *ted = c->ted;
+	struct pce_cspf_dir *d = &dj->d;
+	struct pce_cspf_node *nodes = d->nodes;
+	uint32_t t = pce_disjoint_in(dst), x, v, e, i;
+	uint32_t num_states = 2 * ted->num_nodes;
+	int metric = reqs[0].metric;
+	int split;
+	uint64_t dist;
+
+	if (++dj->gen == 0) {
+		memset(nodes, 0, num_states * sizeof(*nodes));
+		dj->gen = 1;
+	}
+	d->heap_len = 0;
+	x = pce_disjoint_out(src);
+	nodes[x].gen = dj->gen;
+	nodes[x].dist = 0;
+	nodes[x].prev = x;
+	nodes[x].link = PCE_DISJOINT_NONE;
+	nodes[x].pos = d->heap_len++;
+	d->heap[0] = x;
+
+	while (d->heap_len) {
+		x = pce_cspf_heap_pop(d);
+		if (x == t)
+			break;
+		v = x / 2;
+
+		/* only one path may cross a node split in two states */
+		split = mode == PCE_DISJOINT_NODE && v != src && v != dst;
+
+		if (x == pce_disjoint_in(v)) {
+			if (!split || !dj->used[v])
+				pce_disjoint_relax(dj, x, pce_disjoint_out(v),
+					PCE_DISJOINT_NONE, 0);
+
+			/* links used by a path, backwards */
+			for (i = ted->rev_row[v]; i < ted->rev_row[v + 1]; i++) {
+				e = ted->rev_link[i];
+				if (dj->flow[e] & PCE_DISJOINT_FLOW)
+					pce_disjoint_relax(dj, x,
+						pce_disjoint_out(ted->rev_src[i]),
+						e, -pce_disjoint_weight(ted,
+						metric, e));
+			}
+		} else {
+			if (!split || dj->used[v])
+				pce_disjoint_relax(dj, x, pce_disjoint_in(v),
+					PCE_DISJOINT_NONE, 0);
+
+			/* links still free */
+			for (e = ted->row[v]; e < ted->row[v + 1]; e++) {
+				if (dj->flow[e] & PCE_DISJOINT_FLOW ||
+					!pce_disjoint_link_ok(ted, reqs,
+						num_reqs, e))
+					continue;
+				pce_disjoint_relax(dj, x,
+					pce_disjoint_in(ted->dst[e]), e,
+					pce_disjoint_weight(ted, metric, e));
+			}
+		}
+	}
+	if (nodes[t].gen != dj->gen || nodes[t].pos != PCE_CSPF_DONE)
+		return -1;
+
+	/* states not settled closer than the destination get its distance */
+	dist = nodes[t].dist;
+	for (x = 0; x < num_states; x++) {
+		if (nodes[x].gen == dj->gen && nodes[x].pos == PCE_CSPF_DONE &&
+			nodes[x].dist < dist)
+			dj->pot[x] += nodes[x].dist;
+		else
+			dj->pot[x] += dist;
+	}
+
+	return 0;
+}
+
+/*
+ * pce_disjoint_augment - Add the path found to the flow: the links walked
+ * forwards now carry it, the ones walked backwards don't anymore
+ */
+static void pce_disjoint_augment(struct pce_disjoint *dj, uint32_t src,
+	uint32_t dst)
+{
+	struct pce_cspf_node *nodes = dj->d.nodes;
+	uint32_t y = pce_disjoint_in(dst), x, e;
+
+	while (y != pce_disjoint_out(src)) {
+		x = nodes[y].prev;
+		e = nodes[y].link;
+		if (e == PCE_DISJOINT_NONE) {
+			dj->used[x / 2] = x == pce_disjoint_in(x / 2);
+		} else if (x == pce_disjoint_out(x / 2)) {
+			if (!(dj->flow[e] & PCE_DISJOINT_LISTED))
+				dj->flow_links[dj->num_flow_links++] = e;
+			dj->flow[e] |= PCE_DISJOINT_FLOW | PCE_DISJOINT_LISTED;
+		} else {
+			dj->flow[e] &= ~PCE_DISJOINT_FLOW;
+		}
+		y = x;
+	}
+}
+
+/*
+ * pce_disjoint_path - Take a path out of the flow, from the source to the
+ * destination
+ */
+static int pce_disjoint_path(const struct pce_ted *ted,
+	struct pce_disjoint *dj, int metric, uint32_t src, uint32_t dst,
+	uint32_t *hops, struct pce_cspf_path *path)
+{
+	uint32_t v = src, e, n = 0;
+	uint64_t cost = 0;
+
+	hops[n++] = ted->node_id[src];
+	while (v != dst) {
+		for (e = ted->row[v]; e < ted->row[v + 1]; e++)
+			if (dj->flow[e] & PCE_DISJOINT_FLOW)
+				break;
+		if (e == ted->row[v + 1] || n == ted->num_nodes)
+			return -1;
+		dj->flow[e] &= ~PCE_DISJOINT_FLOW;
+		cost += pce_disjoint_weight(ted, metric, e);
+		v = ted->dst[e];
+		hops[n++] = ted->node_id[v];
+	}
+	path->hops = hops;
+	path->num_hops = n;
+	path->cost = cost;
+	path->cached = 0;
+
+	return 0;
+}
+
+/*
+ * pce_disjoint_run - Compute the disjoint paths, see pce_disjoint_compute()
+ */
+static int pce_disjoint_run(struct pce_cspf *c, struct pce_disjoint *dj,
+	const struct pce_cspf_req *reqs, int num_paths, int mode, long src,
+	long dst, struct pce_cspf_path *paths)
+{
+	const struct pce_ted *ted = c->ted;
+	uint32_t i, e;
+	int n;
+
+	memset(dj->pot, 0, 2 * (size_t)ted->num_nodes * sizeof(*dj->pot));
+
+	for (n = 0; n < num_paths; n++) {
+		if (pce_disjoint_round(c, dj, reqs, num_paths, mode, src, dst))
+			break;
+		pce_disjoint_augment(dj, src, dst);
+	}
+	num_paths = n;
+	for (n = 0; n < num_paths; n++)
+		if (pce_disjoint_path(ted, dj, reqs[0].metric, src, dst,
+			dj->hops + n * (size_t)ted->num_nodes, &paths[n]))
+			break;
+
+	/* leave the scratch memory clean for the next computation */
+	for (i = 0; i < dj->num_flow_links; i++) {
+		e = dj->flow_links[i];
+		dj->flow[e] = 0;
+		dj->used[pce_ted_link_src(ted, e)] = 0;
+		dj->used[ted->dst[e]] = 0;
+	}
+	dj->num_flow_links = 0;
+
+	return n;
+}
+
+/*
+ * pce_disjoint_compute - Compute num_paths link or node disjoint paths
+ * between the end points of the requests (all the same), meeting the
+ * constraints of all of them
+ *
+ * The paths are valid until the next computation of the engine. Returns
+ * the number of paths found, as many as there are up to num_paths.
+ * Computed again if the links changed meanwhile.
+ */
+int pce_disjoint_compute(struct pce_cspf *c, const struct pce_cspf_req *reqs,
+	int num_paths, int mode, struct pce_cspf_path *paths)
+{
+	const struct pce_ted *ted = c->ted;
+	struct pce_disjoint *dj;
+	unsigned long seq;
+	long src, dst;
+	int n;
+
+	src = pce_ted_node(ted, reqs[0].src);
+	dst = pce_ted_node(ted, reqs[0].dst);
+	if (src < 0 || dst < 0 || src == dst)
+		return 0;
+	if (num_paths > PCE_DISJOINT_MAX)
+		num_paths = PCE_DISJOINT_MAX;
+
+	if (!c->disjoint) {
+		c->disjoint = pce_disjoint_create(ted);
+		if (!c->disjoint)
+			return 0;
+	}
+	dj = c->disjoint;
+
+	do {
+		seq = pce_ted_read_begin(ted);
+		n = pce_disjoint_run(c, dj, reqs, num_paths, mode, src, dst,
+			paths);
+	} while (pce_ted_read_retry(ted, seq));
+
+	return n;
+}
@@ -0,0 +1,56 @@
+/*
+ * pce_disjoint.h - PCE disjoint paths interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_DISJOINT_H
+#define PCE_DISJOINT_H
+
+#include <stdint.h>
+
+#include "pce_cspf.h"
+
+/*
+ * Up to PCE_DISJOINT_MAX link or node disjoint paths between two nodes,
+ * with the least total cost, computed jointly (Suurballe, as generalized
+ * by Bhandari): every path found is a shortest path on the residual graph
+ * of the previous ones, where the links already used may be walked
+ * backwards at a negative cost, so a later path can reroute an earlier
+ * one instead of being blocked by it. Node potentials keep the reduced
+ * costs non-negative, so every round is a plain Dijkstra.
+ *
+ * For node disjoint paths every node is split in an entry and an exit
+ * state, joined by an arc only one path can take, so the search runs
+ * over two states per node in both cases.
+ */
+
+#define PCE_DISJOINT_MAX  4	/* paths per computation */
+
+#define PCE_DISJOINT_LINK 0
+#define PCE_DISJOINT_NODE 1
+
+/* a link carrying a path, and listed for the cleanup */
+#define PCE_DISJOINT_FLOW   0x01
+#define PCE_DISJOINT_LISTED 0x02
+
+struct pce_disjoint {
+	uint32_t gen;
+	struct pce_cspf_dir d;		/* two states per node */
+	int64_t *pot;			/* state potentials */
+	unsigned char *flow;		/* per link */
+	unsigned char *used;		/* per node, crossed by a path */
+	uint32_t *flow_links;
+	uint32_t num_flow_links;
+	uint32_t *hops;			/* PCE_DISJOINT_MAX paths */
+};
+
+extern void pce_disjoint_delete(struct pce_disjoint *dj);
+
+extern int pce_disjoint_compute(struct pce_cspf *c,
+	const struct pce_cspf_req *reqs, int num_paths, int mode,
+	struct pce_cspf_path *paths);
+
+#endif /* PCE_DISJOINT_H */
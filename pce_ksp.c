@@ -0,0 +1,568 @@
+/*
+ * pce_ksp.c - PCE k shortest paths
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "pce_log.h"
+#include "pce_ted.h"
+#include "pce_cspf.h"
+#include "pce_ksp.h"
+
+#define PCE_KSP_NONE (~0U)
+
+/*
+ * pce_ksp_create - Allocate the scratch memory of an engine, on its first
+ * load balancing computation
+ */
+static struct pce_ksp *pce_ksp_create(const struct pce_ted *ted)
+{
+	struct pce_ksp *k;
+	uint32_t n = ted->num_nodes ? ted->num_nodes : 1;
+	uint32_t m = ted->num_links ? ted->num_links : 1;
+
+	k = calloc(1, sizeof(*k));
+	if (!k)
+		goto err;
+	k->fwd.nodes = calloc(n, sizeof(*k->fwd.nodes));
+	k->fwd.heap = malloc(n * sizeof(*k->fwd.heap));
+	k->bwd.nodes = calloc(n, sizeof(*k->bwd.nodes));
+	k->bwd.heap = malloc(n * sizeof(*k->bwd.heap));
+	k->node_mark = calloc(n, sizeof(*k->node_mark));
+	k->link_mark = calloc(m, sizeof(*k->link_mark));
+	k->bw_run = calloc(m, sizeof(*k->bw_run));
+	k->bw = malloc(m * sizeof(*k->bw));
+	if (!k->fwd.nodes || !k->fwd.heap || !k->bwd.nodes || !k->bwd.heap ||
+		!k->node_mark || !k->link_mark || !k->bw_run || !k->bw)
+		goto err1;
+
+	return k;
+
+err1:
+	pce_ksp_delete(k);
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_ksp_delete - Release the scratch memory of an engine
+ */
+void pce_ksp_delete(struct pce_ksp *k)
+{
+	free(k->fwd.nodes);
+	free(k->fwd.heap);
+	free(k->bwd.nodes);
+	free(k->bwd.heap);
+	free(k->node_mark);
+	free(k->link_mark);
+	free(k->bw_run);
+	free(k->bw);
+	free(k->links);
+	free(k->hops);
+	free(k);
+}
+
+/*
+ * pce_ksp_weight - Weight of a link for a metric
+ */
+static inline uint64_t pce_ksp_weight(const struct pce_ted *ted, int metric,
+	uint32_t e)
+{
+	switch (metric) {
+	case PCE_CSPF_METRIC_IGP:
+		return ted->igp_metric[e];
+	case PCE_CSPF_METRIC_HOPS:
+		return 1;
+	default:
+		return ted->te_metric[e];
+	}
+}
+
+/*
+ * pce_ksp_label - Label a node reached through a link, if it is closer
+ */
+static inline void pce_ksp_label(struct pce_cspf_dir *d, uint32_t gen,
+	uint32_t v, uint32_t prev, uint32_t link, uint64_t dist)
+{
+	struct pce_cspf_node *w = &d->nodes[v];
+
+	if (w->gen != gen) {
+		w->gen = gen;
+		w->pos = d->heap_len++;
+		d->heap[w->pos] = v;
+	} else if (w->pos == PCE_CSPF_DONE || dist >= w->dist) {
+		return;
+	}
+	w->dist = dist;
+	w->prev = prev;
+	w->link = link;
+	pce_cspf_heap_up(d, w->pos);
+}
+
+/*
+ * pce_ksp_dist - Distance of a node to the destination, PCE_CSPF_INF if
+ * it can't reach it
+ */
+static inline uint64_t pce_ksp_dist(const struct pce_ksp *k, uint32_t v)
+{
+	const struct pce_cspf_node *w = &k->bwd.nodes[v];
+
+	if (w->gen != k->run || w->pos != PCE_CSPF_DONE)
+		return PCE_CSPF_INF;
+	return w->dist;
+}
+
+/*
+ * pce_ksp_bw - Bandwidth left on a link by the paths already taken
+ */
+static inline float pce_ksp_bw(const struct pce_ksp *k,
+	const struct pce_ted *ted, uint32_t e)
+{
+	return k->bw_run[e] == k->run ? k->bw[e] : ted->unrsv_bw[e];
+}
+
+/*
+ * pce_ksp_reserve - Make room for n more links in the arena
+ */
+static int pce_ksp_reserve(struct pce_ksp *k, uint32_t n)
+{
+	uint32_t *links, size;
+
+	if (k->num_links + n <= k->max_links)
+		return 0;
+	size = k->max_links ? k->max_links : 256;
+	while (size < k->num_links + n)
+		size *= 2;
+	links = realloc(k->links, size * sizeof(*links));
+	if (!links) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		return -1;
+	}
+	k->links = links;
+	k->max_links = size;
+
+	return 0;
+}
+
+/*
+ * pce_ksp_hash - Hash the links of a path, to tell paths apart quickly
+ */
+static uint32_t pce_ksp_hash(const uint32_t *links, uint32_t n)
+{
+	uint32_t h = 2166136261U, i;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ links[i]) * 16777619U;
+
+	return h;
+}
+
+/*
+ * pce_ksp_same - Check whether two paths are the same
+ */
+static inline int pce_ksp_same(const struct pce_ksp *k,
+	const struct pce_ksp_path *a, const struct pce_ksp_path *b)
+{
+	return a->hash == b->hash && a->num_links == b->num_links &&
+		!memcmp(k->links + a->link, k->links + b->link,
+			a->num_links * sizeof(*k->links));
+}
+
+/*
+ * pce_ksp_worst - Most expensive candidate
+ */
+static struct pce_ksp_path *pce_ksp_worst(struct pce_ksp *k)
+{
+	struct pce_ksp_path *worst = &k->cands[0];
+	uint32_t i;
+
+	for (i = 1; i < k->num_cands; i++)
+		if (k->cands[i].cost > worst->cost)
+			worst = &k->cands[i];
+
+	return worst;
+}
+
+/*
+ * pce_ksp_tree - Search the distances to the destination, against the
+ * links, and take the first path from the tree
+ *
+ * Returns -1 if the source can't reach the destination.
+ */
+static int pce_ksp_tree(struct pce_ksp *k, const struct pce_ted *ted,
+	const struct pce_cspf_req *req, uint32_t src, uint32_t dst,
+	uint64_t *work)
+{
+	struct pce_cspf_dir *d = &k->bwd;
+	struct pce_ksp_path *p = &k->paths[0];
+	uint32_t u, v, e, i, n;
+
+	d->heap_len = 0;
+	pce_ksp_label(d, k->run, dst, dst, PCE_KSP_NONE, 0);
+	while (d->heap_len) {
+		u = pce_cspf_heap_pop(d);
+		for (i = ted->rev_row[u]; i < ted->rev_row[u + 1]; i++) {
+			e = ted->rev_link[i];
+			if (!pce_cspf_link_ok(ted, req, e))
+				continue;
+			pce_ksp_label(d, k->run, ted->rev_src[i], u, e,
+				d->nodes[u].dist +
+				pce_ksp_weight(ted, req->metric, e));
+		}
+		*work += ted->rev_row[u + 1] - ted->rev_row[u];
+	}
+	if (pce_ksp_dist(k, src) == PCE_CSPF_INF)
+		return -1;
+
+	for (n = 0, v = src; v != dst; v = d->nodes[v].prev)
+		n++;
+	if (pce_ksp_reserve(k, n))
+		return -1;
+	for (n = 0, v = src; v != dst; v = d->nodes[v].prev)
+		k->links[k->num_links + n++] = d->nodes[v].link;
+
+	p->link = k->num_links;
+	p->num_links = n;
+	p->dev = 0;
+	p->hash = pce_ksp_hash(k->links + p->link, n);
+	p->cost = pce_ksp_dist(k, src);
+	k->num_links += n;
+	k->num_paths = 1;
+
+	return 0;
+}
+
+/*
+ * pce_ksp_cut - Cut the root of a spur search, the first i hops of path
+ * p, and the links the paths examined with the same root took next
+ */
+static void pce_ksp_cut(struct pce_ksp *k, const struct pce_ted *ted,
+	const struct pce_ksp_path *p, uint32_t i, uint32_t src)
+{
+	const struct pce_ksp_path *q;
+	uint32_t j;
+
+	if (++k->mark == 0) {
+		memset(k->node_mark, 0,
+			ted->num_nodes * sizeof(*k->node_mark));
+		memset(k->link_mark, 0,
+			ted->num_links * sizeof(*k->link_mark));
+		k->mark = 1;
+	}
+
+	if (i)
+		k->node_mark[src] = k->mark;
+	for (j = 0; j + 1 < i; j++)
+		k->node_mark[ted->dst[k->links[p->link + j]]] = k->mark;
+
+	for (q = k->paths; q < k->paths + k->num_paths; q++)
+		if (q->num_links > i && !memcmp(k->links + q->link,
+			k->links + p->link, i * sizeof(*k->links)))
+			k->link_mark[k->links[q->link + i]] = k->mark;
+}
+
+/*
+ * pce_ksp_candidate - Keep the root of path p followed by the spur
+ * found, unless it was already found
+ */
+static void pce_ksp_candidate(struct pce_ksp *k, const struct pce_ksp_path *p,
+	uint32_t i, uint32_t spur, uint32_t dst, uint64_t cost)
+{
+	struct pce_cspf_node *nodes = k->fwd.nodes;
+	struct pce_ksp_path cand, *q;
+	uint32_t v, j, n = i;
+
+	for (v = dst; v != spur; v = nodes[v].prev)
+		n++;
+	if (pce_ksp_reserve(k, n))
+		return;
+	memcpy(k->links + k->num_links, k->links + p->link,
+		i * sizeof(*k->links));
+	for (v = dst, j = n; v != spur; v = nodes[v].prev)
+		k->links[k->num_links + --j] = nodes[v].link;
+
+	cand.link = k->num_links;
+	cand.num_links = n;
+	cand.dev = i;
+	cand.hash = pce_ksp_hash(k->links + cand.link, cand.num_links);
+	cand.cost = cost;
+
+	for (q = k->paths; q < k->paths + k->num_paths; q++)
+		if (pce_ksp_same(k, q, &cand))
+			return;
+	for (q = k->cands; q < k->cands + k->num_cands; q++)
+		if (pce_ksp_same(k, q, &cand))
+			return;
+
+	/* the worst candidate is more expensive, the search made sure */
+	if (k->num_cands < PCE_KSP_K - k->num_paths)
+		q = &k->cands[k->num_cands++];
+	else
+		q = pce_ksp_worst(k);
+	*q = cand;
+	k->num_links += cand.num_links;
+}
+
+/*
+ * pce_ksp_spur - Search the spur of path p from its hop i, an A* search
+ * driven by the distances to the destination
+ *
+ * A spur is only worth it if it beats the worst candidate kept, when
+ * there is no room left for more.
+ */
+static void pce_ksp_spur(struct pce_ksp *k, const struct pce_ted *ted,
+	const struct pce_cspf_req *req, const struct pce_ksp_path *p,
+	uint32_t i, uint32_t spur, uint32_t dst, uint64_t root,
+	uint64_t *work)
+{
+	struct pce_cspf_dir *d = &k->fwd;
+	uint64_t limit = PCE_CSPF_INF, h, g;
+	uint32_t u, v, e;
+
+	if (k->num_cands == PCE_KSP_K - k->num_paths) {
+		h = pce_ksp_worst(k)->cost;
+		if (h <= root)
+			return;
+		limit = h - root;
+	}
+	h = pce_ksp_dist(k, spur);
+	if (h >= limit)
+		return;
+
+	if (++k->gen == 0) {
+		memset(d->nodes, 0, ted->num_nodes * sizeof(*d->nodes));
+		k->gen = 1;
+	}
+	d->heap_len = 0;
+	pce_ksp_label(d, k->gen, spur, spur, PCE_KSP_NONE, h);
+	while (d->heap_len) {
+		u = pce_cspf_heap_pop(d);
+		if (d->nodes[u].dist >= limit)
+			return;
+		if (u == dst) {
+			pce_ksp_candidate(k, p, i, spur, dst,
+				root + d->nodes[u].dist);
+			return;
+		}
+
+		/* the labels are lower bounds of the whole spur cost */
+		g = d->nodes[u].dist - pce_ksp_dist(k, u);
+		for (e = ted->row[u]; e < ted->row[u + 1]; e++) {
+			v = ted->dst[e];
+			if (k->link_mark[e] == k->mark ||
+				k->node_mark[v] == k->mark ||
+				!pce_cspf_link_ok(ted, req, e))
+				continue;
+			h = pce_ksp_dist(k, v);
+			if (h == PCE_CSPF_INF)
+				continue;
+			pce_ksp_label(d, k->gen, v, u, e,
+				g + pce_ksp_weight(ted, req->metric, e) + h);
+		}
+		*work += ted->row[u + 1] - ted->row[u];
+	}
+}
+
+/*
+ * pce_ksp_spurs - Search the spurs of the last path examined, until the
+ * work budget runs out
+ */
+static void pce_ksp_spurs(struct pce_ksp *k, const struct pce_ted *ted,
+	const struct pce_cspf_req *req, uint32_t src, uint32_t dst,
+	uint64_t budget, uint64_t *work)
+{
+	const struct pce_ksp_path *p = &k->paths[k->num_paths - 1];
+	uint64_t root = 0;
+	uint32_t i, v = src, e;
+
+	for (i = 0; i < p->num_links && *work < budget; i++) {
+		if (i >= p->dev) {
+			pce_ksp_cut(k, ted, p, i, src);
+			pce_ksp_spur(k, ted, req, p, i, v, dst, root, work);
+		}
+		e = k->links[p->link + i];
+		root += pce_ksp_weight(ted, req->metric, e);
+		v = ted->dst[e];
+	}
+}
+
+/*
+ * pce_ksp_next - Examine the cheapest candidate
+ */
+static void pce_ksp_next(struct pce_ksp *k)
+{
+	uint32_t i, best = 0;
+
+	for (i = 1; i < k->num_cands; i++)
+		if (k->cands[i].cost < k->cands[best].cost)
+			best = i;
+	k->paths[k->num_paths++] = k->cands[best];
+	k->cands[best] = k->cands[--k->num_cands];
+}
+
+/*
+ * pce_ksp_share - Bandwidth a path takes: what is still missing (but at
+ * least min_bw), as far as its links have it left
+ *
+ * Returns 0 if the path can't take min_bw.
+ */
+static float pce_ksp_share(struct pce_ksp *k, const struct pce_ted *ted,
+	const struct pce_ksp_path *p, float need, float min_bw)
+{
+	const uint32_t *links = k->links + p->link;
+	float share = need > min_bw ? need : min_bw, bw;
+	uint32_t i;
+
+	for (i = 0; i < p->num_links; i++) {
+		bw = pce_ksp_bw(k, ted, links[i]);
+		if (bw < share)
+			share = bw;
+	}
+	if (share <= 0 || share < min_bw)
+		return 0;
+
+	for (i = 0; i < p->num_links; i++) {
+		bw = pce_ksp_bw(k, ted, links[i]);
+		k->bw_run[links[i]] = k->run;
+		k->bw[links[i]] = bw - share;
+	}
+
+	return share;
+}
+
+/*
+ * pce_ksp_hops - Turn the paths taken into router ids
+ */
+static int pce_ksp_hops(struct pce_ksp *k, const struct pce_ted *ted,
+	uint32_t src, const uint32_t *taken, const float *bw, int n,
+	struct pce_cspf_path *paths)
+{
+	const struct pce_ksp_path *p;
+	uint32_t *hops, size = 0, i;
+	int j;
+
+	for (j = 0; j < n; j++)
+		size += k->paths[taken[j]].num_links + 1;
+	if (size > k->max_hops) {
+		hops = realloc(k->hops, size * sizeof(*hops));
+		if (!hops) {
+			pce_log(LOG_ERR, "failed to get memory\n");
+			return -1;
+		}
+		k->hops = hops;
+		k->max_hops = size;
+	}
+
+	hops = k->hops;
+	for (j = 0; j < n; j++) {
+		p = &k->paths[taken[j]];
+		hops[0] = ted->node_id[src];
+		for (i = 0; i < p->num_links; i++)
+			hops[i + 1] = ted->node_id[ted->dst[k->links[p->link + i]]];
+		paths[j].hops = hops;
+		paths[j].num_hops = p->num_links + 1;
+		paths[j].cost = p->cost;
+		paths[j].cached = 0;
+		paths[j].bw = bw[j];
+		hops += p->num_links + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * pce_ksp_run - Compute the paths of a request, see pce_ksp_compute()
+ */
+static int pce_ksp_run(struct pce_ksp *k, const struct pce_ted *ted,
+	const struct pce_cspf_req *req, long src, long dst, int max_paths,
+	float min_bw, struct pce_cspf_path *paths)
+{
+	struct pce_cspf_req r = *req;
+	uint32_t taken[PCE_KSP_MAX];
+	float bw[PCE_KSP_MAX], need = req->bw, share;
+	uint64_t work = 0, budget;
+	int n = 0;
+
+	if (++k->run == 0) {
+		memset(k->bwd.nodes, 0, ted->num_nodes * sizeof(*k->bwd.nodes));
+		memset(k->bw_run, 0, ted->num_links * sizeof(*k->bw_run));
+		k->run = 1;
+	}
+	k->num_links = 0;
+	k->num_paths = 0;
+	k->num_cands = 0;
+
+	/* a link not even carrying min_bw is no use */
+	r.bw = min_bw;
+	budget = PCE_KSP_WORK * (uint64_t)ted->num_links;
+	if (pce_ksp_tree(k, ted, &r, src, dst, &work))
+		return 0;
+
+	while (1) {
+		share = pce_ksp_share(k, ted, &k->paths[k->num_paths - 1],
+			need, min_bw);
+		if (share > 0 || need <= 0) {
+			taken[n] = k->num_paths - 1;
+			bw[n++] = share;
+			need -= share;
+		}
+		if (need <= 0 || n == max_paths || k->num_paths == PCE_KSP_K)
+			break;
+
+		if (work < budget)
+			pce_ksp_spurs(k, ted, &r, src, dst, budget, &work);
+		if (!k->num_cands)
+			break;
+		pce_ksp_next(k);
+	}
+	if (need > 0 || pce_ksp_hops(k, ted, src, taken, bw, n, paths))
+		return 0;
+
+	return n;
+}
+
+/*
+ * pce_ksp_compute - Compute up to max_paths paths carrying together the
+ * bandwidth of the request, each at least min_bw
+ *
+ * The paths are valid until the next computation of the engine. Returns
+ * the number of paths, 0 if the bandwidth can't be met within the bounds.
+ * Without bandwidth the shortest path alone does. Computed again if the
+ * links changed meanwhile.
+ */
+int pce_ksp_compute(struct pce_cspf *c, const struct pce_cspf_req *req,
+	int max_paths, float min_bw, struct pce_cspf_path *paths)
+{
+	const struct pce_ted *ted = c->ted;
+	unsigned long seq;
+	long src, dst;
+	int n;
+
+	src = pce_ted_node(ted, req->src);
+	dst = pce_ted_node(ted, req->dst);
+	if (src < 0 || dst < 0 || src == dst)
+		return 0;
+	if (max_paths > PCE_KSP_MAX)
+		max_paths = PCE_KSP_MAX;
+
+	if (!c->ksp) {
+		c->ksp = pce_ksp_create(ted);
+		if (!c->ksp)
+			return 0;
+	}
+
+	do {
+		seq = pce_ted_read_begin(ted);
+		n = pce_ksp_run(c->ksp, ted, req, src, dst, max_paths, min_bw,
+			paths);
+	} while (pce_ted_read_retry(ted, seq));
+
+	return n;
+}
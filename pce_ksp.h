@@ -0,0 +1,81 @@
+/*
+ * pce_ksp.h - PCE k shortest paths interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_KSP_H
+#define PCE_KSP_H
+
+#include <stdint.h>
+
+#include "pce_cspf.h"
+
+/*
+ * Load balancing splits the bandwidth of a request over up to
+ * PCE_KSP_MAX paths, taken in increasing cost order from the k shortest
+ * loopless paths (Yen): every path found is a root, a prefix of an
+ * earlier path, followed by a spur, a shortest path from the end of the
+ * root that avoids the root and the links the earlier paths with the same
+ * root took next. Only the spurs past the node where a path deviated
+ * from its parent are searched (Lawler).
+ *
+ * The work is shared by all the spur searches: a single backward search
+ * from the destination gives the exact distance of every node to it, the
+ * first path, and the A* heuristic that drives every spur search straight
+ * to the destination. A spur search also stops as soon as it can't beat
+ * the candidates already kept, and only as many candidates as there are
+ * paths left to find are kept.
+ *
+ * Links below the minimum bandwidth of a path are pruned, and every path
+ * takes what is left on its links by the cheaper paths, up to the
+ * bandwidth still missing. The computation is bounded in paths examined
+ * (PCE_KSP_K) and in links scanned (PCE_KSP_WORK times the topology
+ * links): past the latter, the candidates already found are still taken
+ * but no new ones are searched.
+ */
+
+#define PCE_KSP_MAX  8		/* paths answered */
+#define PCE_KSP_K    16		/* paths examined */
+#define PCE_KSP_WORK 16		/* links scanned, per topology link */
+
+/* a path examined, its links in the engine arena */
+struct pce_ksp_path {
+	uint32_t link;		/* first link in the arena */
+	uint32_t num_links;
+	uint32_t dev;		/* spurs searched from this hop on */
+	uint32_t hash;
+	uint64_t cost;
+};
+
+struct pce_ksp {
+	uint32_t gen;		/* spur search labels */
+	uint32_t mark;		/* nodes and links cut for a spur search */
+	uint32_t run;		/* link residual bandwidth */
+	struct pce_cspf_dir fwd;	/* spur searches */
+	struct pce_cspf_dir bwd;	/* distances to the destination */
+	uint32_t *node_mark;
+	uint32_t *link_mark;
+	uint32_t *bw_run;
+	float *bw;
+
+	uint32_t *links;	/* arena of the paths examined */
+	uint32_t num_links;
+	uint32_t max_links;
+	uint32_t *hops;		/* paths answered, node ids */
+	uint32_t max_hops;
+
+	struct pce_ksp_path paths[PCE_KSP_K];	/* examined, by cost */
+	struct pce_ksp_path cands[PCE_KSP_K];	/* candidates */
+	uint32_t num_paths;
+	uint32_t num_cands;
+};
+
+extern void pce_ksp_delete(struct pce_ksp *k);
+
+extern int pce_ksp_compute(struct pce_cspf *c, const struct pce_cspf_req *req,
+	int max_paths, float min_bw, struct pce_cspf_path *paths);
+
+#endif /* PCE_KSP_H */
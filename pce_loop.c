@@ -0,0 +1,213 @@
+/*
+ * pce_loop.c - PCE event loop (epoll based)
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "pce_log.h"
+#include "pce_loop.h"
+#include "pce_timer.h"
+
+/* max number of events handled per loop iteration */
+#define PCE_LOOP_EVENTS 256
+
+struct pce_loop {
+	int efd;
+	int running;
+	struct pce_timers *timers;
+
+	/* events returned by the last epoll_wait() */
+	struct epoll_event events[PCE_LOOP_EVENTS];
+	int num_events;
+	int curr_event;
+};
+
+/*
+ * pce_loop_create - Create a new event loop
+ */
+struct pce_loop *pce_loop_create(void)
+{
+	struct pce_loop *l;
+
+	l = calloc(1, sizeof(*l));
+	if (!l) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto out;
+	}
+
+	l->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (l->efd < 0) {
+		pce_log(LOG_ERR, "failure in epoll_create1(): %s\n",
+			strerror(errno));
+		goto out1;
+	}
+
+	l->timers = pce_timers_create(l);
+	if (!l->timers)
+		goto out2;
+
+	return l;
+
+out2:
+	close(l->efd);
+out1:
+	free(l);
+out:
+	return NULL;
+}
+
+/*
+ * pce_loop_delete - Delete the event loop
+ */
+void pce_loop_delete(struct pce_loop *l)
+{
+	pce_timers_delete(l, l->timers);
+	close(l->efd);
+	free(l);
+}
+
+/*
+ * pce_loop_add - Start watching an event source
+ */
+int pce_loop_add(struct pce_loop *l, struct pce_loop_event *ev,
+	unsigned int events)
+{
+	struct epoll_event ee;
+
+	ee.events = events;
+	ee.data.ptr = ev;
+	return epoll_ctl(l->efd, EPOLL_CTL_ADD, ev->fd, &ee);
+}
+
+/*
+ * pce_loop_add_listener - Start watching a listening socket
+ *
+ * The handler is notified when connections are ready to be accepted.
+ */
+int pce_loop_add_listener(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	return pce_loop_add(l, ev, PCE_LOOP_IN);
+}
+
+/*
+ * pce_loop_add_stream - Start watching a connected socket
+ *
+ * The handler is notified when data is ready to be read.
+ */
+int pce_loop_add_stream(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	return pce_loop_add(l, ev, PCE_LOOP_IN);
+}
+
+/*
+ * pce_loop_mod - Change the events of interest of an event source
+ */
+int pce_loop_mod(struct pce_loop *l, struct pce_loop_event *ev,
+	unsigned int events)
+{
+	struct epoll_event ee;
+
+	ee.events = events;
+	ee.data.ptr = ev;
+	return epoll_ctl(l->efd, EPOLL_CTL_MOD, ev->fd, &ee);
+}
+
+/*
+ * pce_loop_del - Stop watching an event source
+ *
+ * The event source can be released as soon as this returns, even from
+ * within a handler: any of its events still pending in the current batch
+ * are discarded.
+ */
+int pce_loop_del(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	int i;
+
+	for (i = l->curr_event + 1; i < l->num_events; i++)
+		if (l->events[i].data.ptr == ev)
+			l->events[i].data.ptr = NULL;
+
+	return epoll_ctl(l->efd, EPOLL_CTL_DEL, ev->fd, NULL);
+}
+
+/*
+ * pce_loop_sends - Tell whether the loop writes to stream sources: it
+ * doesn't, their handler is notified when they're writable
+ */
+int pce_loop_sends(struct pce_loop *l)
+{
+	return 0;
+}
+
+/*
+ * pce_loop_send - Not supported, see pce_loop_sends()
+ */
+int pce_loop_send(struct pce_loop *l, struct pce_loop_event *ev,
+	char *buf, size_t off, size_t len)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+/*
+ * pce_loop_timers - Return the timer wheel of the event loop
+ */
+struct pce_timers *pce_loop_timers(struct pce_loop *l)
+{
+	return l->timers;
+}
+
+/*
+ * pce_loop_run - Dispatch events until pce_loop_stop() is called
+ */
+int pce_loop_run(struct pce_loop *l)
+{
+	struct pce_loop_event *ev;
+
+	l->running = 1;
+	while (l->running) {
+
+		/* block on interested events */
+		l->num_events = epoll_wait(l->efd, l->events,
+			PCE_LOOP_EVENTS, -1);
+		if (l->num_events < 0) {
+			l->num_events = 0;
+			if (errno == EINTR)
+				continue;
+			pce_log(LOG_ERR, "failure in epoll_wait(): %s\n",
+				strerror(errno));
+			return -1;
+		}
+
+		/* dispatch events to their handlers */
+		for (l->curr_event = 0; l->curr_event < l->num_events;
+			l->curr_event++) {
+			ev = l->events[l->curr_event].data.ptr;
+			if (ev)
+				ev->handler(ev,
+					l->events[l->curr_event].events);
+		}
+		l->num_events = 0;
+		l->curr_event = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * pce_loop_stop - Make pce_loop_run() return after the current iteration
+ */
+void pce_loop_stop(struct pce_loop *l)
+{
+	l->running = 0;
+}
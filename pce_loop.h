@@ -0,0 +1,70 @@
+/*
+ * pce_loop.h - PCE event loop interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_LOOP_H
+#define PCE_LOOP_H
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+/* events of interest */
+#define PCE_LOOP_IN   EPOLLIN
+#define PCE_LOOP_OUT  EPOLLOUT
+#define PCE_LOOP_ERR  EPOLLERR
+#define PCE_LOOP_HUP  EPOLLHUP
+
+/*
+ * An event source (socket, timer, ...) watched by the event loop. It is
+ * usually embedded in the structure owning the file descriptor and the
+ * handlers use container_of() to get back to it.
+ *
+ * Readiness based backends (epoll) always call handler(). Completion based
+ * backends (io_uring) call handler() for sources added by pce_loop_add(),
+ * hand accepted connections to accept() for listening sources and received
+ * data to recv() for stream sources (count <= 0 on hang-up or error).
+ *
+ * Completion based backends also write to stream sources (see
+ * pce_loop_sends()): the buffer given to pce_loop_send() is handed back to
+ * sent() with the count written (< 0 on error), or freed by the loop if the
+ * source is removed meanwhile.
+ */
+struct pce_loop_event {
+	int fd;
+	void (*handler)(struct pce_loop_event *ev, unsigned int events);
+	void (*accept)(struct pce_loop_event *ev, int cfd);
+	void (*recv)(struct pce_loop_event *ev, char *buf, ssize_t count);
+	void (*sent)(struct pce_loop_event *ev, char *buf, ssize_t count);
+
+	/* backend private */
+	unsigned int id;
+};
+
+struct pce_loop;
+struct pce_timers;
+
+extern struct pce_loop *pce_loop_create(void);
+extern void pce_loop_delete(struct pce_loop *l);
+
+extern int pce_loop_add(struct pce_loop *l, struct pce_loop_event *ev,
+	unsigned int events);
+extern int pce_loop_add_listener(struct pce_loop *l,
+	struct pce_loop_event *ev);
+extern int pce_loop_add_stream(struct pce_loop *l, struct pce_loop_event *ev);
+extern int pce_loop_mod(struct pce_loop *l, struct pce_loop_event *ev,
+	unsigned int events);
+extern int pce_loop_del(struct pce_loop *l, struct pce_loop_event *ev);
+extern int pce_loop_sends(struct pce_loop *l);
+extern int pce_loop_send(struct pce_loop *l, struct pce_loop_event *ev,
+	char *buf, size_t off, size_t len);
+
+extern struct pce_timers *pce_loop_timers(struct pce_loop *l);
+
+extern int pce_loop_run(struct pce_loop *l);
+extern void pce_loop_stop(struct pce_loop *l);
+
+#endif /* PCE_LOOP_H */
@@ -0,0 +1,729 @@
+/*
+ * pce_loop_uring.c - PCE event loop (io_uring based)
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "pce_log.h"
+#include "pce_loop.h"
+#include "pce_timer.h"
+
+/*
+ * The io_uring backend talks to the kernel through the raw system calls and
+ * the uapi header, so no user space library is needed. Listening sockets use
+ * multishot accept, stream sockets use multishot recv out of a ring of
+ * provided buffers and send what they are given, every other source uses
+ * multishot poll. All the requests queued during a loop iteration are
+ * submitted with the same system call that waits for the next completions.
+ */
+
+#define PCE_URING_ENTRIES  1024	/* submission queue entries */
+#define PCE_URING_BUFS     1024	/* provided receive buffers (power of 2) */
+#define PCE_URING_BUF_SIZE 4096	/* size of a provided receive buffer */
+#define PCE_URING_BGID     0	/* provided buffer group id */
+
+/*
+ * The user data of a request identifies the source slot, the slot
+ * generation and the operation. A slot generation changes when the source
+ * is removed, so late completions of cancelled requests are discarded.
+ */
+#define PCE_URING_OP_POLL   0
+#define PCE_URING_OP_RECV   1
+#define PCE_URING_OP_ACCEPT 2
+#define PCE_URING_OP_SEND   3
+#define PCE_URING_OP_CANCEL 4
+#define PCE_URING_OP_MASK   7
+
+#define pce_uring_data(slot, gen, op) \
+	(((uint64_t)(gen) << 32) | ((uint64_t)(slot) << 3) | (op))
+#define pce_uring_data_op(d)   ((unsigned int)(d) & PCE_URING_OP_MASK)
+#define pce_uring_data_slot(d) ((unsigned int)(d) >> 3)
+#define pce_uring_data_gen(d)  ((unsigned int)((d) >> 32))
+
+struct pce_uring_slot {
+	struct pce_loop_event *ev;
+	unsigned int gen;
+	unsigned int ops;	/* armed operations (bitmask) */
+	unsigned int cancels;	/* operations being cancelled (bitmask) */
+	unsigned int events;	/* poll events of interest */
+	int recv_off;		/* stream reception paused */
+	char *send_buf;		/* being sent, the slot is kept till then */
+	unsigned int next_free;
+};
+
+struct pce_loop {
+	int fd;
+	int running;
+	struct pce_timers *timers;
+
+	/* submission queue */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail;
+	unsigned int sq_pending;
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* ring mappings */
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	/* provided receive buffers */
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	char *bufs;
+	unsigned short br_tail;
+
+	/* event source slots */
+	struct pce_uring_slot *slots;
+	unsigned int num_slots;
+	unsigned int free_slot;
+};
+
+static int pce_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int pce_uring_enter(int fd, unsigned int to_submit,
+	unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		NULL, 0);
+}
+
+static int pce_uring_register(int fd, unsigned int opcode, void *arg,
+	unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * pce_uring_submit - Submit the queued requests, optionally waiting for
+ * completions
+ */
+static int pce_uring_submit(struct pce_loop *l, unsigned int wait)
+{
+	int ret;
+
+	__atomic_store_n(l->sq_tail, l->sq_local_tail, __ATOMIC_RELEASE);
+	ret = pce_uring_enter(l->fd, l->sq_pending, wait,
+		wait ? IORING_ENTER_GETEVENTS : 0);
+	if (ret < 0)
+		return -errno;
+	l->sq_pending -= ret;
+	return ret;
+}
+
+/*
+ * pce_uring_sqe - Get a free submission queue entry
+ */
+static struct io_uring_sqe *pce_uring_sqe(struct pce_loop *l)
+{
+	unsigned int head, idx;
+	struct io_uring_sqe *sqe;
+
+	head = __atomic_load_n(l->sq_head, __ATOMIC_ACQUIRE);
+	if (l->sq_local_tail - head >= l->sq_entries) {
+		/* queue full, flush it to the kernel */
+		pce_uring_submit(l, 0);
+		head = __atomic_load_n(l->sq_head, __ATOMIC_ACQUIRE);
+		if (l->sq_local_tail - head >= l->sq_entries) {
+			pce_log(LOG_ERR, "io_uring submission queue full\n");
+			return NULL;
+		}
+	}
+
+	idx = l->sq_local_tail & *l->sq_mask;
+	sqe = &l->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	l->sq_array[idx] = idx;
+	l->sq_local_tail++;
+	l->sq_pending++;
+
+	return sqe;
+}
+
+/*
+ * pce_uring_buf_put - Give a receive buffer back to the kernel
+ */
+static void pce_uring_buf_put(struct pce_loop *l, unsigned short bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &l->br->bufs[l->br_tail & (PCE_URING_BUFS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(l->bufs +
+		(size_t)bid * PCE_URING_BUF_SIZE);
+	buf->len = PCE_URING_BUF_SIZE;
+	buf->bid = bid;
+	l->br_tail++;
+	__atomic_store_n(&l->br->tail, l->br_tail, __ATOMIC_RELEASE);
+}
+
+static int pce_uring_arm_poll(struct pce_loop *l, unsigned int id)
+{
+	struct pce_uring_slot *s = &l->slots[id];
+	struct io_uring_sqe *sqe;
+
+	sqe = pce_uring_sqe(l);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = s->ev->fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = s->events;
+	sqe->user_data = pce_uring_data(id, s->gen, PCE_URING_OP_POLL);
+	s->ops |= 1 << PCE_URING_OP_POLL;
+	return 0;
+}
+
+static int pce_uring_arm_recv(struct pce_loop *l, unsigned int id)
+{
+	struct pce_uring_slot *s = &l->slots[id];
+	struct io_uring_sqe *sqe;
+
+	sqe = pce_uring_sqe(l);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = PCE_URING_BGID;
+	sqe->fd = s->ev->fd;
+	sqe->user_data = pce_uring_data(id, s->gen, PCE_URING_OP_RECV);
+	s->ops |= 1 << PCE_URING_OP_RECV;
+	return 0;
+}
+
+static int pce_uring_arm_accept(struct pce_loop *l, unsigned int id)
+{
+	struct pce_uring_slot *s = &l->slots[id];
+	struct io_uring_sqe *sqe;
+
+	sqe = pce_uring_sqe(l);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->fd = s->ev->fd;
+	sqe->user_data = pce_uring_data(id, s->gen, PCE_URING_OP_ACCEPT);
+	s->ops |= 1 << PCE_URING_OP_ACCEPT;
+	return 0;
+}
+
+static int pce_uring_arm_send(struct pce_loop *l, unsigned int id,
+	char *buf, size_t off, size_t len)
+{
+	struct pce_uring_slot *s = &l->slots[id];
+	struct io_uring_sqe *sqe;
+
+	sqe = pce_uring_sqe(l);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = s->ev->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(buf + off);
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = pce_uring_data(id, s->gen, PCE_URING_OP_SEND);
+	s->ops |= 1 << PCE_URING_OP_SEND;
+	s->send_buf = buf;
+	return 0;
+}
+
+static void pce_uring_cancel(struct pce_loop *l, unsigned int id,
+	unsigned int op)
+{
+	struct pce_uring_slot *s = &l->slots[id];
+	struct io_uring_sqe *sqe;
+
+	sqe = pce_uring_sqe(l);
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = pce_uring_data(id, s->gen, op);
+	sqe->user_data = pce_uring_data(0, 0, PCE_URING_OP_CANCEL);
+	s->ops &= ~(1 << op);
+}
+
+/*
+ * pce_uring_slot_get - Bind an event source to a free slot
+ */
+static int pce_uring_slot_get(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	unsigned int i, num;
+	struct pce_uring_slot *slots;
+
+	if (l->free_slot == l->num_slots) {
+		num = l->num_slots ? l->num_slots * 2 : 64;
+		slots = realloc(l->slots, num * sizeof(*slots));
+		if (!slots) {
+			pce_log(LOG_ERR, "failed to get memory\n");
+			return -1;
+		}
+		memset(&slots[l->num_slots], 0,
+			(num - l->num_slots) * sizeof(*slots));
+		for (i = l->num_slots; i < num; i++)
+			slots[i].next_free = i + 1;
+		l->slots = slots;
+		l->num_slots = num;
+	}
+
+	ev->id = l->free_slot;
+	l->free_slot = l->slots[ev->id].next_free;
+	l->slots[ev->id].ev = ev;
+	l->slots[ev->id].ops = 0;
+	l->slots[ev->id].cancels = 0;
+	l->slots[ev->id].events = 0;
+	l->slots[ev->id].recv_off = 0;
+	l->slots[ev->id].send_buf = NULL;
+
+	return 0;
+}
+
+/*
+ * pce_uring_slot_put - Make a slot free, its requests are all gone
+ */
+static void pce_uring_slot_put(struct pce_loop *l, unsigned int id)
+{
+	l->slots[id].next_free = l->free_slot;
+	l->free_slot = id;
+}
+
+/*
+ * pce_loop_create - Create a new event loop
+ */
+struct pce_loop *pce_loop_create(void)
+{
+	struct pce_loop *l;
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+
+	l = calloc(1, sizeof(*l));
+	if (!l) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto out;
+	}
+
+	/* completions may burst well beyond the submissions */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+		IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = PCE_URING_ENTRIES * 8;
+	l->fd = pce_uring_setup(PCE_URING_ENTRIES, &p);
+	if (l->fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = PCE_URING_ENTRIES * 8;
+		l->fd = pce_uring_setup(PCE_URING_ENTRIES, &p);
+	}
+	if (l->fd < 0) {
+		pce_log(LOG_ERR, "failure in io_uring_setup(): %s\n",
+			strerror(errno));
+		goto out1;
+	}
+
+	/* map the submission and completion rings */
+	l->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	l->cq_size = p.cq_off.cqes + p.cq_entries *
+		sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (l->cq_size > l->sq_size)
+			l->sq_size = l->cq_size;
+		l->cq_size = l->sq_size;
+	}
+	l->sq_ptr = mmap(NULL, l->sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, l->fd, IORING_OFF_SQ_RING);
+	if (l->sq_ptr == MAP_FAILED)
+		goto err2;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		l->cq_ptr = l->sq_ptr;
+	} else {
+		l->cq_ptr = mmap(NULL, l->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, l->fd, IORING_OFF_CQ_RING);
+		if (l->cq_ptr == MAP_FAILED)
+			goto err3;
+	}
+	l->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	l->sqes = mmap(NULL, l->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, l->fd, IORING_OFF_SQES);
+	if (l->sqes == MAP_FAILED)
+		goto err4;
+
+	l->sq_head = l->sq_ptr + p.sq_off.head;
+	l->sq_tail = l->sq_ptr + p.sq_off.tail;
+	l->sq_mask = l->sq_ptr + p.sq_off.ring_mask;
+	l->sq_array = l->sq_ptr + p.sq_off.array;
+	l->sq_entries = p.sq_entries;
+	l->sq_local_tail = *l->sq_tail;
+	l->cq_head = l->cq_ptr + p.cq_off.head;
+	l->cq_tail = l->cq_ptr + p.cq_off.tail;
+	l->cq_mask = l->cq_ptr + p.cq_off.ring_mask;
+	l->cqes = l->cq_ptr + p.cq_off.cqes;
+
+	/* register the ring of provided receive buffers */
+	l->br_size = PCE_URING_BUFS * sizeof(struct io_uring_buf);
+	l->br = mmap(NULL, l->br_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (l->br == MAP_FAILED)
+		goto err5;
+	l->bufs = malloc((size_t)PCE_URING_BUFS * PCE_URING_BUF_SIZE);
+	if (!l->bufs)
+		goto err6;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)l->br;
+	reg.ring_entries = PCE_URING_BUFS;
+	reg.bgid = PCE_URING_BGID;
+	if (pce_uring_register(l->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+		pce_log(LOG_ERR, "failed to register io_uring buffers: %s\n",
+			strerror(errno));
+		goto err7;
+	}
+	for (i = 0; i < PCE_URING_BUFS; i++)
+		pce_uring_buf_put(l, i);
+
+	l->timers = pce_timers_create(l);
+	if (!l->timers)
+		goto err7;
+
+	return l;
+
+err7:
+	free(l->bufs);
+err6:
+	munmap(l->br, l->br_size);
+err5:
+	munmap(l->sqes, l->sqes_size);
+err4:
+	if (l->cq_ptr != l->sq_ptr)
+		munmap(l->cq_ptr, l->cq_size);
+err3:
+	munmap(l->sq_ptr, l->sq_size);
+err2:
+	pce_log(LOG_ERR, "failed to map io_uring rings\n");
+	close(l->fd);
+out1:
+	free(l);
+out:
+	return NULL;
+}
+
+/*
+ * pce_loop_delete - Delete the event loop
+ */
+void pce_loop_delete(struct pce_loop *l)
+{
+	unsigned int i;
+
+	pce_timers_delete(l, l->timers);
+	close(l->fd);
+	for (i = 0; i < l->num_slots; i++)
+		free(l->slots[i].send_buf);
+	free(l->bufs);
+	munmap(l->br, l->br_size);
+	munmap(l->sqes, l->sqes_size);
+	if (l->cq_ptr != l->sq_ptr)
+		munmap(l->cq_ptr, l->cq_size);
+	munmap(l->sq_ptr, l->sq_size);
+	free(l->slots);
+	free(l);
+}
+
+/*
+ * pce_loop_add - Start watching an event source
+ */
+int pce_loop_add(struct pce_loop *l, struct pce_loop_event *ev,
+	unsigned int events)
+{
+	if (pce_uring_slot_get(l, ev))
+		return -1;
+	l->slots[ev->id].events = events;
+	return pce_uring_arm_poll(l, ev->id);
+}
+
+/*
+ * pce_loop_add_listener - Start accepting connections on a listening socket
+ *
+ * Every accepted connection is handed over to the accept() hook.
+ */
+int pce_loop_add_listener(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	if (pce_uring_slot_get(l, ev))
+		return -1;
+	return pce_uring_arm_accept(l, ev->id);
+}
+
+/*
+ * pce_loop_add_stream - Start receiving data from a connected socket
+ *
+ * Received data is handed over to the recv() hook.
+ */
+int pce_loop_add_stream(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	if (pce_uring_slot_get(l, ev))
+		return -1;
+	return pce_uring_arm_recv(l, ev->id);
+}
+
+/*
+ * pce_loop_mod - Change the events of interest of an event source
+ *
+ * Stream sources already receive through the recv() hook, only the other
+ * events of interest (e.g. PCE_LOOP_OUT) are polled for them. Dropping
+ * PCE_LOOP_IN pauses the reception, data already received may still be
+ * handed over until the receive request is cancelled.
+ */
+int pce_loop_mod(struct pce_loop *l, struct pce_loop_event *ev,
+	unsigned int events)
+{
+	struct pce_uring_slot *s = &l->slots[ev->id];
+	struct io_uring_sqe *sqe;
+
+	if (ev->recv) {
+		s->recv_off = !(events & PCE_LOOP_IN);
+		if (s->recv_off && (s->ops & (1 << PCE_URING_OP_RECV))) {
+			pce_uring_cancel(l, ev->id, PCE_URING_OP_RECV);
+			s->cancels |= 1 << PCE_URING_OP_RECV;
+		} else if (!s->recv_off &&
+			!(s->ops & (1 << PCE_URING_OP_RECV)) &&
+			!(s->cancels & (1 << PCE_URING_OP_RECV))) {
+			/* rearmed once the cancellation completes otherwise */
+			if (pce_uring_arm_recv(l, ev->id))
+				return -1;
+		}
+		events &= ~PCE_LOOP_IN;
+	}
+	if (events == s->events && (s->ops & (1 << PCE_URING_OP_POLL)))
+		return 0;
+	s->events = events;
+
+	if (!(s->ops & (1 << PCE_URING_OP_POLL)))
+		return events ? pce_uring_arm_poll(l, ev->id) : 0;
+
+	if (!events) {
+		pce_uring_cancel(l, ev->id, PCE_URING_OP_POLL);
+		return 0;
+	}
+
+	/* update the armed poll request in place */
+	sqe = pce_uring_sqe(l);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = pce_uring_data(ev->id, s->gen, PCE_URING_OP_POLL);
+	sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = events;
+	sqe->user_data = pce_uring_data(0, 0, PCE_URING_OP_CANCEL);
+	return 0;
+}
+
+/*
+ * pce_loop_del - Stop watching an event source
+ *
+ * The event source can be released as soon as this returns, even from
+ * within a handler: late completions of its requests are discarded.
+ */
+int pce_loop_del(struct pce_loop *l, struct pce_loop_event *ev)
+{
+	struct pce_uring_slot *s = &l->slots[ev->id];
+	unsigned int op;
+
+	for (op = 0; op < PCE_URING_OP_CANCEL; op++)
+		if (s->ops & (1 << op))
+			pce_uring_cancel(l, ev->id, op);
+
+	/*
+	 * the kernel holds a reference to the file until the requests are
+	 * cancelled, so submit right away rather than at the next iteration
+	 */
+	pce_uring_submit(l, 0);
+
+	s->ev = NULL;
+	s->gen++;
+
+	/* the kernel may still read the buffer being sent */
+	if (!s->send_buf)
+		pce_uring_slot_put(l, ev->id);
+
+	return 0;
+}
+
+/*
+ * pce_loop_sends - Tell whether the loop writes to stream sources: it
+ * does, see pce_loop_send()
+ */
+int pce_loop_sends(struct pce_loop *l)
+{
+	return 1;
+}
+
+/*
+ * pce_loop_send - Send buf[off, off + len) on a stream source
+ *
+ * The buffer (from malloc()) belongs to the loop until it is handed back to
+ * the sent() hook. One send at a time per source.
+ */
+int pce_loop_send(struct pce_loop *l, struct pce_loop_event *ev,
+	char *buf, size_t off, size_t len)
+{
+	return pce_uring_arm_send(l, ev->id, buf, off, len);
+}
+
+/*
+ * pce_uring_complete - Dispatch a completion to its event source
+ */
+static void pce_uring_complete(struct pce_loop *l, struct io_uring_cqe *cqe)
+{
+	unsigned int op, id, bid = 0;
+	struct pce_uring_slot *s;
+	struct pce_loop_event *ev;
+	char *buf;
+	int more = cqe->flags & IORING_CQE_F_MORE;
+	int has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+
+	op = pce_uring_data_op(cqe->user_data);
+	if (op == PCE_URING_OP_CANCEL)
+		return;
+	if (has_buf)
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+	/* discard completions of removed sources */
+	id = pce_uring_data_slot(cqe->user_data);
+	s = id < l->num_slots ? &l->slots[id] : NULL;
+	if (!s || !s->ev || s->gen != pce_uring_data_gen(cqe->user_data)) {
+		if (has_buf)
+			pce_uring_buf_put(l, bid);
+		if (op == PCE_URING_OP_ACCEPT && cqe->res >= 0)
+			close(cqe->res);
+		if (op == PCE_URING_OP_SEND && s && s->send_buf) {
+			free(s->send_buf);
+			s->send_buf = NULL;
+			pce_uring_slot_put(l, id);
+		}
+		return;
+	}
+	ev = s->ev;
+	if (!more) {
+		s->ops &= ~(1 << op);
+		s->cancels &= ~(1 << op);
+	}
+
+	switch (op) {
+	case PCE_URING_OP_POLL:
+		if (cqe->res == -ECANCELED)
+			break;
+		if (!more && s->events)
+			pce_uring_arm_poll(l, id);
+		ev->handler(ev, cqe->res < 0 ? PCE_LOOP_ERR : cqe->res);
+		break;
+
+	case PCE_URING_OP_ACCEPT:
+		if (!more && cqe->res != -ECANCELED)
+			pce_uring_arm_accept(l, id);
+		ev->accept(ev, cqe->res);
+		break;
+
+	case PCE_URING_OP_RECV:
+		if (cqe->res == -ECANCELED || cqe->res == -ENOBUFS) {
+			/*
+			 * paused (unless resumed in the meantime) or out of
+			 * buffers, they are given back below
+			 */
+			if (!s->recv_off && !(s->ops & (1 << op)))
+				pce_uring_arm_recv(l, id);
+			break;
+		}
+		if (cqe->res > 0 && !more && !s->recv_off)
+			pce_uring_arm_recv(l, id);
+		ev->recv(ev, has_buf ? l->bufs +
+			(size_t)bid * PCE_URING_BUF_SIZE : NULL, cqe->res);
+		if (has_buf)
+			pce_uring_buf_put(l, bid);
+		break;
+
+	case PCE_URING_OP_SEND:
+		buf = s->send_buf;
+		s->send_buf = NULL;
+		ev->sent(ev, buf, cqe->res);
+		break;
+	}
+}
+
+/*
+ * pce_loop_timers - Return the timer wheel of the event loop
+ */
+struct pce_timers *pce_loop_timers(struct pce_loop *l)
+{
+	return l->timers;
+}
+
+/*
+ * pce_loop_run - Dispatch events until pce_loop_stop() is called
+ */
+int pce_loop_run(struct pce_loop *l)
+{
+	int ret;
+	unsigned int head, tail;
+	struct io_uring_cqe cqe;
+
+	l->running = 1;
+	while (l->running) {
+
+		/* submit the queued requests and block on completions */
+		ret = pce_uring_submit(l, 1);
+		if (ret < 0 && ret != -EINTR && ret != -EAGAIN &&
+			ret != -EBUSY) {
+			pce_log(LOG_ERR, "failure in io_uring_enter(): %s\n",
+				strerror(-ret));
+			return -1;
+		}
+
+		/* dispatch completions to their event sources */
+		head = *l->cq_head;
+		tail = __atomic_load_n(l->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			cqe = l->cqes[head & *l->cq_mask];
+			__atomic_store_n(l->cq_head, ++head, __ATOMIC_RELEASE);
+			pce_uring_complete(l, &cqe);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * pce_loop_stop - Make pce_loop_run() return after the current iteration
+ */
+void pce_loop_stop(struct pce_loop *l)
+{
+	l->running = 0;
+}
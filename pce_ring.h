@@ -0,0 +1,113 @@
+/*
+ * pce_ring.h - PCE bounded lock-free queue
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_RING_H
+#define PCE_RING_H
+
+#include <stdlib.h>
+
+/*
+ * A bounded queue of pointers any number of threads can push to and a
+ * single thread pops from. Every slot carries a sequence number telling
+ * whether it is free for the push of a given round or holds the data of
+ * that round, so producers only contend on the tail index (one
+ * compare-and-swap per push) and the consumer takes no lock at all.
+ */
+
+#define PCE_RING_CACHELINE 64
+
+struct pce_ring_slot {
+	unsigned long seq;
+	void *data;
+};
+
+struct pce_ring {
+	unsigned long mask;
+	struct pce_ring_slot *slots;
+
+	/* producers and consumer indexes sit on their own cache lines */
+	unsigned long tail __attribute__ ((aligned(PCE_RING_CACHELINE)));
+	unsigned long head __attribute__ ((aligned(PCE_RING_CACHELINE)));
+};
+
+/*
+ * pce_ring_init - Set up a ring for size entries (a power of 2)
+ */
+static inline int pce_ring_init(struct pce_ring *r, unsigned long size)
+{
+	unsigned long i;
+
+	r->slots = malloc(size * sizeof(*r->slots));
+	if (!r->slots)
+		return -1;
+	for (i = 0; i < size; i++)
+		r->slots[i].seq = i;
+	r->mask = size - 1;
+	r->head = 0;
+	r->tail = 0;
+
+	return 0;
+}
+
+static inline void pce_ring_release(struct pce_ring *r)
+{
+	free(r->slots);
+}
+
+/*
+ * pce_ring_push - Queue an entry, from any thread
+ *
+ * Returns -1 if the ring is full.
+ */
+static inline int pce_ring_push(struct pce_ring *r, void *data)
+{
+	struct pce_ring_slot *slot;
+	unsigned long pos, seq;
+	long dif;
+
+	pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	while (1) {
+		slot = &r->slots[pos & r->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		dif = (long)(seq - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&r->tail, &pos,
+				pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+	}
+	slot->data = data;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * pce_ring_pop - Dequeue an entry, from the consumer thread only
+ *
+ * Returns NULL if the ring is empty.
+ */
+static inline void *pce_ring_pop(struct pce_ring *r)
+{
+	struct pce_ring_slot *slot = &r->slots[r->head & r->mask];
+	void *data;
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != r->head + 1)
+		return NULL;
+	data = slot->data;
+	__atomic_store_n(&slot->seq, r->head + r->mask + 1, __ATOMIC_RELEASE);
+	r->head++;
+
+	return data;
+}
+
+#endif /* PCE_RING_H */
@@ -8,180 +8,221 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-#include <poll.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
-#include <sys/timerfd.h>
+#include <sys/stat.h>
 
+#include "list.h"
 #include "pce_log.h"
+#include "pce_loop.h"
 #include "pce_pidfile.h"
-#include "pcep_msg.h"
-#include "pcep_framer.h"
+#include "pce_ted.h"
+#include "pce_cspf.h"
+#include "pce_worker.h"
+#include "pcep_session.h"
 
 #define PCE_SERVICE "4189"
 #define PCE_PIDFILE "/var/run/pce.pid"
+#define PCE_STATSFILE "/var/run/pce.stats"
+
+#define PCE_THREADS_MAX 256
+#define PCE_WORKERS_MAX 256
+#define PCE_CACHE_MAX   (1024 * 1024)	/* in entries */
+#define PCE_RCVBUF_MAX  (16 * 1024)	/* in KB */
+
+/* the server threads wait for all of them to be started */
+static pthread_mutex_t pce_server_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pce_server_cond = PTHREAD_COND_INITIALIZER;
+
+struct pce_server_data;
+
+/*
+ * A PCE server thread owns a listening socket (bound with SO_REUSEPORT, so
+ * the kernel spreads the incoming connections), an event loop and all the
+ * sessions accepted on it: nothing is shared on the hot path.
+ */
+struct pce_server_thread {
+	int id;
+	pthread_t tid;
+	struct pce_loop_event lev;
+	struct pce_loop *loop;
+	struct list_head sessions;
+	struct pce_server_data *data;
+	struct pce_cspf *cspf;
+	struct pce_worker_port *port;
+
+	/* statistics */
+	unsigned long num_sessions;
+	unsigned long num_sess_accepted;
+	unsigned long num_sess_refused;
+	struct pcep_stats stats;
+};
 
 struct pce_server_data {
-	int cfd;
-	int lfd;
 	struct addrinfo *addr;
-	int tfd;
-	struct itimerspec tval;
+	struct pcep_session_config cfg;
+	struct pcep_load load;
+	unsigned long num_sessions;	/* all the threads */
+	struct pce_ted *ted;
+	const char *ted_update;		/* link changes applied on SIGHUP */
+	struct pce_server_thread *threads;
+	int num_threads;
+	struct pce_worker_pool *pool;
+	int num_workers;
+	uint32_t cache_size;
 	int debug;
+	int running;		/* threads or workers started */
+	int start;		/* threads may run (1) or must return (-1) */
 };
 
-#define PCEP_FD_SOCKET 0
-#define PCEP_FD_TIMER 1
-#define PCEP_FD_TOT 2
-
-#define PCEP_MSG_CHUNK 9
-static void pcep_session(struct pce_server_data *data)
+/*
+ * pce_server_close - Release a PCEP session closed by its peer
+ */
+static void pce_server_close(struct pcep_session *ses)
 {
-	char *buf;
-	char dump[80];
-	uint64_t elaps;
-	ssize_t count;
-	struct pcep_msg_hdr *pcep_msg;
-	struct pcep_framer *pcep_framer;
-	struct pollfd fds[2];
-
-	buf = malloc(PCEP_MSG_CHUNK);
-	if (!buf) {
-		pce_log(LOG_ERR, "failed to get memory\n");
-		goto out;
-	}
+	struct pce_server_thread *thr = ses->owner;
 
-	/* create a PCEP message framer */
-	pcep_framer = pcep_framer_create();
-	if (pcep_framer == NULL) {
-		pce_log(LOG_ERR, "failed to create PCEP framer\n");
-		goto out1;
-	}
+	list_del(&ses->list);
+	PCEP_STATS_ADD(thr->num_sessions, -1);
+	__atomic_sub_fetch(&thr->data->num_sessions, 1, __ATOMIC_RELAXED);
+	pcep_session_delete(ses);
+}
 
-	/* create a periodic one second timer */
-	data->tval.it_interval.tv_sec = 1,
-	data->tval.it_value.tv_sec = 1,
-	data->tfd = timerfd_create(CLOCK_MONOTONIC, 0);
-	if (!data->tfd) {
-		pce_log(LOG_ERR, "failed to create PCEP session timer\n");
-		goto out2;
-	}
-	if (timerfd_settime(data->tfd, 0, &data->tval, NULL) != 0) {
-		pce_log(LOG_ERR, "failed to set PCEP session timer\n");
-		goto out3;
+/*
+ * pce_server_attach - Attach a new session to the thread event loop
+ *
+ * Connections beyond the maximum number of sessions are closed right
+ * away, before any session resource is allocated.
+ */
+static void pce_server_attach(struct pce_server_thread *thr, int cfd)
+{
+	int err;
+	unsigned long num;
+	struct pcep_session *ses;
+	socklen_t cl_addrlen;
+	struct sockaddr_storage cl_addr;
+	char hbuf[NI_MAXHOST];
+	char sbuf[NI_MAXSERV];
+
+	cl_addrlen = sizeof(cl_addr);
+	err = getpeername(cfd, (struct sockaddr *)&cl_addr, &cl_addrlen);
+	if (!err)
+		err = getnameinfo((struct sockaddr *) &cl_addr, cl_addrlen,
+			hbuf, sizeof(hbuf), sbuf, sizeof(sbuf),
+			NI_NUMERICHOST | NI_NUMERICSERV);
+	if (!err)
+		pce_log(LOG_DEBUG, "accepted connection from "
+			"'%s:%s' (thread %d)\n", hbuf, sbuf, thr->id);
+	else
+		pce_log(LOG_DEBUG, "accepted connection from "
+			"'unknown' host (thread %d)\n", thr->id);
+
+	num = __atomic_add_fetch(&thr->data->num_sessions, 1, __ATOMIC_RELAXED);
+	if (thr->data->cfg.max_sessions && num > thr->data->cfg.max_sessions) {
+		pce_log(LOG_DEBUG, "too many PCEP sessions, connection "
+			"refused\n");
+		PCEP_STATS_ADD(thr->num_sess_refused, 1);
+		goto err;
 	}
 
-	/* specify events of interest */
-	fds[PCEP_FD_SOCKET].fd = data->cfd;
-	fds[PCEP_FD_SOCKET].events = POLLIN;
-	fcntl(data->cfd, F_SETFL, fcntl(data->cfd, F_GETFL) | O_NONBLOCK);
-	fds[PCEP_FD_TIMER].fd = data->tfd;
-	fds[PCEP_FD_TIMER].events = POLLIN;
-	fcntl(data->tfd, F_SETFL, fcntl(data->tfd, F_GETFL) | O_NONBLOCK);
-		
-	while (1) {
-
-		/* block on interested events */
-		if (poll(fds, PCEP_FD_TOT, -1) < 0)
-			break;
-
-		/* socket data available */
-		if (fds[PCEP_FD_SOCKET].revents & POLLIN) {
-
-			/* read a message chunk from the incoming stream */
-			do {
-				count = read(data->cfd, buf, PCEP_MSG_CHUNK);
-			} while (count == -1 && errno == EINTR);
-
-			/* check for any (fatal) error */
-			if (count == -1)
-				break;
-			/* check if the peer socket hunged-up */
-			if (count == 0)
-				break;
-
-			/* feed the framer with the message chunk */
-			pcep_framer_write(pcep_framer, buf, count);
+	pce_log(LOG_DEBUG, "starting PCEP session ...\n");
+	ses = pcep_session_create(thr->loop, cfd, &thr->data->cfg);
+	if (!ses)
+		goto err;
+	ses->close = pce_server_close;
+	ses->owner = thr;
+	ses->stats = &thr->stats;
+	ses->cspf = thr->cspf;
+	ses->port = thr->port;
+	if (thr->port)
+		ses->load = &thr->data->load;
+	list_add_tail(&ses->list, &thr->sessions);
+	PCEP_STATS_ADD(thr->num_sessions, 1);
+	PCEP_STATS_ADD(thr->num_sess_accepted, 1);
+	return;
 
-			/* handle messages if any */
-			while (pcep_msg = pcep_framer_read(pcep_framer)) {
+err:
+	__atomic_sub_fetch(&thr->data->num_sessions, 1, __ATOMIC_RELAXED);
+	close(cfd);
+}
 
-				pcep_msg_hdr_dump(pcep_msg, dump, sizeof(dump));
-				pce_log(LOG_DEBUG, "%s\n", dump);
+/*
+ * pce_server_accept - Accept all the pending connections from PCE clients
+ */
+static void pce_server_accept(struct pce_loop_event *ev, unsigned int events)
+{
+	struct pce_server_thread *thr =
+		container_of(ev, struct pce_server_thread, lev);
+	int cfd;
 
-				/* handle the message */
-				// TODO pcep_handle_msg(pcep_session, pcep_msg);
-				
-				/* release the message memory */
-				pcep_msg_free(pcep_msg);
-			}
+	while (1) {
+		cfd = accept4(thr->lev.fd, NULL, NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (cfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				pce_log(LOG_ERR, "failure in accept(): %s\n",
+					strerror(errno));
+			break;
 		}
+		pce_server_attach(thr, cfd);
+	}
+}
 
-		/* timer expired */
-		if (fds[PCEP_FD_TIMER].revents & POLLIN) {
-
-			/* read the expiration time */
-			do {
-				count = read(data->tfd, &elaps, sizeof(elaps));
-			} while (count == -1 && errno == EINTR);
-
-			/* any error? */
-			if (count != sizeof(elaps))
-				break;
-
-			pce_log(LOG_DEBUG, "timer exipred, elapsed %d\n", elaps);
+/*
+ * pce_server_accepted - Handle a connection accepted by the event loop
+ */
+static void pce_server_accepted(struct pce_loop_event *ev, int cfd)
+{
+	struct pce_server_thread *thr =
+		container_of(ev, struct pce_server_thread, lev);
 
-			/* handle the timer */
-			// TODO pcep_handle_timer(pcep_session, elaps);
-		}
+	if (cfd < 0) {
+		pce_log(LOG_ERR, "failure in accept(): %s\n", strerror(-cfd));
+		return;
 	}
-
-out3:
-	close(data->tfd);
-out2:
-	pcep_framer_delete(pcep_framer);
-out1:
-	free(buf);
-out:
-	return;
+	pce_server_attach(thr, cfd);
 }
 
 /*
- * pce_server_init - PCE server initialization
+ * pce_server_listen - Create a listening socket bound to the server address
  */
-int pce_server_init(struct pce_server_data *data)
+static int pce_server_listen(struct pce_server_data *data)
 {
-	int err, sock_opt;
+	int fd, err, sock_opt;
 	struct addrinfo *addr;
 
-	pce_log(LOG_DEBUG, "starting PCE server ...\n");
-
 	/* try to bind the PCE server to any address */
 	for (addr = data->addr; addr != NULL; addr = addr->ai_next) {
 
 		/* create listening socket */
-		data->lfd = socket(addr->ai_family, addr->ai_socktype,
-			addr->ai_protocol);
-		if (data->lfd == -1)
+		fd = socket(addr->ai_family, addr->ai_socktype |
+			SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+		if (fd == -1)
 			continue;
 
 		/* allow address reseuse */
 		sock_opt = 1;
-		setsockopt(data->lfd, SOL_SOCKET, SO_REUSEADDR,
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+			(void *)&sock_opt, sizeof(sock_opt));
+
+		/* let every server thread bind its own listening socket */
+		sock_opt = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
 			(void *)&sock_opt, sizeof(sock_opt));
 
 		/* try to bind to the retrieved address */
-		err = bind(data->lfd, addr->ai_addr, addr->ai_addrlen);
+		err = bind(fd, addr->ai_addr, addr->ai_addrlen);
 		if (err)
-			close(data->lfd);
+			close(fd);
 		else
 			break;
 	}
@@ -189,110 +230,355 @@ int pce_server_init(struct pce_server_data *data)
 	/* check if any address succeded */
 	if (!addr || err) {
 		pce_log(LOG_ERR, "can't bind PCE server to any address\n");
-		goto out1;
+		return -1;
 	}
 
-	/* put the PCE server listening */
-	if (listen(data->lfd, 0) < 0) {
+	/* put the PCE server listening (PCCs may reconnect in bulk) */
+	if (listen(fd, SOMAXCONN) < 0) {
 		pce_log(LOG_ERR, "failure in listen(): %s\n",
 			strerror(errno));
-		goto err2;
+		close(fd);
+		return -1;
 	}
 
-	/* concurrent PCE server */
-	while (1) {
+	return fd;
+}
 
-		socklen_t cl_addrlen;
-		struct sockaddr_storage cl_addr;
-		char hbuf[NI_MAXHOST];
-		char sbuf[NI_MAXSERV];
-
-		/* accept connections from PCE clients */
-		cl_addrlen = sizeof(cl_addr);
-		data->cfd = accept(data->lfd, (struct sockaddr *)&cl_addr,
-			&cl_addrlen);
-		if (data->cfd < 0) {
-			pce_log(LOG_ERR, "failure in accept(): %s\n",
-				strerror(errno));
-			continue;
-		}
-		err = getnameinfo((struct sockaddr *) &cl_addr, cl_addrlen,
-			hbuf, sizeof(hbuf), sbuf, sizeof(sbuf),
-			NI_NUMERICHOST | NI_NUMERICSERV);
-		if (!err)
-			pce_log(LOG_DEBUG, "accepted connection from "
-				"'%s:%s'\n", hbuf, sbuf);
-		else
-			pce_log(LOG_DEBUG, "accepted connection from "
-				"'unknown' host\n");
-
-		/* create a new process to handle each session */
-		switch (fork()) {
-		case -1: /* error */
-			pce_log(LOG_ERR, "failure in fork(): %s\n",
-				strerror(errno));
-			close(data->cfd);
-			break;
+/*
+ * pce_server_thread_init - Setup the listening socket and the event loop
+ */
+static int pce_server_thread_init(struct pce_server_thread *thr)
+{
+	thr->lev.fd = pce_server_listen(thr->data);
+	if (thr->lev.fd < 0)
+		goto out;
 
-		case 0: /* child */
-			close(data->lfd);
-			signal(SIGINT, SIG_DFL);
-			signal(SIGTERM, SIG_DFL);
-			signal(SIGCHLD, SIG_DFL);
-			signal(SIGPIPE, SIG_IGN);
-			pce_log(LOG_DEBUG, "starting PCEP session ...\n");
-			pcep_session(data);
-			pce_log(LOG_DEBUG, "closing PCEP session ...\n");
-			close(data->cfd);
-			exit(EXIT_SUCCESS);
-			break;
+	thr->loop = pce_loop_create();
+	if (!thr->loop)
+		goto out1;
 
-		default: /* parent */
-			close(data->cfd);
-			continue;
-		}
+	/*
+	 * paths are computed by the workers if any, otherwise by the thread
+	 * itself: the topology is shared, the scratch memory is not
+	 */
+	if (thr->data->pool) {
+		thr->port = pce_worker_port_create(thr->data->pool, thr->loop);
+		if (!thr->port)
+			goto out2;
+	} else if (thr->data->ted) {
+		thr->cspf = pce_cspf_create(thr->data->ted,
+			thr->data->cache_size);
+		if (!thr->cspf)
+			goto out2;
 	}
 
-	return;
+	thr->lev.handler = pce_server_accept;
+	thr->lev.accept = pce_server_accepted;
+	INIT_LIST_HEAD(&thr->sessions);
+	if (pce_loop_add_listener(thr->loop, &thr->lev)) {
+		pce_log(LOG_ERR, "failed to watch PCE server socket\n");
+		goto out3;
+	}
 
-err2:
-	pce_log(LOG_DEBUG, "closing PCE server ...\n");
-	close(data->lfd);
+	return 0;
+
+out3:
+	if (thr->port)
+		pce_worker_port_delete(thr->port);
+	if (thr->cspf)
+		pce_cspf_delete(thr->cspf);
+out2:
+	pce_loop_delete(thr->loop);
 out1:
-	return err;
+	close(thr->lev.fd);
+out:
+	return -1;
+}
+
+/*
+ * pce_server_thread_exit - Release the thread resources
+ */
+static void pce_server_thread_exit(struct pce_server_thread *thr)
+{
+	struct pcep_session *ses, *tmp;
+
+	/* release all the sessions still in place */
+	list_for_each_entry_safe(ses, tmp, &thr->sessions, list)
+		pce_server_close(ses);
+	pce_loop_del(thr->loop, &thr->lev);
+	pce_loop_delete(thr->loop);
+	close(thr->lev.fd);
+	if (thr->port)
+		pce_worker_port_delete(thr->port);
+	if (thr->cspf)
+		pce_cspf_delete(thr->cspf);
 }
 
-static void pce_sigchld_handler(int signal)
+/*
+ * pce_server_start - Let the server threads run their event loops (go > 0)
+ * or return right away (go < 0)
+ */
+static void pce_server_start(struct pce_server_data *data, int go)
+{
+	pthread_mutex_lock(&pce_server_lock);
+	data->start = go;
+	pthread_cond_broadcast(&pce_server_cond);
+	pthread_mutex_unlock(&pce_server_lock);
+}
+
+static void *pce_server_thread_run(void *arg)
+{
+	struct pce_server_thread *thr = arg;
+	int go;
+
+	/* no connection is accepted until every thread is there */
+	pthread_mutex_lock(&pce_server_lock);
+	while (!thr->data->start)
+		pthread_cond_wait(&pce_server_cond, &pce_server_lock);
+	go = thr->data->start;
+	pthread_mutex_unlock(&pce_server_lock);
+	if (go < 0)
+		return NULL;
+
+	pce_log(LOG_DEBUG, "starting PCE server thread %d ...\n", thr->id);
+	pce_loop_run(thr->loop);
+
+	return NULL;
+}
+
+/*
+ * pce_server_stats - Roll up the per-thread statistics into the stats file
+ */
+static void pce_server_stats(struct pce_server_data *data)
 {
-	pid_t pid;
-	int status;
+	FILE *f;
+	int i;
+	struct pce_server_thread *thr;
+	unsigned long sess, acc, ref, tot_sess = 0, tot_acc = 0, tot_ref = 0;
+	struct pcep_stats s, tot;
+
+	f = fopen(PCE_STATSFILE, "w");
+	if (!f) {
+		pce_log(LOG_ERR, "can't create PCE stats file\n");
+		return;
+	}
 
-	/* handle exit of more than one child */
-	do {
-		pid = waitpid(-1, &status, WNOHANG);
-	} while (pid > 0);
+#define PCE_STATS_FMT "%-6s %10lu %10lu %10lu %10lu %10lu %10lu %10lu %10lu " \
+	"%10lu %10lu %10lu %10lu %10lu\n"
+	fprintf(f, "%-6s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s "
+		"%10s %10s %10s\n",
+		"thread", "sessions", "accepted", "rejected", "ka-rcvd",
+		"ka-sent", "req-rcvd", "rep-sent", "err-sent", "unknown",
+		"cache-hit", "cache-miss", "expired", "refused");
+
+	memset(&tot, 0, sizeof(tot));
+	for (i = 0; i < data->num_threads; i++) {
+		char id[16];
+
+		thr = &data->threads[i];
+		sess = PCEP_STATS_READ(thr->num_sessions);
+		acc = PCEP_STATS_READ(thr->num_sess_accepted);
+		ref = PCEP_STATS_READ(thr->num_sess_refused);
+		s.num_keep_alive_rcvd =
+			PCEP_STATS_READ(thr->stats.num_keep_alive_rcvd);
+		s.num_keep_alive_sent =
+			PCEP_STATS_READ(thr->stats.num_keep_alive_sent);
+		s.num_pc_req_rcvd = PCEP_STATS_READ(thr->stats.num_pc_req_rcvd);
+		s.num_pc_rep_sent = PCEP_STATS_READ(thr->stats.num_pc_rep_sent);
+		s.num_pc_err_sent = PCEP_STATS_READ(thr->stats.num_pc_err_sent);
+		s.num_unknown_rcvd =
+			PCEP_STATS_READ(thr->stats.num_unknown_rcvd);
+		s.num_path_cache_hits =
+			PCEP_STATS_READ(thr->stats.num_path_cache_hits);
+		s.num_path_cache_misses =
+			PCEP_STATS_READ(thr->stats.num_path_cache_misses);
+		s.num_pc_req_expired =
+			PCEP_STATS_READ(thr->stats.num_pc_req_expired);
+		s.num_pc_req_refused =
+			PCEP_STATS_READ(thr->stats.num_pc_req_refused);
+
+		snprintf(id, sizeof(id), "%d", i);
+		fprintf(f, PCE_STATS_FMT, id, sess, acc, ref,
+			s.num_keep_alive_rcvd, s.num_keep_alive_sent,
+			s.num_pc_req_rcvd, s.num_pc_rep_sent,
+			s.num_pc_err_sent, s.num_unknown_rcvd,
+			s.num_path_cache_hits, s.num_path_cache_misses,
+			s.num_pc_req_expired, s.num_pc_req_refused);
+
+		tot_sess += sess;
+		tot_acc += acc;
+		tot_ref += ref;
+		tot.num_keep_alive_rcvd += s.num_keep_alive_rcvd;
+		tot.num_keep_alive_sent += s.num_keep_alive_sent;
+		tot.num_pc_req_rcvd += s.num_pc_req_rcvd;
+		tot.num_pc_rep_sent += s.num_pc_rep_sent;
+		tot.num_pc_err_sent += s.num_pc_err_sent;
+		tot.num_unknown_rcvd += s.num_unknown_rcvd;
+		tot.num_path_cache_hits += s.num_path_cache_hits;
+		tot.num_path_cache_misses += s.num_path_cache_misses;
+		tot.num_pc_req_expired += s.num_pc_req_expired;
+		tot.num_pc_req_refused += s.num_pc_req_refused;
+	}
+	fprintf(f, PCE_STATS_FMT, "total", tot_sess, tot_acc, tot_ref,
+		tot.num_keep_alive_rcvd, tot.num_keep_alive_sent,
+		tot.num_pc_req_rcvd, tot.num_pc_rep_sent,
+		tot.num_pc_err_sent, tot.num_unknown_rcvd,
+		tot.num_path_cache_hits, tot.num_path_cache_misses,
+		tot.num_pc_req_expired, tot.num_pc_req_refused);
+#undef PCE_STATS_FMT
+
+	fclose(f);
 }
 
+/*
+ * pce_server_ted_update - Apply the link changes of the update file to the
+ * topology, the engines catch up before their next computation
+ */
+static void pce_server_ted_update(struct pce_server_data *data)
+{
+	struct pce_ted_link *links;
+	uint32_t i, num_links;
+	int ret;
+
+	if (!data->ted || !data->ted_update)
+		return;
+	if (pce_ted_read_links(data->ted_update, &links, &num_links))
+		return;
+
+	for (i = 0; i < num_links; i++) {
+		ret = pce_ted_update(data->ted, &links[i]);
+		if (ret < 0)
+			break;
+		if (!ret)
+			pce_log(LOG_ERR, "unknown link in TED update file "
+				"'%s'\n", data->ted_update);
+	}
+	free(links);
+	pce_log(LOG_DEBUG, "applied %u of %u TED changes\n", i, num_links);
+}
 
-static void pce_sigterm_handler(int signal)
+/*
+ * pce_server_init - PCE server initialization
+ */
+int pce_server_init(struct pce_server_data *data)
 {
+	int i, sig, err = -1;
+	sigset_t sigs;
+	struct pce_server_thread *thr;
+
+	pce_log(LOG_DEBUG, "starting PCE server ...\n");
+
+	data->threads = calloc(data->num_threads, sizeof(*data->threads));
+	if (!data->threads) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto out;
+	}
+
+	/*
+	 * signals are handled synchronously by the main thread only, the
+	 * server threads inherit the blocked signal mask
+	 */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	/* the workers only make sense with a topology to compute paths on */
+	if (data->num_workers && data->ted) {
+		data->pool = pce_worker_pool_create(data->num_workers,
+			data->ted, data->cache_size);
+		if (!data->pool)
+			goto err0;
+		data->running = 1;
+	}
+
+	/* one listening socket and event loop per server thread */
+	for (i = 0; i < data->num_threads; i++) {
+		thr = &data->threads[i];
+		thr->id = i;
+		thr->data = data;
+		if (pce_server_thread_init(thr))
+			goto err1;
+	}
+	for (i = 0; i < data->num_threads; i++) {
+		thr = &data->threads[i];
+		if (pthread_create(&thr->tid, NULL, pce_server_thread_run,
+				thr)) {
+			pce_log(LOG_ERR, "failed to create PCE server "
+				"thread\n");
+			goto err2;
+		}
+	}
+	pce_server_start(data, 1);
+	data->running = 1;
+
+	/* wait for termination, dump statistics or change links on demand */
+	while (sigwait(&sigs, &sig) == 0) {
+		if (sig == SIGUSR1) {
+			pce_server_stats(data);
+			continue;
+		}
+		if (sig == SIGHUP) {
+			pce_server_ted_update(data);
+			continue;
+		}
+		pce_log(LOG_DEBUG, "closing PCE server ...\n");
+		pce_pidfile_delete(PCE_PIDFILE);
+		err = 0;
+		break;
+	}
+
+	/*
+	 * the server threads are never joined: they block in their event
+	 * loops and go away with the process
+	 */
+	return err;
+
+err2:
+	/*
+	 * the threads started are still waiting: they return without having
+	 * touched their loops, which are all released below
+	 */
+	pce_server_start(data, -1);
+	while (i-- > 0)
+		pthread_join(data->threads[i].tid, NULL);
+	i = data->num_threads;
 	pce_pidfile_delete(PCE_PIDFILE);
-	exit(EXIT_SUCCESS);
+err1:
+	while (i-- > 0)
+		pce_server_thread_exit(&data->threads[i]);
+err0:
+	free(data->threads);
+out:
+	return err;
 }
 
 static void pce_server_usage(FILE * out)
 {
 	static const char usage_str[] =
-		("Usage:                                                \n"
-		"  pce server [options]                               \n\n"
-		"Options:                                               \n"
-		"  -a | --address    PCE server address                 \n"
-		"  -p | --port       PCE server port                    \n"
-		"  -d | --debug      PCE server debug mode              \n"
-		"  -v | --version    show the program version and exit  \n"
-		"  -h | --help       show this help and exit          \n\n"
-		"Examples:                                              \n"
-		"  pce server -d -p 4189                              \n\n");
+		("Usage:                                                   \n"
+		"  pce server [options]                                  \n\n"
+		"Options:                                                  \n"
+		"  -a | --address      PCE server address                  \n"
+		"  -p | --port         PCE server port                     \n"
+		"  -d | --debug        PCE server debug mode               \n"
+		"  -t | --threads      PCE server threads (default 1)      \n"
+		"  -b | --rcvbuf       receive buffer in KB (default 64)   \n"
+		"  -T | --ted          topology file (text or binary)      \n"
+		"  -U | --ted-update   link changes applied on SIGHUP      \n"
+		"  -w | --workers      CSPF worker threads (default 0)     \n"
+		"  -c | --cache        path cache entries (default 4096)   \n"
+		"  -m | --max-sessions PCEP sessions (default 0: any)      \n"
+		"  -q | --max-pending  requests pending before overload    \n"
+		"                      (default 4096)                      \n"
+		"  -v | --version      show the program version and exit   \n"
+		"  -h | --help         show this help and exit           \n\n"
+		"Examples:                                                 \n"
+		"  pce server -d -p 4189                                   \n"
+		"  pce server -t 32                                        \n"
+		"  pce server -t 4 -w 16 -T ted.bin                      \n\n");
 
 	fprintf(out, "%s", usage_str);
 	fflush(out);
@@ -314,6 +600,14 @@ static const struct option pce_server_options[] = {
 	{"addr", required_argument, NULL, 'a'},
 	{"port", required_argument, NULL, 'p'},
 	{"debug", no_argument, NULL, 'd'},
+	{"threads", required_argument, NULL, 't'},
+	{"rcvbuf", required_argument, NULL, 'b'},
+	{"ted", required_argument, NULL, 'T'},
+	{"ted-update", required_argument, NULL, 'U'},
+	{"workers", required_argument, NULL, 'w'},
+	{"cache", required_argument, NULL, 'c'},
+	{"max-sessions", required_argument, NULL, 'm'},
+	{"max-pending", required_argument, NULL, 'q'},
 	{"version", no_argument, NULL, 'v'},
 	{"help", no_argument, NULL, 'h'},
 	{NULL, 0, NULL, 0}
@@ -323,14 +617,22 @@ int pce_server_main(int argc, char *argv[])
 {
 	int err, opt;
 	int debug = 0;
+	int threads = 1;
+	int workers = 0;
+	int cache = PCE_CSPF_CACHE_SIZE;
+	int rcvbuf = PCEP_DEFAULT_RECV_BUF_SIZE / 1024;
+	int max_sessions = PCEP_DEFAULT_MAX_SESSIONS;
+	int max_pending = PCEP_DEFAULT_LOAD_HIGH;
 	int ppid = getpid();
 	char *port = PCE_SERVICE;
 	char *addr = NULL;
+	char *ted = NULL;
+	char *ted_update = NULL;
 	struct addrinfo hints;
 	struct pce_server_data *data;
 
 	/* parse PCE server command line options */
-	while ((opt = getopt_long(argc, argv, "da:p:vh", pce_server_options,
+	while ((opt = getopt_long(argc, argv, "da:p:t:b:T:U:w:c:m:q:vh", pce_server_options,
 				NULL)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -342,6 +644,59 @@ int pce_server_main(int argc, char *argv[])
 		case 'p':
 			port = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > PCE_THREADS_MAX) {
+				pce_server_usage(stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'b':
+			/* the ring size is a power of 2 fitting any message */
+			rcvbuf = atoi(optarg);
+			if (rcvbuf < PCEP_FRAMER_RING_SIZE / 1024 ||
+				rcvbuf > PCE_RCVBUF_MAX || (rcvbuf & (rcvbuf - 1))) {
+				pce_server_usage(stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'T':
+			ted = optarg;
+			break;
+		case 'U':
+			ted_update = optarg;
+			break;
+		case 'w':
+			workers = atoi(optarg);
+			if (workers < 0 || workers > PCE_WORKERS_MAX) {
+				pce_server_usage(stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'c':
+			/* a power of 2, 0 disables the cache */
+			cache = atoi(optarg);
+			if (cache < 0 || cache > PCE_CACHE_MAX ||
+				(cache & (cache - 1))) {
+				pce_server_usage(stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'm':
+			/* 0: no limit */
+			max_sessions = atoi(optarg);
+			if (max_sessions < 0) {
+				pce_server_usage(stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'q':
+			max_pending = atoi(optarg);
+			if (max_pending < 1) {
+				pce_server_usage(stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'v':
 			pce_server_version(stdout);
 			exit(EXIT_SUCCESS);
@@ -358,6 +713,13 @@ int pce_server_main(int argc, char *argv[])
 	pce_log_open(debug ? LOG_PERROR : LOG_PID);
 	pce_log_level(debug ? LOG_DEBUG : LOG_ERR);
 
+	/* the session FSM must handle every event in every state */
+	if (pcep_session_fsm_check()) {
+		err = EINVAL;
+		pce_log(LOG_ERR, "incomplete PCEP session FSM\n");
+		goto out1;
+	}
+
 	/* allocate PCE server data */
 	data = calloc(sizeof(*data), 1);
 	if (!data) {
@@ -366,6 +728,40 @@ int pce_server_main(int argc, char *argv[])
 		goto out1;
 	}
 	data->debug = debug;
+	data->num_threads = threads;
+	data->num_workers = workers;
+	data->cache_size = cache;
+	data->ted_update = ted_update;
+
+	/* default PCEP session attributes */
+	data->cfg.open_wait_timer = PCEP_DEFAULT_OPEN_WAIT_TIMER;
+	data->cfg.keep_wait_timer = PCEP_DEFAULT_KEEP_WAIT_TIMER;
+	data->cfg.keep_alive_timer = PCEP_DEFAULT_KEEP_ALIVE_TIMER;
+	data->cfg.dead_timer = PCEP_DEFAULT_DEAD_TIMER;
+	data->cfg.sync_timer = PCEP_DEFAULT_SYNC_TIMER;
+	data->cfg.request_timer = PCEP_DEFAULT_REQUEST_TIMER;
+	data->cfg.init_backoff_timer = PCEP_DEFAULT_INIT_BACKOFF_TIMER;
+	data->cfg.max_backoff_timer = PCEP_DEFAULT_MAX_BACKOFF_TIMER;
+	data->cfg.max_sessions = max_sessions;
+	data->cfg.max_req_per_session = PCEP_DEFAULT_MAX_REQ_PER_SESSION;
+	data->cfg.max_unknown_reqs = PCEP_DEFAULT_MAX_UNKNOWN_REQS;
+	data->cfg.max_unknown_msgs = PCEP_DEFAULT_MAX_UNKNOWN_MSGS;
+	data->cfg.recv_buf_size = rcvbuf * 1024;
+	data->cfg.read_budget = PCEP_DEFAULT_READ_BUDGET;
+	data->cfg.send_hwm = PCEP_DEFAULT_SEND_HWM;
+
+	/* overloaded at max_pending requests pending, until half of them */
+	data->load.high = max_pending;
+	data->load.low = max_pending / 2;
+
+	/* load the topology paths are computed on */
+	if (ted) {
+		data->ted = pce_ted_load(ted);
+		if (!data->ted) {
+			err = EINVAL;
+			goto out2;
+		}
+	}
 
 	/* obtain address(es) structure matching service */
 	memset(&hints, 0, sizeof(hints));
@@ -376,7 +772,7 @@ int pce_server_main(int argc, char *argv[])
 	err = getaddrinfo(addr, port, &hints, &data->addr);
 	if (err || !data->addr) {
 		pce_log(LOG_ERR, "failed getaddrinfo: %s\n", gai_strerror(err));
-		goto out2;
+		goto out3;
 	}
 
 	/* daemonize */
@@ -430,15 +826,23 @@ int pce_server_main(int argc, char *argv[])
 	}
 
 	/* register PCE server signal handlers */
-	signal(SIGINT, pce_sigterm_handler);
-	signal(SIGTERM, pce_sigterm_handler);
-	signal(SIGCHLD, pce_sigchld_handler);
+	signal(SIGPIPE, SIG_IGN);
 
 	/* init PCE server */
 	err = pce_server_init(data);
 
+	/*
+	 * the server threads and the workers are never stopped: once any of
+	 * them started, the server data is in use until the process exits
+	 */
+	if (data->running)
+		goto out1;
+
 	/* free PCE server resources */
 	freeaddrinfo(data->addr);
+out3:
+	if (data->ted)
+		pce_ted_delete(data->ted);
 out2:
 	free(data);
 out1:
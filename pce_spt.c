@@ -0,0 +1,331 @@
+/*
+ * pce_spt.c - PCE incremental shortest path trees
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "pce_log.h"
+#include "pce_ted.h"
+#include "pce_cspf.h"
+#include "pce_spt.h"
+
+/*
+ * pce_spt_create - Create the (empty) set of trees of an engine
+ */
+struct pce_spt_set *pce_spt_create(const struct pce_ted *ted)
+{
+	struct pce_spt_set *s;
+	uint32_t n = ted->num_nodes ? ted->num_nodes : 1;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		goto err;
+	s->ted = ted;
+	s->stack = malloc(n * sizeof(*s->stack));
+	s->cut = malloc(n * sizeof(*s->cut));
+	if (!s->stack || !s->cut)
+		goto err1;
+
+	return s;
+
+err1:
+	pce_spt_delete(s);
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_spt_delete - Release a set of trees
+ */
+void pce_spt_delete(struct pce_spt_set *s)
+{
+	int i;
+
+	for (i = 0; i < PCE_SPT_MAX; i++) {
+		free(s->trees[i].d.nodes);
+		free(s->trees[i].d.heap);
+	}
+	free(s->stack);
+	free(s->cut);
+	free(s);
+}
+
+/*
+ * pce_spt_weight - Weight of a link for a metric, PCE_CSPF_INF if down
+ */
+static inline uint64_t pce_spt_weight(const struct pce_ted *ted, int metric,
+	uint32_t e)
+{
+	uint32_t te = ted->te_metric[e];
+
+	if (te == PCE_TED_METRIC_DOWN)
+		return PCE_CSPF_INF;
+
+	switch (metric) {
+	case PCE_CSPF_METRIC_IGP:
+		return ted->igp_metric[e];
+	case PCE_CSPF_METRIC_HOPS:
+		return 1;
+	default:
+		return te;
+	}
+}
+
+/*
+ * pce_spt_relax - Label a node reached through a link, if it is closer
+ *
+ * Unlike a plain search, a settled node may improve (when links get
+ * better) and goes back in the heap.
+ */
+static inline void pce_spt_relax(struct pce_cspf_dir *d, uint32_t v,
+	uint32_t link, uint64_t dist)
+{
+	struct pce_cspf_node *w = &d->nodes[v];
+
+	if (dist >= w->dist)
+		return;
+	w->dist = dist;
+	w->prev = link;
+	if (w->pos == PCE_CSPF_DONE) {
+		w->pos = d->heap_len++;
+		d->heap[w->pos] = v;
+	}
+	pce_cspf_heap_up(d, w->pos);
+}
+
+/*
+ * pce_spt_run - Settle the nodes in the heap and whatever they improve
+ */
+static void pce_spt_run(const struct pce_ted *ted, struct pce_spt *t)
+{
+	struct pce_cspf_dir *d = &t->d;
+	uint32_t u, e;
+	uint64_t dist, w;
+
+	while (d->heap_len) {
+		u = pce_cspf_heap_pop(d);
+		dist = d->nodes[u].dist;
+		for (e = ted->row[u]; e < ted->row[u + 1]; e++) {
+			w = pce_spt_weight(ted, t->metric, e);
+			if (w != PCE_CSPF_INF)
+				pce_spt_relax(d, ted->dst[e], e, dist + w);
+		}
+	}
+}
+
+/*
+ * pce_spt_build - Compute the tree of a source from scratch
+ */
+static int pce_spt_build(const struct pce_ted *ted, struct pce_spt *t,
+	uint32_t src, int metric)
+{
+	struct pce_cspf_dir *d = &t->d;
+	uint32_t n = ted->num_nodes, v;
+
+	if (!d->nodes) {
+		d->nodes = malloc(n * sizeof(*d->nodes));
+		d->heap = malloc(n * sizeof(*d->heap));
+		if (!d->nodes || !d->heap) {
+			free(d->nodes);
+			free(d->heap);
+			d->nodes = NULL;
+			d->heap = NULL;
+			return -1;
+		}
+	}
+
+	for (v = 0; v < n; v++) {
+		d->nodes[v].dist = PCE_CSPF_INF;
+		d->nodes[v].prev = PCE_SPT_NONE;
+		d->nodes[v].pos = PCE_CSPF_DONE;
+	}
+	d->heap_len = 0;
+	t->src = src;
+	t->metric = metric;
+	pce_spt_relax(d, src, PCE_SPT_NONE, 0);
+	pce_spt_run(ted, t);
+
+	return 0;
+}
+
+/*
+ * pce_spt_get - Get the tree of a source, building it once the source is
+ * hot
+ */
+static struct pce_spt *pce_spt_get(struct pce_spt_set *s, uint32_t src,
+	int metric)
+{
+	struct pce_spt *t, *lru = NULL;
+	struct pce_spt_hot *h;
+	int i;
+
+	for (i = 0; i < s->num_trees; i++) {
+		t = &s->trees[i];
+		if (t->src == src && t->metric == metric)
+			return t;
+		if (!lru || t->last_use < lru->last_use)
+			lru = t;
+	}
+
+	h = &s->hot[(src * 2654435761U ^ metric) & (PCE_SPT_SLOTS - 1)];
+	if (h->src != src || h->metric != metric || !h->count) {
+		h->src = src;
+		h->metric = metric;
+		h->count = 0;
+	}
+	if (++h->count < PCE_SPT_HOT)
+		return NULL;
+	h->count = 0;
+
+	/* a free tree, or the least recently used one */
+	t = s->num_trees < PCE_SPT_MAX ? &s->trees[s->num_trees] : lru;
+	if (pce_spt_build(s->ted, t, src, metric))
+		return NULL;
+	if (t == &s->trees[s->num_trees])
+		s->num_trees++;
+
+	return t;
+}
+
+/*
+ * pce_spt_path - Get the shortest path from a tree, src and dst are nodes
+ * and hops has room for a path through all of them
+ *
+ * Returns 1 and fills path, 0 if there is no path or -1 if the source has
+ * no tree (yet).
+ */
+int pce_spt_path(struct pce_spt_set *s, uint32_t src, uint32_t dst,
+	int metric, uint32_t *hops, struct pce_cspf_path *path)
+{
+	const struct pce_ted *ted = s->ted;
+	struct pce_cspf_node *nodes;
+	struct pce_spt *t;
+	uint32_t v, n;
+
+	if (metric != PCE_CSPF_METRIC_IGP && metric != PCE_CSPF_METRIC_HOPS)
+		metric = PCE_CSPF_METRIC_TE;
+	t = pce_spt_get(s, src, metric);
+	if (!t)
+		return -1;
+	t->last_use = ++s->clock;
+
+	nodes = t->d.nodes;
+	if (nodes[dst].dist == PCE_CSPF_INF)
+		return 0;
+
+	/* walk up to the root, then again filling the hops backwards */
+	for (v = dst, n = 1; v != src; n++)
+		v = pce_ted_link_src(ted, nodes[v].prev);
+	path->hops = hops;
+	path->num_hops = n;
+	path->cost = nodes[dst].dist;
+	for (v = dst; ; v = pce_ted_link_src(ted, nodes[v].prev)) {
+		hops[--n] = ted->node_id[v];
+		if (!n)
+			break;
+	}
+
+	return 1;
+}
+
+/*
+ * pce_spt_cut - Cut off the subtree of a node, appending its nodes to the
+ * cut list
+ */
+static uint32_t pce_spt_cut(struct pce_spt_set *s, struct pce_spt *t,
+	uint32_t v, uint32_t num_cut)
+{
+	const struct pce_ted *ted = s->ted;
+	struct pce_cspf_node *nodes = t->d.nodes;
+	uint32_t top = 0, u, e;
+
+	s->stack[top++] = v;
+	while (top) {
+		u = s->stack[--top];
+		s->cut[num_cut++] = u;
+
+		/* the children still point to their parent link */
+		for (e = ted->row[u]; e < ted->row[u + 1]; e++)
+			if (nodes[ted->dst[e]].prev == e)
+				s->stack[top++] = ted->dst[e];
+		nodes[u].dist = PCE_CSPF_INF;
+		nodes[u].prev = PCE_SPT_NONE;
+	}
+
+	return num_cut;
+}
+
+/*
+ * pce_spt_repair - Bring the trees up to date with the links changed
+ *
+ * The subtrees hanging from the links changed are cut off and relabeled
+ * from their neighbours still in the tree, the links changed relabel the
+ * nodes they reach, then every improvement spreads as in a plain search.
+ *
+ * Returns the number of trees that changed.
+ */
+int pce_spt_repair(struct pce_spt_set *s, const uint32_t *links,
+	uint32_t num_links)
+{
+	const struct pce_ted *ted = s->ted;
+	struct pce_cspf_node *nodes;
+	struct pce_spt *t;
+	uint32_t i, j, k, u, v, e, num_cut;
+	uint64_t w;
+	int num = 0;
+
+	for (i = 0; i < (uint32_t)s->num_trees; i++) {
+		t = &s->trees[i];
+		nodes = t->d.nodes;
+
+		num_cut = 0;
+		for (j = 0; j < num_links; j++) {
+			v = ted->dst[links[j]];
+			if (nodes[v].prev == links[j])
+				num_cut = pce_spt_cut(s, t, v, num_cut);
+		}
+		for (j = 0; j < num_cut; j++) {
+			v = s->cut[j];
+			for (k = ted->rev_row[v]; k < ted->rev_row[v + 1]; k++) {
+				u = ted->rev_src[k];
+				e = ted->rev_link[k];
+				w = pce_spt_weight(ted, t->metric, e);
+				if (nodes[u].dist != PCE_CSPF_INF &&
+					w != PCE_CSPF_INF)
+					pce_spt_relax(&t->d, v, e,
+						nodes[u].dist + w);
+			}
+		}
+		for (j = 0; j < num_links; j++) {
+			e = links[j];
+			u = pce_ted_link_src(ted, e);
+			w = pce_spt_weight(ted, t->metric, e);
+			if (nodes[u].dist != PCE_CSPF_INF &&
+				w != PCE_CSPF_INF)
+				pce_spt_relax(&t->d, ted->dst[e], e,
+					nodes[u].dist + w);
+		}
+
+		if (num_cut || t->d.heap_len) {
+			pce_spt_run(ted, t);
+			num++;
+		}
+	}
+
+	return num;
+}
+
+/*
+ * pce_spt_reset - Drop all the trees, when the changes can't be followed
+ */
+void pce_spt_reset(struct pce_spt_set *s)
+{
+	s->num_trees = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * pce_spt.h - PCE incremental shortest path trees interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_SPT_H
+#define PCE_SPT_H
+
+#include <stdint.h>
+
+#include "pce_ted.h"
+#include "pce_cspf.h"
+
+/*
+ * An engine keeps the full shortest path tree of the few sources most
+ * requests come from (its hot sources), so an unconstrained request from
+ * them is answered by walking the tree back from the destination. When
+ * links change, the trees are repaired rather than computed again
+ * (dynamic SPF): the subtrees hanging from the links that changed are
+ * cut off, relabeled from their neighbours still in the tree, and the
+ * improvements spread from there, so the work is bounded by the part of
+ * the tree that actually moved.
+ *
+ * A tree uses the labels and heap of a search direction, where the label
+ * of a node holds its parent link instead of its previous node.
+ */
+
+#define PCE_SPT_MAX   4		/* trees per engine */
+#define PCE_SPT_HOT   8		/* requests before a source gets a tree */
+#define PCE_SPT_SLOTS 64	/* sources whose requests are counted */
+
+#define PCE_SPT_NONE  (~0U)	/* parent link of the root and unreached */
+
+struct pce_spt {
+	uint32_t src;		/* node */
+	int metric;
+	unsigned long last_use;
+	struct pce_cspf_dir d;
+};
+
+struct pce_spt_hot {
+	uint32_t src;
+	int metric;
+	unsigned int count;
+};
+
+struct pce_spt_set {
+	const struct pce_ted *ted;
+	unsigned long clock;
+	int num_trees;
+	struct pce_spt trees[PCE_SPT_MAX];
+	struct pce_spt_hot hot[PCE_SPT_SLOTS];
+
+	/* repair scratch memory, a node each */
+	uint32_t *stack;
+	uint32_t *cut;
+};
+
+extern struct pce_spt_set *pce_spt_create(const struct pce_ted *ted);
+extern void pce_spt_delete(struct pce_spt_set *s);
+
+extern int pce_spt_path(struct pce_spt_set *s, uint32_t src, uint32_t dst,
+	int metric, uint32_t *hops, struct pce_cspf_path *path);
+extern int pce_spt_repair(struct pce_spt_set *s, const uint32_t *links,
+	uint32_t num_links);
+extern void pce_spt_reset(struct pce_spt_set *s);
+
+#endif /* PCE_SPT_H */
@@ -0,0 +1,629 @@
+/*
+ * pce_ted.c - PCE traffic engineering database
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pce_log.h"
+#include "pce_ted.h"
+
+/* smallest link array allocation while reading an edge list */
+#define PCE_TED_LINKS_MIN 1024
+
+static int pce_ted_id_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * pce_ted_create - Build the CSR graph of a list of links
+ */
+struct pce_ted *pce_ted_create(struct pce_ted_link *links,
+	uint32_t num_links)
+{
+	struct pce_ted *ted;
+	uint32_t *ids, *node_id, *row, *dst, *te, *igp, *aff;
+	uint32_t *rev_row, *rev_link, *rev_src;
+	uint32_t i, n, u, e, pos;
+	float *bw;
+	size_t size;
+	char *mem;
+
+	ted = calloc(1, sizeof(*ted));
+	if (!ted)
+		goto err;
+
+	/* nodes are numbered by ascending router id */
+	ids = malloc(2 * (size_t)num_links * sizeof(*ids) + 1);
+	if (!ids)
+		goto err1;
+	for (i = 0; i < num_links; i++) {
+		ids[2 * i] = links[i].src;
+		ids[2 * i + 1] = links[i].dst;
+	}
+	qsort(ids, 2 * (size_t)num_links, sizeof(*ids), pce_ted_id_cmp);
+	for (i = 0, n = 0; i < 2 * num_links; i++)
+		if (!n || ids[i] != ids[n - 1])
+			ids[n++] = ids[i];
+
+	/* a single block holds all the arrays */
+	size = (3 * (size_t)n + 2) * sizeof(uint32_t) +
+		(size_t)num_links * (6 * sizeof(uint32_t) + sizeof(float));
+	mem = malloc(size);
+	if (!mem)
+		goto err2;
+	node_id = (uint32_t *)mem;
+	row = node_id + n;
+	dst = row + n + 1;
+	te = dst + num_links;
+	igp = te + num_links;
+	aff = igp + num_links;
+	rev_row = aff + num_links;
+	rev_link = rev_row + n + 1;
+	rev_src = rev_link + num_links;
+	bw = (float *)(rev_src + num_links);
+
+	memcpy(node_id, ids, n * sizeof(*ids));
+	free(ids);
+
+	ted->num_nodes = n;
+	ted->num_links = num_links;
+	ted->node_id = node_id;
+	ted->mem = mem;
+	ted->mem_size = size;
+
+	/* count the links leaving every node, then place them */
+	memset(row, 0, (n + 1) * sizeof(*row));
+	for (i = 0; i < num_links; i++)
+		row[pce_ted_node(ted, links[i].src) + 1]++;
+	for (i = 0; i < n; i++)
+		row[i + 1] += row[i];
+	for (i = 0; i < num_links; i++) {
+		u = pce_ted_node(ted, links[i].src);
+		pos = row[u]++;
+		dst[pos] = pce_ted_node(ted, links[i].dst);
+		te[pos] = links[i].te_metric;
+		igp[pos] = links[i].igp_metric;
+		bw[pos] = links[i].unrsv_bw;
+		aff[pos] = links[i].affinity;
+	}
+	for (i = n; i > 0; i--)
+		row[i] = row[i - 1];
+	row[0] = 0;
+
+	/* same for the links entering every node */
+	memset(rev_row, 0, (n + 1) * sizeof(*rev_row));
+	for (e = 0; e < num_links; e++)
+		rev_row[dst[e] + 1]++;
+	for (i = 0; i < n; i++)
+		rev_row[i + 1] += rev_row[i];
+	for (u = 0; u < n; u++) {
+		for (e = row[u]; e < row[u + 1]; e++) {
+			pos = rev_row[dst[e]]++;
+			rev_link[pos] = e;
+			rev_src[pos] = u;
+		}
+	}
+	for (i = n; i > 0; i--)
+		rev_row[i] = rev_row[i - 1];
+	rev_row[0] = 0;
+
+	ted->row = row;
+	ted->rev_row = rev_row;
+	ted->rev_link = rev_link;
+	ted->rev_src = rev_src;
+	ted->dst = dst;
+	ted->te_metric = te;
+	ted->igp_metric = igp;
+	ted->unrsv_bw = bw;
+	ted->affinity = aff;
+
+	return ted;
+
+err2:
+	free(ids);
+err1:
+	free(ted);
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_ted_delete - Release a topology
+ */
+void pce_ted_delete(struct pce_ted *ted)
+{
+	if (ted->mapped)
+		munmap(ted->mem, ted->mem_size);
+	else
+		free(ted->mem);
+	free(ted->changes);
+	free(ted);
+}
+
+/*
+ * pce_ted_update - Change the attributes of every link from l->src to
+ * l->dst, a link taken down keeps its other attributes
+ *
+ * Meant for a single writer: the engines read the attributes as they
+ * change, and redo or repair whatever they computed on older generations.
+ * The links change within an odd sequence count, for the readers to tell
+ * (see pce_ted_read_retry()), and every change is published by the
+ * release of the generation it makes.
+ *
+ * Returns the number of links changed, or -1.
+ */
+int pce_ted_update(struct pce_ted *ted, const struct pce_ted_link *l)
+{
+	uint32_t *te, *igp, *aff;
+	long src, dst;
+	uint32_t e;
+	float *bw;
+	int n = 0, down = l->te_metric == PCE_TED_METRIC_DOWN;
+	struct pce_ted_change *ch;
+
+	src = pce_ted_node(ted, l->src);
+	dst = pce_ted_node(ted, l->dst);
+	if (src < 0 || dst < 0)
+		return 0;
+
+	if (!ted->changes) {
+		ted->changes = calloc(PCE_TED_CHANGES, sizeof(*ted->changes));
+		if (!ted->changes) {
+			pce_log(LOG_ERR, "failed to get memory\n");
+			return -1;
+		}
+	}
+
+	/* a mapped file gets private copies of the pages written */
+	if (ted->mapped && !ted->writable) {
+		if (mprotect(ted->mem, ted->mem_size,
+			PROT_READ | PROT_WRITE) < 0) {
+			pce_log(LOG_ERR, "failure in mprotect(): %s\n",
+				strerror(errno));
+			return -1;
+		}
+		ted->writable = 1;
+	}
+	te = (uint32_t *)ted->te_metric;
+	igp = (uint32_t *)ted->igp_metric;
+	bw = (float *)ted->unrsv_bw;
+	aff = (uint32_t *)ted->affinity;
+
+	__atomic_store_n(&ted->seq, ted->seq + 1, __ATOMIC_RELAXED);
+	for (e = ted->row[src]; e < ted->row[src + 1]; e++) {
+		if (ted->dst[e] != (uint32_t)dst)
+			continue;
+
+		/*
+		 * the slot reused is written after the generations published,
+		 * an engine reading it sees them (see pce_cspf_sync())
+		 */
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		ch = &ted->changes[(ted->gen + 1) % PCE_TED_CHANGES];
+		__atomic_store_n(&ch->link, e, __ATOMIC_RELAXED);
+		if (down) {
+			__atomic_store_n(&ch->worse, 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&te[e], PCE_TED_METRIC_DOWN,
+				__ATOMIC_RELAXED);
+			__atomic_store_n(&igp[e], PCE_TED_METRIC_DOWN,
+				__ATOMIC_RELAXED);
+		} else {
+			__atomic_store_n(&ch->worse, l->te_metric >= te[e] &&
+				l->igp_metric >= igp[e] &&
+				l->unrsv_bw <= bw[e] && l->affinity == aff[e],
+				__ATOMIC_RELAXED);
+			__atomic_store_n(&te[e], l->te_metric,
+				__ATOMIC_RELAXED);
+			__atomic_store_n(&igp[e], l->igp_metric,
+				__ATOMIC_RELAXED);
+			__atomic_store(&bw[e], &l->unrsv_bw, __ATOMIC_RELAXED);
+			__atomic_store_n(&aff[e], l->affinity,
+				__ATOMIC_RELAXED);
+		}
+
+		/* publish the change with the generation it makes */
+		__atomic_store_n(&ted->gen, ted->gen + 1, __ATOMIC_RELEASE);
+		n++;
+	}
+	__atomic_store_n(&ted->seq, ted->seq + 1, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/*
+ * pce_ted_sec_len - Size of a section of a binary TED file
+ */
+static size_t pce_ted_sec_len(uint32_t num_nodes, uint32_t num_links,
+	int sec)
+{
+	switch (sec) {
+	case PCE_TED_SEC_NODE_ID:
+		return (size_t)num_nodes * sizeof(uint32_t);
+	case PCE_TED_SEC_ROW:
+	case PCE_TED_SEC_REV_ROW:
+		return ((size_t)num_nodes + 1) * sizeof(uint32_t);
+	case PCE_TED_SEC_UNRSV_BW:
+		return (size_t)num_links * sizeof(float);
+	default:
+		return (size_t)num_links * sizeof(uint32_t);
+	}
+}
+
+/*
+ * pce_ted_check_secs - Check that the sections of a binary TED file are
+ * aligned, within the file and don't overlap each other or the header
+ *
+ * The metrics are updated in place (see pce_ted_update()), a section
+ * sharing their bytes would change under the checks below.
+ */
+static int pce_ted_check_secs(const struct pce_ted_file_hdr *hdr)
+{
+	int order[PCE_TED_SECS];
+	uint64_t end = sizeof(*hdr);
+	size_t len;
+	int i, j, k;
+
+	for (i = 0; i < PCE_TED_SECS; i++) {
+		len = pce_ted_sec_len(hdr->num_nodes, hdr->num_links, i);
+		if (hdr->off[i] % PCE_TED_ALIGN || hdr->off[i] > hdr->size ||
+			len > hdr->size - hdr->off[i])
+			return -1;
+
+		/* sort by offset */
+		for (j = i; j > 0 && hdr->off[order[j - 1]] > hdr->off[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (i = 0; i < PCE_TED_SECS; i++) {
+		k = order[i];
+		len = pce_ted_sec_len(hdr->num_nodes, hdr->num_links, k);
+		if (!len)
+			continue;
+		if (hdr->off[k] < end)
+			return -1;
+		end = hdr->off[k] + len;
+	}
+
+	return 0;
+}
+
+/*
+ * pce_ted_check_row - Check that a row index array starts at 0, never goes
+ * back and ends with the last link
+ */
+static int pce_ted_check_row(const uint32_t *row, uint32_t num_nodes,
+	uint32_t num_links)
+{
+	uint32_t i;
+
+	if (row[0] || row[num_nodes] != num_links)
+		return -1;
+	for (i = 0; i < num_nodes; i++)
+		if (row[i] > row[i + 1])
+			return -1;
+
+	return 0;
+}
+
+/*
+ * pce_ted_check - Check that the arrays of a mapped topology index each
+ * other within bounds
+ *
+ * The node ids must also be in ascending order, for the lookups.
+ */
+static int pce_ted_check(const struct pce_ted *ted)
+{
+	uint32_t i;
+
+	for (i = 1; i < ted->num_nodes; i++)
+		if (ted->node_id[i - 1] >= ted->node_id[i])
+			return -1;
+	if (pce_ted_check_row(ted->row, ted->num_nodes, ted->num_links) ||
+		pce_ted_check_row(ted->rev_row, ted->num_nodes, ted->num_links))
+		return -1;
+	for (i = 0; i < ted->num_links; i++)
+		if (ted->dst[i] >= ted->num_nodes ||
+			ted->rev_src[i] >= ted->num_nodes ||
+			ted->rev_link[i] >= ted->num_links)
+			return -1;
+
+	return 0;
+}
+
+/*
+ * pce_ted_map - Map a binary TED file
+ *
+ * The arrays are used in place: they are only checked to index each other
+ * within bounds, so that a corrupted file can't take a search out of them.
+ */
+struct pce_ted *pce_ted_map(const char *path)
+{
+	const struct pce_ted_file_hdr *hdr;
+	struct pce_ted *ted;
+	struct stat st;
+	char *base;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		pce_log(LOG_ERR, "can't open TED file '%s'\n", path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+		pce_log(LOG_ERR, "truncated TED file '%s'\n", path);
+		goto err;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		pce_log(LOG_ERR, "failure in mmap(): %s\n", strerror(errno));
+		goto err;
+	}
+	close(fd);
+
+	/* the arrays are paged in behind our back */
+	madvise(base, st.st_size, MADV_WILLNEED);
+
+	hdr = (const struct pce_ted_file_hdr *)base;
+	if (memcmp(hdr->magic, PCE_TED_MAGIC, sizeof(hdr->magic)) ||
+		hdr->version != PCE_TED_VERSION ||
+		hdr->byte_order != PCE_TED_BYTE_ORDER ||
+		hdr->size != (uint64_t)st.st_size) {
+		pce_log(LOG_ERR, "bad TED file '%s'\n", path);
+		goto err1;
+	}
+	if (pce_ted_check_secs(hdr)) {
+		pce_log(LOG_ERR, "bad TED file '%s'\n", path);
+		goto err1;
+	}
+
+	ted = calloc(1, sizeof(*ted));
+	if (!ted) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto err1;
+	}
+	ted->num_nodes = hdr->num_nodes;
+	ted->num_links = hdr->num_links;
+	ted->node_id = (void *)(base + hdr->off[PCE_TED_SEC_NODE_ID]);
+	ted->row = (void *)(base + hdr->off[PCE_TED_SEC_ROW]);
+	ted->rev_row = (void *)(base + hdr->off[PCE_TED_SEC_REV_ROW]);
+	ted->dst = (void *)(base + hdr->off[PCE_TED_SEC_DST]);
+	ted->te_metric = (void *)(base + hdr->off[PCE_TED_SEC_TE_METRIC]);
+	ted->igp_metric = (void *)(base + hdr->off[PCE_TED_SEC_IGP_METRIC]);
+	ted->unrsv_bw = (void *)(base + hdr->off[PCE_TED_SEC_UNRSV_BW]);
+	ted->affinity = (void *)(base + hdr->off[PCE_TED_SEC_AFFINITY]);
+	ted->rev_link = (void *)(base + hdr->off[PCE_TED_SEC_REV_LINK]);
+	ted->rev_src = (void *)(base + hdr->off[PCE_TED_SEC_REV_SRC]);
+	ted->mem = base;
+	ted->mem_size = st.st_size;
+	ted->mapped = 1;
+
+	if (pce_ted_check(ted)) {
+		pce_log(LOG_ERR, "bad TED file '%s'\n", path);
+		goto err2;
+	}
+
+	return ted;
+
+err2:
+	free(ted);
+err1:
+	munmap(base, st.st_size);
+	return NULL;
+err:
+	close(fd);
+	return NULL;
+}
+
+/*
+ * pce_ted_save - Write a topology as a binary TED file
+ *
+ * The file is written aside and renamed, so a server starting meanwhile
+ * maps either the old or the new one.
+ */
+int pce_ted_save(const struct pce_ted *ted, const char *path)
+{
+	static const char zero[PCE_TED_ALIGN];
+	struct pce_ted_file_hdr hdr;
+	const void *sec[PCE_TED_SECS];
+	char tmp[4096];
+	uint64_t off;
+	size_t len;
+	FILE *f;
+	int i;
+
+	sec[PCE_TED_SEC_NODE_ID] = ted->node_id;
+	sec[PCE_TED_SEC_ROW] = ted->row;
+	sec[PCE_TED_SEC_REV_ROW] = ted->rev_row;
+	sec[PCE_TED_SEC_DST] = ted->dst;
+	sec[PCE_TED_SEC_TE_METRIC] = ted->te_metric;
+	sec[PCE_TED_SEC_IGP_METRIC] = ted->igp_metric;
+	sec[PCE_TED_SEC_UNRSV_BW] = ted->unrsv_bw;
+	sec[PCE_TED_SEC_AFFINITY] = ted->affinity;
+	sec[PCE_TED_SEC_REV_LINK] = ted->rev_link;
+	sec[PCE_TED_SEC_REV_SRC] = ted->rev_src;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PCE_TED_MAGIC, sizeof(hdr.magic));
+	hdr.version = PCE_TED_VERSION;
+	hdr.byte_order = PCE_TED_BYTE_ORDER;
+	hdr.num_nodes = ted->num_nodes;
+	hdr.num_links = ted->num_links;
+	off = sizeof(hdr);
+	for (i = 0; i < PCE_TED_SECS; i++) {
+		off = (off + PCE_TED_ALIGN - 1) & ~(uint64_t)(PCE_TED_ALIGN - 1);
+		hdr.off[i] = off;
+		off += pce_ted_sec_len(ted->num_nodes, ted->num_links, i);
+	}
+	hdr.size = off;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (!f) {
+		pce_log(LOG_ERR, "can't create TED file '%s'\n", tmp);
+		return -1;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto err;
+	off = sizeof(hdr);
+	for (i = 0; i < PCE_TED_SECS; i++) {
+		if (fwrite(zero, 1, hdr.off[i] - off, f) != hdr.off[i] - off)
+			goto err;
+		len = pce_ted_sec_len(ted->num_nodes, ted->num_links, i);
+		if (len && fwrite(sec[i], len, 1, f) != 1)
+			goto err;
+		off = hdr.off[i] + len;
+	}
+	if (fclose(f)) {
+		f = NULL;
+		goto err;
+	}
+	if (rename(tmp, path)) {
+		pce_log(LOG_ERR, "can't rename TED file '%s'\n", tmp);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+
+err:
+	pce_log(LOG_ERR, "failed to write TED file '%s'\n", tmp);
+	if (f)
+		fclose(f);
+	unlink(tmp);
+	return -1;
+}
+
+/*
+ * pce_ted_parse - Parse a line of the text edge list
+ *
+ * Returns 1 for a link, 0 for a line to skip and -1 for a malformed line.
+ */
+static int pce_ted_parse(char *line, struct pce_ted_link *l)
+{
+	char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN], state[5];
+	struct in_addr addr;
+
+	line += strspn(line, " \t");
+	if (*line == '#' || *line == '\n' || *line == '\0')
+		return 0;
+
+	if (sscanf(line, "%15s %15s %u %u %f %x", src, dst, &l->te_metric,
+		&l->igp_metric, &l->unrsv_bw, &l->affinity) != 6) {
+		if (sscanf(line, "%15s %15s %4s", src, dst, state) != 3 ||
+			strcmp(state, "down"))
+			return -1;
+		l->te_metric = PCE_TED_METRIC_DOWN;
+		l->igp_metric = PCE_TED_METRIC_DOWN;
+		l->unrsv_bw = 0;
+		l->affinity = 0;
+	}
+	if (inet_pton(AF_INET, src, &addr) != 1)
+		return -1;
+	l->src = ntohl(addr.s_addr);
+	if (inet_pton(AF_INET, dst, &addr) != 1)
+		return -1;
+	l->dst = ntohl(addr.s_addr);
+
+	return 1;
+}
+
+/*
+ * pce_ted_read_links - Read a text edge list
+ */
+int pce_ted_read_links(const char *path, struct pce_ted_link **links,
+	uint32_t *num_links)
+{
+	struct pce_ted_link *l = NULL, *tmp;
+	size_t n = 0, size = 0;
+	unsigned int lineno = 0;
+	char line[256];
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "r");
+	if (!f) {
+		pce_log(LOG_ERR, "can't open TED file '%s'\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (n == size) {
+			size = size ? 2 * size : PCE_TED_LINKS_MIN;
+			tmp = realloc(l, size * sizeof(*l));
+			if (!tmp) {
+				pce_log(LOG_ERR, "failed to get memory\n");
+				goto err;
+			}
+			l = tmp;
+		}
+		ret = pce_ted_parse(line, &l[n]);
+		if (ret < 0) {
+			pce_log(LOG_ERR, "malformed TED file '%s' at line "
+				"%u\n", path, lineno);
+			goto err;
+		}
+		n += ret;
+	}
+	fclose(f);
+
+	*links = l;
+	*num_links = n;
+
+	return 0;
+
+err:
+	free(l);
+	fclose(f);
+	return -1;
+}
+
+/*
+ * pce_ted_load - Load a topology from a binary TED file or a text edge
+ * list
+ */
+struct pce_ted *pce_ted_load(const char *path)
+{
+	struct pce_ted_link *links;
+	struct pce_ted *ted;
+	uint32_t num_links;
+	char magic[8];
+	FILE *f;
+	int bin;
+
+	f = fopen(path, "r");
+	if (!f) {
+		pce_log(LOG_ERR, "can't open TED file '%s'\n", path);
+		return NULL;
+	}
+	bin = fread(magic, sizeof(magic), 1, f) == 1 &&
+		!memcmp(magic, PCE_TED_MAGIC, sizeof(magic));
+	fclose(f);
+	if (bin)
+		return pce_ted_map(path);
+
+	if (pce_ted_read_links(path, &links, &num_links))
+		return NULL;
+	ted = pce_ted_create(links, num_links);
+	free(links);
+
+	return ted;
+}
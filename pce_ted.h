@@ -0,0 +1,213 @@
+/*
+ * pce_ted.h - PCE traffic engineering database interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_TED_H
+#define PCE_TED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The topology is a directed graph in compressed sparse row form: the
+ * links leaving node i are row[i] ... row[i + 1] - 1, and every link
+ * attribute lives in its own array (struct of arrays), so a path
+ * computation only touches the attributes it needs. The links entering
+ * node i are indexed the same way by rev_row[], so that a search can also
+ * run backwards from the destination. Nodes are numbered by ascending
+ * router id, which is looked up by binary search.
+ *
+ * The graph itself never changes, the attributes of its links may: every
+ * change bumps the topology generation and is recorded in a ring, so the
+ * engines can catch up with the changes they missed and repair what they
+ * derived from the topology instead of starting over. A computation
+ * reading the attributes while they change is done again (see
+ * pce_ted_read_begin()), so that it never mixes the attributes of a link
+ * from before and after a change.
+ */
+
+/* a link down has this TE and IGP metric */
+#define PCE_TED_METRIC_DOWN (~0U)
+
+/* changes remembered for the engines catching up (a power of 2) */
+#define PCE_TED_CHANGES 1024
+
+struct pce_ted_change {
+	uint32_t link;
+	int worse;		/* no path through the link got any better */
+};
+
+struct pce_ted {
+	uint32_t num_nodes;
+	uint32_t num_links;
+
+	/* nodes */
+	const uint32_t *node_id;	/* router ids (IPv4, host order) */
+	const uint32_t *row;		/* num_nodes + 1 entries */
+	const uint32_t *rev_row;	/* num_nodes + 1 entries */
+
+	/* links */
+	const uint32_t *dst;		/* head node */
+	const uint32_t *te_metric;
+	const uint32_t *igp_metric;
+	const float *unrsv_bw;		/* bytes per second */
+	const uint32_t *affinity;	/* administrative groups */
+
+	/* reverse links */
+	const uint32_t *rev_link;	/* index of the link */
+	const uint32_t *rev_src;	/* tail node */
+
+	/* backing memory */
+	void *mem;
+	size_t mem_size;
+	int mapped;
+
+	/* the change making generation g is changes[g % PCE_TED_CHANGES] */
+	unsigned long gen;
+	struct pce_ted_change *changes;
+	unsigned long seq;	/* odd while links change */
+	int writable;
+};
+
+/*
+ * Binary TED file: a header followed by the topology arrays, each at a
+ * 64 bytes aligned offset from the start of the file, in host byte order.
+ * The file is mapped read-only and used in place: the arrays are the CSR
+ * graph, nothing is parsed or copied.
+ */
+
+#define PCE_TED_MAGIC      "PCE-TED"	/* 8 bytes with the NUL */
+#define PCE_TED_VERSION    1
+#define PCE_TED_BYTE_ORDER 0x01020304
+#define PCE_TED_ALIGN      64
+
+/* sections of a binary TED file */
+#define PCE_TED_SEC_NODE_ID     0
+#define PCE_TED_SEC_ROW         1
+#define PCE_TED_SEC_REV_ROW     2
+#define PCE_TED_SEC_DST         3
+#define PCE_TED_SEC_TE_METRIC   4
+#define PCE_TED_SEC_IGP_METRIC  5
+#define PCE_TED_SEC_UNRSV_BW    6
+#define PCE_TED_SEC_AFFINITY    7
+#define PCE_TED_SEC_REV_LINK    8
+#define PCE_TED_SEC_REV_SRC     9
+#define PCE_TED_SECS           10
+
+struct pce_ted_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t num_nodes;
+	uint32_t num_links;
+	uint64_t size;			/* of the whole file */
+	uint64_t off[PCE_TED_SECS];	/* from the start of the file */
+};
+
+/*
+ * A link of the text edge list, one per line:
+ *
+ *   <src> <dst> <te-metric> <igp-metric> <unreserved-bw> <affinity>
+ *   <src> <dst> down
+ *
+ * addresses in dotted notation, bandwidth in bytes per second, affinity
+ * as a (hex) bit mask. Empty lines and lines starting with '#' are
+ * skipped. The same format lists the changes applied to a running
+ * topology.
+ */
+struct pce_ted_link {
+	uint32_t src;
+	uint32_t dst;
+	uint32_t te_metric;
+	uint32_t igp_metric;
+	float unrsv_bw;
+	uint32_t affinity;
+};
+
+extern struct pce_ted *pce_ted_create(struct pce_ted_link *links,
+	uint32_t num_links);
+extern struct pce_ted *pce_ted_load(const char *path);
+extern struct pce_ted *pce_ted_map(const char *path);
+extern int pce_ted_save(const struct pce_ted *ted, const char *path);
+extern void pce_ted_delete(struct pce_ted *ted);
+extern int pce_ted_update(struct pce_ted *ted, const struct pce_ted_link *l);
+
+extern int pce_ted_read_links(const char *path, struct pce_ted_link **links,
+	uint32_t *num_links);
+
+/*
+ * pce_ted_node - Get the node with the given router id, -1 if unknown
+ */
+static inline long pce_ted_node(const struct pce_ted *ted, uint32_t id)
+{
+	uint32_t lo = 0, hi = ted->num_nodes, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ted->node_id[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < ted->num_nodes && ted->node_id[lo] == id ? (long)lo : -1;
+}
+
+/*
+ * pce_ted_link_src - Get the node a link leaves
+ */
+static inline uint32_t pce_ted_link_src(const struct pce_ted *ted,
+	uint32_t e)
+{
+	uint32_t lo = 0, hi = ted->num_nodes, mid;
+
+	/* the last node whose first link is not after e */
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (ted->row[mid] <= e)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * pce_ted_gen - Get the topology generation, from any thread
+ */
+static inline unsigned long pce_ted_gen(const struct pce_ted *ted)
+{
+	return __atomic_load_n(&ted->gen, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * pce_ted_read_begin - Start reading the link attributes, from any thread,
+ * once the change in progress (if any) is done
+ */
+static inline unsigned long pce_ted_read_begin(const struct pce_ted *ted)
+{
+	unsigned long seq;
+
+	while ((seq = __atomic_load_n(&ted->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+/*
+ * pce_ted_read_retry - Tell whether links changed since the reading began:
+ * what was read may then be half of a change
+ */
+static inline int pce_ted_read_retry(const struct pce_ted *ted,
+	unsigned long seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&ted->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif /* PCE_TED_H */
@@ -0,0 +1,332 @@
+/*
+ * pce_timer.c - PCE hierarchical timer wheel
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "list.h"
+#include "pce_log.h"
+#include "pce_loop.h"
+#include "pce_timer.h"
+
+#define PCE_TIMER_MAX_TICKS \
+	((1UL << (PCE_TIMER_LEVELS * PCE_TIMER_LEVEL_BITS)) - 1)
+
+/* slot of the wheel level holding timers expiring at the given tick */
+#define pce_timer_index(expires, level) \
+	(((expires) >> ((level) * PCE_TIMER_LEVEL_BITS)) & PCE_TIMER_LEVEL_MASK)
+
+/*
+ * pce_timer_enqueue - Put a timer in the wheel level matching its expiry
+ */
+static void pce_timer_enqueue(struct pce_timers *tw, struct pce_timer *t)
+{
+	unsigned long delta;
+	int level;
+
+	/* already expired timers run at the next tick */
+	if ((long)(t->expires - tw->now) < 0)
+		t->expires = tw->now;
+
+	delta = t->expires - tw->now;
+	if (delta > PCE_TIMER_MAX_TICKS) {
+		delta = PCE_TIMER_MAX_TICKS;
+		t->expires = tw->now + delta;
+	}
+
+	for (level = 0; level < PCE_TIMER_LEVELS - 1; level++)
+		if (delta < (1UL << ((level + 1) * PCE_TIMER_LEVEL_BITS)))
+			break;
+
+	list_add_tail(&t->list,
+		&tw->wheel[level][pce_timer_index(t->expires, level)]);
+}
+
+/*
+ * pce_timer_cascade - Spread the timers of a higher level slot over the
+ * lower levels
+ */
+static int pce_timer_cascade(struct pce_timers *tw, int level, int index)
+{
+	struct pce_timer *t, *tmp;
+	struct list_head head;
+
+	INIT_LIST_HEAD(&head);
+	list_splice_init(&tw->wheel[level][index], &head);
+	list_for_each_entry_safe(t, tmp, &head, list)
+		pce_timer_enqueue(tw, t);
+
+	return index;
+}
+
+/*
+ * pce_timers_clock - Return the current tick
+ */
+static unsigned long pce_timers_clock(struct pce_timers *tw)
+{
+	struct timespec ts;
+	long long nsecs;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	nsecs = (ts.tv_sec - tw->base.tv_sec) * 1000000000LL +
+		(ts.tv_nsec - tw->base.tv_nsec);
+	return nsecs / (PCE_TIMER_TICK_MS * 1000000LL);
+}
+
+/*
+ * pce_timers_next - Return the first tick (from now on) with some work to
+ * do: timers to run or a non empty slot to cascade
+ */
+static unsigned long pce_timers_next(struct pce_timers *tw)
+{
+	unsigned long next = PCE_TIMER_NEVER, base, tick;
+	int level, i, shift;
+
+	for (i = 0; i < PCE_TIMER_LEVEL_SIZE; i++)
+		if (!list_empty(&tw->wheel[0][(tw->now + i) &
+			PCE_TIMER_LEVEL_MASK]))
+			return tw->now + i;
+
+	/* upper level slots are cascaded when the lower levels wrap */
+	for (level = 1; level < PCE_TIMER_LEVELS; level++) {
+		shift = level * PCE_TIMER_LEVEL_BITS;
+		base = tw->now >> shift;
+		i = (tw->now & ((1UL << shift) - 1)) ? 1 : 0;
+		for (; i <= PCE_TIMER_LEVEL_SIZE; i++) {
+			if (list_empty(&tw->wheel[level][(base + i) &
+				PCE_TIMER_LEVEL_MASK]))
+				continue;
+			tick = (base + i) << shift;
+			if (tick < next)
+				next = tick;
+			break;
+		}
+	}
+
+	return next;
+}
+
+/*
+ * pce_timers_arm - Arm the kernel timer for the given tick
+ */
+static void pce_timers_arm(struct pce_timers *tw, unsigned long tick)
+{
+	struct itimerspec tval;
+	unsigned long msecs;
+
+	if (tick == tw->armed)
+		return;
+
+	/* a zero value disarms the kernel timer */
+	memset(&tval, 0, sizeof(tval));
+	if (tick != PCE_TIMER_NEVER) {
+		msecs = tick * PCE_TIMER_TICK_MS;
+		tval.it_value.tv_sec = tw->base.tv_sec + msecs / 1000;
+		tval.it_value.tv_nsec = tw->base.tv_nsec +
+			(msecs % 1000) * 1000000L;
+		if (tval.it_value.tv_nsec >= 1000000000L) {
+			tval.it_value.tv_sec++;
+			tval.it_value.tv_nsec -= 1000000000L;
+		}
+	}
+	if (timerfd_settime(tw->tev.fd, TFD_TIMER_ABSTIME, &tval, NULL) != 0) {
+		pce_log(LOG_ERR, "failed to configure PCE timer\n");
+		return;
+	}
+	tw->armed = tick;
+}
+
+/*
+ * pce_timers_step - Run a single tick of the wheel
+ */
+static void pce_timers_step(struct pce_timers *tw)
+{
+	struct pce_timer *t;
+	struct list_head head;
+	int index, level;
+
+	INIT_LIST_HEAD(&head);
+
+	/* entering a new round of a level: cascade the upper one */
+	index = tw->now & PCE_TIMER_LEVEL_MASK;
+	for (level = 1; !index && level < PCE_TIMER_LEVELS; level++)
+		index = pce_timer_cascade(tw, level,
+			pce_timer_index(tw->now, level));
+
+	/*
+	 * timers (re)armed by the handlers below are queued from the next
+	 * tick on
+	 */
+	list_splice_init(&tw->wheel[0][tw->now & PCE_TIMER_LEVEL_MASK], &head);
+	tw->now++;
+
+	while (!list_empty(&head)) {
+		t = list_entry(head.next, struct pce_timer, list);
+		list_del_init(&t->list);
+		t->fn(t);
+	}
+}
+
+/*
+ * pce_timers_advance - Move the wheel forward up to the given tick, running
+ * the expired timers
+ *
+ * Ticks with nothing to do are skipped, so the cost doesn't depend on the
+ * time elapsed.
+ */
+static void pce_timers_advance(struct pce_timers *tw, unsigned long tick)
+{
+	unsigned long next;
+
+	while (tw->now <= tick) {
+		next = pce_timers_next(tw);
+		if (next > tick) {
+			tw->now = tick + 1;
+			break;
+		}
+		tw->now = next;
+		pce_timers_step(tw);
+	}
+}
+
+static void pce_timers_handler(struct pce_loop_event *ev, unsigned int events)
+{
+	struct pce_timers *tw = container_of(ev, struct pce_timers, tev);
+	ssize_t count;
+	uint64_t elaps;
+
+	/* acknowledge the expiry (if still pending) */
+	do {
+		count = read(tw->tev.fd, &elaps, sizeof(elaps));
+	} while (count == -1 && errno == EINTR);
+
+	/* the one-shot kernel timer is disarmed now */
+	tw->armed = PCE_TIMER_NEVER;
+
+	tw->running = 1;
+	pce_timers_advance(tw, pce_timers_clock(tw));
+	tw->running = 0;
+
+	pce_timers_arm(tw, pce_timers_next(tw));
+}
+
+/*
+ * pce_timers_create - Create the timer wheel of an event loop
+ */
+struct pce_timers *pce_timers_create(struct pce_loop *l)
+{
+	struct pce_timers *tw;
+	int i, j;
+
+	tw = calloc(1, sizeof(*tw));
+	if (!tw) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto out;
+	}
+	for (i = 0; i < PCE_TIMER_LEVELS; i++)
+		for (j = 0; j < PCE_TIMER_LEVEL_SIZE; j++)
+			INIT_LIST_HEAD(&tw->wheel[i][j]);
+
+	/* a single one-shot kernel timer drives the wheel */
+	tw->tev.fd = timerfd_create(CLOCK_MONOTONIC,
+		TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tw->tev.fd < 0) {
+		pce_log(LOG_ERR, "failed to create PCE timer\n");
+		goto out1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tw->base);
+	tw->armed = PCE_TIMER_NEVER;
+	tw->tev.handler = pce_timers_handler;
+	if (pce_loop_add(l, &tw->tev, PCE_LOOP_IN) < 0) {
+		pce_log(LOG_ERR, "failed to watch PCE timer\n");
+		goto out2;
+	}
+
+	return tw;
+
+out2:
+	close(tw->tev.fd);
+out1:
+	free(tw);
+out:
+	return NULL;
+}
+
+/*
+ * pce_timers_delete - Delete the timer wheel, pending timers are dropped
+ */
+void pce_timers_delete(struct pce_loop *l, struct pce_timers *tw)
+{
+	pce_loop_del(l, &tw->tev);
+	close(tw->tev.fd);
+	free(tw);
+}
+
+/*
+ * pce_timer_init - Initialize a timer
+ */
+void pce_timer_init(struct pce_timer *t, void (*fn)(struct pce_timer *t))
+{
+	INIT_LIST_HEAD(&t->list);
+	t->expires = 0;
+	t->fn = fn;
+}
+
+/*
+ * pce_timer_add - (Re)arm a timer to expire in msecs milliseconds
+ *
+ * The timer never runs early and runs at most one tick late (plus the
+ * time to get the loop back).
+ */
+void pce_timer_add(struct pce_loop *l, struct pce_timer *t,
+	unsigned int msecs)
+{
+	struct pce_timers *tw = pce_loop_timers(l);
+	unsigned long now;
+
+	if (pce_timer_pending(t))
+		list_del(&t->list);
+
+	now = pce_timers_clock(tw);
+
+	/* an empty wheel (nothing armed) can jump to the current tick */
+	if (!tw->running && tw->armed == PCE_TIMER_NEVER)
+		tw->now = now;
+
+	/* the current tick is partly elapsed already */
+	t->expires = now + 1 +
+		(msecs + PCE_TIMER_TICK_MS - 1) / PCE_TIMER_TICK_MS;
+	pce_timer_enqueue(tw, t);
+
+	/* the kernel timer is rearmed on the way out of the handler */
+	if (!tw->running && t->expires < tw->armed)
+		pce_timers_arm(tw, t->expires);
+}
+
+/*
+ * pce_timer_del - Cancel a timer (if pending)
+ */
+void pce_timer_del(struct pce_timer *t)
+{
+	if (pce_timer_pending(t))
+		list_del_init(&t->list);
+}
+
+/*
+ * pce_timer_now - Return the current time of the loop clock, in milliseconds
+ */
+unsigned long pce_timer_now(struct pce_loop *l)
+{
+	return pce_timers_clock(pce_loop_timers(l)) * PCE_TIMER_TICK_MS;
+}
@@ -0,0 +1,63 @@
+/*
+ * pce_timer.h - PCE timer wheel interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_TIMER_H
+#define PCE_TIMER_H
+
+#include <time.h>
+
+#include "list.h"
+#include "pce_loop.h"
+
+/*
+ * Every event loop drives all its timers from a hierarchical timer wheel
+ * and a single one-shot kernel timer, armed for the next tick with some
+ * work to do: the wheel has millisecond resolution but the loop doesn't
+ * wake up on idle ticks. Timers are kept in doubly linked lists, so arming
+ * and cancelling a timer is O(1).
+ */
+
+#define PCE_TIMER_TICK_MS     1	/* wheel resolution */
+#define PCE_TIMER_LEVEL_BITS  6
+#define PCE_TIMER_LEVEL_SIZE  (1 << PCE_TIMER_LEVEL_BITS)
+#define PCE_TIMER_LEVEL_MASK  (PCE_TIMER_LEVEL_SIZE - 1)
+#define PCE_TIMER_LEVELS      5
+
+struct pce_timer {
+	struct list_head list;
+	unsigned long expires;	/* in ticks */
+	void (*fn)(struct pce_timer *t);
+};
+
+#define PCE_TIMER_NEVER       (~0UL)
+
+struct pce_timers {
+	struct pce_loop_event tev;
+	struct timespec base;	/* clock at tick 0 */
+	unsigned long now;	/* first tick not run yet */
+	unsigned long armed;	/* tick the kernel timer is armed for */
+	int running;
+	struct list_head wheel[PCE_TIMER_LEVELS][PCE_TIMER_LEVEL_SIZE];
+};
+
+extern struct pce_timers *pce_timers_create(struct pce_loop *l);
+extern void pce_timers_delete(struct pce_loop *l, struct pce_timers *tw);
+
+extern void pce_timer_init(struct pce_timer *t,
+	void (*fn)(struct pce_timer *t));
+extern void pce_timer_add(struct pce_loop *l, struct pce_timer *t,
+	unsigned int msecs);
+extern void pce_timer_del(struct pce_timer *t);
+extern unsigned long pce_timer_now(struct pce_loop *l);
+
+static inline int pce_timer_pending(struct pce_timer *t)
+{
+	return !list_empty(&t->list);
+}
+
+#endif /* PCE_TIMER_H */
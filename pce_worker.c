@@ -0,0 +1,269 @@
+/*
+ * pce_worker.c - PCE path computation worker pool
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "list.h"
+#include "pce_log.h"
+#include "pce_loop.h"
+#include "pce_ring.h"
+#include "pce_cspf.h"
+#include "pce_worker.h"
+
+/*
+ * pce_worker_kick - Signal an eventfd
+ */
+static void pce_worker_kick(int efd)
+{
+	uint64_t one = 1;
+	ssize_t count;
+
+	do {
+		count = write(efd, &one, sizeof(one));
+	} while (count == -1 && errno == EINTR);
+}
+
+/*
+ * pce_worker_complete - Hand a job back to the port it came from
+ *
+ * The port never overflows: no more jobs than it can hold are in flight.
+ */
+static void pce_worker_complete(struct pce_job *job)
+{
+	struct pce_worker_port *port = job->port;
+
+	pce_ring_push(&port->done, job);
+	if (!__atomic_exchange_n(&port->notified, 1, __ATOMIC_SEQ_CST))
+		pce_worker_kick(port->ev.fd);
+}
+
+/*
+ * pce_worker_next - Take the most urgent job queued
+ */
+static struct pce_job *pce_worker_next(struct pce_worker *w)
+{
+	struct pce_job *job;
+	int prio;
+
+	for (prio = PCE_WORKER_PRIOS - 1; prio >= 0; prio--) {
+		job = pce_ring_pop(&w->jobs[prio]);
+		if (job)
+			return job;
+	}
+
+	return NULL;
+}
+
+static void *pce_worker_run(void *arg)
+{
+	struct pce_worker *w = arg;
+	struct pce_job *job;
+	uint64_t count;
+
+	while (1) {
+		job = pce_worker_next(w);
+		if (!job) {
+			/* announce the nap, then look again before taking it */
+			__atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			job = pce_worker_next(w);
+			if (!job && read(w->efd, &count, sizeof(count)) < 0 &&
+				errno != EINTR)
+				pce_log(LOG_ERR, "failure in read(): %s\n",
+					strerror(errno));
+			__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+			if (!job)
+				continue;
+		}
+		job->run(job, w->cspf);
+		pce_worker_complete(job);
+	}
+
+	return NULL;
+}
+
+/*
+ * pce_worker_pool_create - Start a pool of workers computing paths on the
+ * given topology, each one caching cache_size results
+ *
+ * Like the server threads, the workers are never joined: they block
+ * waiting for jobs and go away with the process.
+ */
+struct pce_worker_pool *pce_worker_pool_create(int num_workers,
+	const struct pce_ted *ted, uint32_t cache_size)
+{
+	struct pce_worker_pool *pool;
+	struct pce_worker *w;
+	int i, prio;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		goto err;
+	if (posix_memalign((void **)&pool->workers, PCE_RING_CACHELINE,
+		num_workers * sizeof(*pool->workers)))
+		goto err1;
+	memset(pool->workers, 0, num_workers * sizeof(*pool->workers));
+
+	for (i = 0; i < num_workers; i++) {
+		w = &pool->workers[i];
+		for (prio = 0; prio < PCE_WORKER_PRIOS; prio++)
+			if (pce_ring_init(&w->jobs[prio],
+				PCE_WORKER_QUEUE_SIZE))
+				goto err1;
+		w->cspf = pce_cspf_create(ted, cache_size);
+		if (!w->cspf)
+			goto err1;
+		w->efd = eventfd(0, EFD_CLOEXEC);
+		if (w->efd < 0) {
+			pce_log(LOG_ERR, "failure in eventfd(): %s\n",
+				strerror(errno));
+			goto err1;
+		}
+		if (pthread_create(&w->tid, NULL, pce_worker_run, w)) {
+			pce_log(LOG_ERR, "failed to create PCE worker "
+				"thread\n");
+			goto err1;
+		}
+		pool->num_workers++;
+	}
+
+	return pool;
+
+err1:
+	/* workers already started keep their resources */
+	if (!pool->num_workers) {
+		free(pool->workers);
+		free(pool);
+	}
+	return NULL;
+err:
+	pce_log(LOG_ERR, "failed to get memory\n");
+	return NULL;
+}
+
+/*
+ * pce_worker_port_handler - Run the completion of the jobs done
+ */
+static void pce_worker_port_handler(struct pce_loop_event *ev,
+	unsigned int events)
+{
+	struct pce_worker_port *port =
+		container_of(ev, struct pce_worker_port, ev);
+	struct pce_job *job;
+	uint64_t count;
+
+	if (read(port->ev.fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return;
+
+	/* the jobs completed from now on signal again */
+	__atomic_store_n(&port->notified, 0, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	while ((job = pce_ring_pop(&port->done))) {
+		port->inflight--;
+		job->done(job);
+	}
+}
+
+/*
+ * pce_worker_port_create - Connect an event loop to a worker pool
+ */
+struct pce_worker_port *pce_worker_port_create(struct pce_worker_pool *pool,
+	struct pce_loop *loop)
+{
+	struct pce_worker_port *port;
+
+	if (posix_memalign((void **)&port, PCE_RING_CACHELINE, sizeof(*port))) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto out;
+	}
+	memset(port, 0, sizeof(*port));
+	port->loop = loop;
+	port->pool = pool;
+	if (pce_ring_init(&port->done, PCE_WORKER_PORT_SIZE)) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		goto out1;
+	}
+
+	port->ev.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (port->ev.fd < 0) {
+		pce_log(LOG_ERR, "failure in eventfd(): %s\n", strerror(errno));
+		goto out2;
+	}
+	port->ev.handler = pce_worker_port_handler;
+	if (pce_loop_add(loop, &port->ev, PCE_LOOP_IN) < 0) {
+		pce_log(LOG_ERR, "failed to watch PCE worker port\n");
+		goto out3;
+	}
+
+	return port;
+
+out3:
+	close(port->ev.fd);
+out2:
+	pce_ring_release(&port->done);
+out1:
+	free(port);
+out:
+	return NULL;
+}
+
+/*
+ * pce_worker_port_delete - Disconnect an event loop from its worker pool,
+ * no job may be in flight
+ */
+void pce_worker_port_delete(struct pce_worker_port *port)
+{
+	pce_loop_del(port->loop, &port->ev);
+	close(port->ev.fd);
+	pce_ring_release(&port->done);
+	free(port);
+}
+
+/*
+ * pce_worker_submit - Queue a job to the next worker with room for it, by
+ * job priority
+ *
+ * Returns -1 if the port has too many jobs in flight or all the workers
+ * are busy.
+ */
+int pce_worker_submit(struct pce_worker_port *port, struct pce_job *job)
+{
+	struct pce_worker_pool *pool = port->pool;
+	struct pce_worker *w;
+	int i;
+
+	if (port->inflight == PCE_WORKER_PORT_SIZE)
+		return -1;
+
+	job->port = port;
+	if (job->prio < 0)
+		job->prio = 0;
+	else if (job->prio >= PCE_WORKER_PRIOS)
+		job->prio = PCE_WORKER_PRIOS - 1;
+	for (i = 0; i < pool->num_workers; i++) {
+		w = &pool->workers[port->next++ % pool->num_workers];
+		if (pce_ring_push(&w->jobs[job->prio], job))
+			continue;
+
+		port->inflight++;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST))
+			pce_worker_kick(w->efd);
+		return 0;
+	}
+
+	return -1;
+}
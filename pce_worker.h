@@ -0,0 +1,82 @@
+/*
+ * pce_worker.h - PCE path computation worker pool interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCE_WORKER_H
+#define PCE_WORKER_H
+
+#include <pthread.h>
+
+#include "pce_loop.h"
+#include "pce_ring.h"
+#include "pce_cspf.h"
+
+/*
+ * Path computations run on a pool of worker threads, so that an expensive
+ * request never delays the keepalives of the sessions sharing an event
+ * loop. Every worker owns a CSPF engine and a lock-free job queue the
+ * event loops push to. Every event loop owns a port: a lock-free queue the
+ * workers push the completed jobs to, and an eventfd waking the loop up
+ * to hand them back to their submitters.
+ *
+ * Both sides only signal their eventfd when the other one may be asleep,
+ * so a busy pool or loop doesn't pay a system call per job.
+ *
+ * A worker has a queue per job priority and always runs the most urgent
+ * job first, so urgent jobs never wait behind bulk ones, only behind the
+ * jobs already running.
+ */
+
+#define PCE_WORKER_QUEUE_SIZE 1024	/* jobs queued per worker priority */
+#define PCE_WORKER_PORT_SIZE  1024	/* jobs in flight per loop */
+#define PCE_WORKER_PRIOS      8		/* job priorities, 0 lowest */
+
+struct pce_worker_port;
+
+struct pce_job {
+	/* run by a worker */
+	void (*run)(struct pce_job *job, struct pce_cspf *cspf);
+	/* run by the event loop the job was submitted from */
+	void (*done)(struct pce_job *job);
+	struct pce_worker_port *port;
+	int prio;
+};
+
+struct pce_worker {
+	struct pce_ring jobs[PCE_WORKER_PRIOS];
+	struct pce_cspf *cspf;
+	pthread_t tid;
+	int efd;
+	int sleeping;
+} __attribute__ ((aligned(PCE_RING_CACHELINE)));
+
+struct pce_worker_pool {
+	int num_workers;
+	struct pce_worker *workers;
+};
+
+struct pce_worker_port {
+	struct pce_loop *loop;
+	struct pce_loop_event ev;
+	struct pce_ring done;
+	struct pce_worker_pool *pool;
+	int notified;
+	unsigned int inflight;	/* owning loop only */
+	unsigned int next;	/* next worker to try */
+};
+
+extern struct pce_worker_pool *pce_worker_pool_create(int num_workers,
+	const struct pce_ted *ted, uint32_t cache_size);
+
+extern struct pce_worker_port *pce_worker_port_create(
+	struct pce_worker_pool *pool, struct pce_loop *loop);
+extern void pce_worker_port_delete(struct pce_worker_port *port);
+
+extern int pce_worker_submit(struct pce_worker_port *port,
+	struct pce_job *job);
+
+#endif /* PCE_WORKER_H */
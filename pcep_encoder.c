@@ -0,0 +1,269 @@
+/*
+ * pcep_encoder.c - PCEP message encoder implementation
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+
+#include "pcep_encoder.h"
+
+/* largest length the 16 bits length fields can carry */
+#define PCEP_ENCODER_LEN_MAX 0xffff
+
+/*
+ * pcep_encoder_init - Start encoding into the given buffer
+ */
+void pcep_encoder_init(struct pcep_encoder *e, void *buf, size_t size)
+{
+	e->buf = buf;
+	e->size = size;
+	pcep_encoder_reset(e);
+}
+
+/*
+ * pcep_encoder_reset - Drop anything encoded so far
+ */
+void pcep_encoder_reset(struct pcep_encoder *e)
+{
+	e->pos = 0;
+	e->seg = 0;
+	e->iovcnt = 0;
+	e->msg = NULL;
+	e->msg_len = 0;
+	e->obj = NULL;
+	e->obj_len = 0;
+	e->err = 0;
+}
+
+/*
+ * pcep_encoder_mark - Remember the current position in the current message
+ *
+ * Must be called between two objects.
+ */
+void pcep_encoder_mark(struct pcep_encoder *e, struct pcep_encoder_mark *m)
+{
+	m->pos = e->pos;
+	m->seg = e->seg;
+	m->iovcnt = e->iovcnt;
+	m->msg_len = e->msg_len;
+}
+
+/*
+ * pcep_encoder_rewind - Drop anything encoded since a mark in the current
+ * message, failures included (e.g. objects that didn't fit)
+ */
+void pcep_encoder_rewind(struct pcep_encoder *e,
+	const struct pcep_encoder_mark *m)
+{
+	e->pos = m->pos;
+	e->seg = m->seg;
+	e->iovcnt = m->iovcnt;
+	e->msg_len = m->msg_len;
+	e->obj = NULL;
+	e->obj_len = 0;
+	e->err = 0;
+}
+
+/*
+ * pcep_encoder_fail - Make the encoder fail from now on
+ */
+static int pcep_encoder_fail(struct pcep_encoder *e)
+{
+	e->err = -1;
+	return -1;
+}
+
+/*
+ * pcep_encoder_account - Add len bytes to the current message and object
+ */
+static int pcep_encoder_account(struct pcep_encoder *e, size_t len)
+{
+	if (!e->msg || e->msg_len + len > PCEP_ENCODER_LEN_MAX)
+		return pcep_encoder_fail(e);
+
+	e->msg_len += len;
+	if (e->obj)
+		e->obj_len += len;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_flush - Close the current inline segment (if not empty)
+ */
+static int pcep_encoder_flush(struct pcep_encoder *e)
+{
+	if (e->pos == e->seg)
+		return 0;
+	if (e->iovcnt == PCEP_ENCODER_IOVS)
+		return pcep_encoder_fail(e);
+
+	e->iov[e->iovcnt].iov_base = e->buf + e->seg;
+	e->iov[e->iovcnt].iov_len = e->pos - e->seg;
+	e->iovcnt++;
+	e->seg = e->pos;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_put - Reserve room for len bytes, to be filled by the caller
+ */
+void *pcep_encoder_put(struct pcep_encoder *e, size_t len)
+{
+	void *p;
+
+	if (e->err || e->size - e->pos < len)
+		goto err;
+	if (pcep_encoder_account(e, len))
+		goto err;
+
+	p = e->buf + e->pos;
+	e->pos += len;
+
+	return p;
+
+err:
+	pcep_encoder_fail(e);
+	return NULL;
+}
+
+/*
+ * pcep_encoder_append - Copy len bytes into the message
+ */
+int pcep_encoder_append(struct pcep_encoder *e, const void *data,
+	size_t len)
+{
+	void *p;
+
+	p = pcep_encoder_put(e, len);
+	if (!p)
+		return -1;
+	memcpy(p, data, len);
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_ref - Add len bytes to the message without copying them
+ *
+ * The data must stay untouched until the message has been written.
+ */
+int pcep_encoder_ref(struct pcep_encoder *e, const void *data, size_t len)
+{
+	if (e->err || pcep_encoder_flush(e))
+		return -1;
+	if (e->iovcnt == PCEP_ENCODER_IOVS || pcep_encoder_account(e, len))
+		return pcep_encoder_fail(e);
+
+	e->iov[e->iovcnt].iov_base = (void *)data;
+	e->iov[e->iovcnt].iov_len = len;
+	e->iovcnt++;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_msg_begin - Start a new message of the given type
+ */
+int pcep_encoder_msg_begin(struct pcep_encoder *e, int type)
+{
+	struct pcep_msg_hdr *msg;
+
+	if (e->err || e->msg || e->size - e->pos < PCEP_MSG_HDR_SIZE)
+		return pcep_encoder_fail(e);
+
+	msg = (struct pcep_msg_hdr *)(e->buf + e->pos);
+	msg->ver = PCEP_MSG_VERSION;
+	msg->flags = 0;
+	msg->type = type;
+	msg->len = 0;
+	e->pos += PCEP_MSG_HDR_SIZE;
+	e->msg = msg;
+	e->msg_len = PCEP_MSG_HDR_SIZE;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_msg_end - Backpatch the length of the current message
+ */
+int pcep_encoder_msg_end(struct pcep_encoder *e)
+{
+	if (e->err || !e->msg || e->obj)
+		return pcep_encoder_fail(e);
+
+	e->msg->len = htons(e->msg_len);
+	e->msg = NULL;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_obj_begin - Start a new object in the current message
+ */
+int pcep_encoder_obj_begin(struct pcep_encoder *e, int o_class,
+	int o_type, int p_flag, int i_flag)
+{
+	struct pcep_obj_hdr *obj;
+
+	if (e->err || e->obj)
+		return pcep_encoder_fail(e);
+
+	obj = pcep_encoder_put(e, PCEP_OBJ_HDR_SIZE);
+	if (!obj)
+		return -1;
+	obj->o_class = o_class;
+	obj->o_type = o_type;
+	obj->res = 0;
+	obj->p_flag = !!p_flag;
+	obj->i_flag = !!i_flag;
+	obj->len = 0;
+	e->obj = obj;
+	e->obj_len = PCEP_OBJ_HDR_SIZE;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_obj_end - Pad the current object to 32 bits and backpatch
+ * its length
+ */
+int pcep_encoder_obj_end(struct pcep_encoder *e)
+{
+	size_t pad;
+	void *p;
+
+	if (e->err || !e->obj)
+		return pcep_encoder_fail(e);
+
+	pad = -e->obj_len & 3;
+	if (pad) {
+		p = pcep_encoder_put(e, pad);
+		if (!p)
+			return -1;
+		memset(p, 0, pad);
+	}
+
+	e->obj->len = htons(e->obj_len);
+	e->obj = NULL;
+
+	return 0;
+}
+
+/*
+ * pcep_encoder_iov - Get the segments of the messages encoded so far
+ */
+int pcep_encoder_iov(struct pcep_encoder *e, struct iovec **iov)
+{
+	if (e->err || e->msg || pcep_encoder_flush(e))
+		return -1;
+
+	*iov = e->iov;
+
+	return e->iovcnt;
+}
@@ -0,0 +1,82 @@
+/*
+ * pcep_encoder.h - PCEP message encoder interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCEP_ENCODER_H
+#define PCEP_ENCODER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "pcep_msg.h"
+#include "pcep_obj.h"
+
+/*
+ * Messages are built in place into a buffer provided by the caller (or
+ * taken from a pool): headers are written first and their lengths are
+ * backpatched when the message or the object is ended. Large bodies (e.g.
+ * EROs) may be referenced instead of copied, the result is then a list of
+ * segments ready for writev().
+ *
+ * Errors are sticky: once a call fails, the following ones do nothing and
+ * pcep_encoder_msg_end()/pcep_encoder_iov() report the failure.
+ */
+
+#define PCEP_ENCODER_IOVS 16
+
+/* a position in the current message, between two objects */
+struct pcep_encoder_mark {
+	size_t pos;
+	size_t seg;
+	int iovcnt;
+	size_t msg_len;
+};
+
+struct pcep_encoder {
+	/* inline buffer */
+	char *buf;
+	size_t size;
+	size_t pos;
+	size_t seg;		/* start of the current inline segment */
+
+	/* output segments */
+	struct iovec iov[PCEP_ENCODER_IOVS];
+	int iovcnt;
+
+	/* message and object being built */
+	struct pcep_msg_hdr *msg;
+	size_t msg_len;
+	struct pcep_obj_hdr *obj;
+	size_t obj_len;
+
+	int err;
+};
+
+extern void pcep_encoder_init(struct pcep_encoder *e, void *buf,
+	size_t size);
+extern void pcep_encoder_reset(struct pcep_encoder *e);
+
+extern int pcep_encoder_msg_begin(struct pcep_encoder *e, int type);
+extern int pcep_encoder_msg_end(struct pcep_encoder *e);
+extern int pcep_encoder_obj_begin(struct pcep_encoder *e, int o_class,
+	int o_type, int p_flag, int i_flag);
+extern int pcep_encoder_obj_end(struct pcep_encoder *e);
+
+extern void pcep_encoder_mark(struct pcep_encoder *e,
+	struct pcep_encoder_mark *m);
+extern void pcep_encoder_rewind(struct pcep_encoder *e,
+	const struct pcep_encoder_mark *m);
+
+extern void *pcep_encoder_put(struct pcep_encoder *e, size_t len);
+extern int pcep_encoder_append(struct pcep_encoder *e, const void *data,
+	size_t len);
+extern int pcep_encoder_ref(struct pcep_encoder *e, const void *data,
+	size_t len);
+
+extern int pcep_encoder_iov(struct pcep_encoder *e, struct iovec **iov);
+
+#endif /* PCEP_ENCODER_H */
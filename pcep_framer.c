@@ -22,8 +22,16 @@ struct pcep_framer *pcep_framer_create(void)
 	struct pcep_framer *f;
 
 	f = calloc(1, sizeof(struct pcep_framer));
+	if (!f)
+		return NULL;
+
+	/* message buffers are recycled through a private pool */
+	f->pool = pcep_pool_create();
+	if (!f->pool) {
+		free(f);
+		return NULL;
+	}
 	f->state = PCEP_HUNT_MSG_VER_FLAGS;
-	INIT_LIST_HEAD(&f->msg_list.list);
 
 	return f;
 }
@@ -33,20 +41,18 @@ struct pcep_framer *pcep_framer_create(void)
  */
 void pcep_framer_delete(struct pcep_framer *f)
 {
-	struct pcep_msg_list *msg_entry;
-
 	/* release any message in the message queue */
-	while (!list_empty(&f->msg_list.list)) {
-		msg_entry = list_entry(f->msg_list.list.next,
-			struct pcep_msg_list, list);
-		free(msg_entry->msg);
-		list_del(&msg_entry->list);
-		free(msg_entry);
-	}
+	while (f->queue_head != f->queue_tail)
+		pcep_pool_free(f->queue[f->queue_head++ %
+			PCEP_FRAMER_QUEUE_SIZE]);
 
 	/* release the buffer for the message recording */
-	if (f->msg_curr)
-		free(f->msg_curr);
+	pcep_pool_free(f->msg_curr);
+	pcep_pool_delete(f->pool);
+
+	/* release the receive ring */
+	free(f->ring);
+	free(f->ring_wrap);
 
 	/* release the framer */
 	free(f);
@@ -59,109 +65,156 @@ void pcep_framer_reset(struct pcep_framer *f)
 {
 	f->state = PCEP_HUNT_MSG_VER_FLAGS;
 	if (f->msg_curr) {
-		free(f->msg_curr);
+		pcep_pool_free(f->msg_curr);
 		f->msg_curr = NULL;
 	}
 }
 
-#define PCEP_MSG_VER_MASK 0xE0
-#define PCEP_MSG_VER_SHIFT 5
-#define PCEP_MSG_FLAGS_MASK 0x1F
-#define PCEP_MSG_FLAGS_SHIFT 0
+/*
+ * pcep_framer_start - Start recording the message announced by hdr_curr
+ */
+static int pcep_framer_start(struct pcep_framer *f)
+{
+	f->msg_len = ntohs(f->hdr_curr.len);
+	if (f->msg_len < PCEP_MSG_HDR_SIZE)
+		return -1;
+
+	/* allocate a buffer to store the message */
+	f->msg_curr = pcep_pool_alloc(f->pool, f->msg_len);
+	if (!f->msg_curr)
+		return -1;
+	memcpy(f->msg_curr, &f->hdr_curr, PCEP_MSG_HDR_SIZE);
+	f->msg_pos = PCEP_MSG_HDR_SIZE;
+	f->state = PCEP_HUNT_MSG;
+
+	return 0;
+}
 
 /*
- * pcep_framer_write - Feed the FSM of the PCEP framer with a message chunk
+ * pcep_framer_complete - Add the recorded message to the message queue
+ *
+ * A message is only started when the queue has room for it.
  */
-void pcep_framer_write(struct pcep_framer *f, char *buf, size_t size)
+static void pcep_framer_complete(struct pcep_framer *f)
 {
-	int i;
-
-	for (i = 0; i < size; i++) {
-		switch (f->state) {
-		case PCEP_HUNT_MSG_VER_FLAGS:
-			f->hdr_curr.ver = (buf[i] & PCEP_MSG_VER_MASK)
-				>> PCEP_MSG_VER_SHIFT;
-			f->hdr_curr.flags = (buf[i] & PCEP_MSG_FLAGS_MASK)
-				 >> PCEP_MSG_FLAGS_SHIFT;
-			if (f->hdr_curr.ver == PCEP_MSG_VERSION) {
-				f->state = PCEP_HUNT_MSG_TYPE;
-			} else {
-				pcep_framer_reset(f);
-			}
+	f->queue[f->queue_tail++ % PCEP_FRAMER_QUEUE_SIZE] = f->msg_curr;
+	f->msg_curr = NULL;
+	f->state = PCEP_HUNT_MSG_VER_FLAGS;
+}
+
+/*
+ * pcep_framer_write_byte - Feed the FSM of the PCEP framer with one byte
+ *
+ * This is the slow path, only used while a header is split across chunks.
+ */
+static void pcep_framer_write_byte(struct pcep_framer *f, char c)
+{
+	switch (f->state) {
+	case PCEP_HUNT_MSG_VER_FLAGS:
+		((char *)&f->hdr_curr)[0] = c;
+		if (f->hdr_curr.ver == PCEP_MSG_VERSION)
+			f->state = PCEP_HUNT_MSG_TYPE;
+		else
+			pcep_framer_reset(f);
+		break;
+
+	case PCEP_HUNT_MSG_TYPE:
+		f->hdr_curr.type = c;
+		/* unknown types are framed too, the session answers them */
+		if (f->hdr_curr.type > PCEP_MSG_TYPE_MIN) {
+			f->msg_len_cnt = 0;
+			f->state = PCEP_HUNT_MSG_LEN;
+		} else {
+			pcep_framer_reset(f);
+		}
+		break;
+
+	case PCEP_HUNT_MSG_LEN:
+		/* the MSB of the length field is received first */
+		((char *)&f->hdr_curr.len)[f->msg_len_cnt++] = c;
+		if (f->msg_len_cnt < sizeof(f->hdr_curr.len))
 			break;
+		if (pcep_framer_start(f)) {
+			pcep_framer_reset(f);
+			break;
+		}
+		/* the message has no body (e.g. keepalive) */
+		if (f->msg_pos == f->msg_len)
+			pcep_framer_complete(f);
+		break;
 
-		case PCEP_HUNT_MSG_TYPE:
-			f->hdr_curr.type = buf[i];
-			if (f->hdr_curr.type > PCEP_MSG_TYPE_MIN &&
-				f->hdr_curr.type < PCEP_MSG_TYPE_MAX) {
-				f->msg_len = 0;
-				f->msg_len_cnt = 0;
-				f->state = PCEP_HUNT_MSG_LEN;
-			} else {
-				pcep_framer_reset(f);
-			}
+	case PCEP_HUNT_MSG:
+		((char *)(f->msg_curr))[f->msg_pos++] = c;
+		if (f->msg_pos == f->msg_len)
+			pcep_framer_complete(f);
+		break;
+
+	default:
+		/* should never happen! */
+		pcep_framer_reset(f);
+	}
+}
+
+/*
+ * pcep_framer_write - Feed the FSM of the PCEP framer with a message chunk
+ *
+ * Whole headers are decoded in one step and message bodies are copied in
+ * bulk, the byte FSM only runs on headers split across chunk boundaries.
+ *
+ * Framing stops before a new message when the message queue is full, the
+ * number of bytes consumed is returned and the rest of the chunk has to be
+ * written again once some messages have been read.
+ */
+size_t pcep_framer_write(struct pcep_framer *f, char *buf, size_t size)
+{
+	size_t i = 0, n;
+
+	while (i < size) {
+
+		/* backpressure: the reader fell behind */
+		if (f->state == PCEP_HUNT_MSG_VER_FLAGS &&
+			f->queue_tail - f->queue_head == PCEP_FRAMER_QUEUE_SIZE)
 			break;
 
-		case PCEP_HUNT_MSG_LEN:
-			/* the MSB of the length field is received first */
-			memcpy((char *)(&f->hdr_curr.len) + f->msg_len_cnt,
-				&buf[i], 1);
-			f->msg_len_cnt++;
-			if (f->msg_len_cnt == sizeof(f->hdr_curr.len)) {
-				/* allocate a buffer to store the message */
-				f->msg_len = ntohs(f->hdr_curr.len);
-				if (f->msg_len >= PCEP_MSG_HDR_SIZE) {
-					if (!f->msg_curr) {
-						f->msg_curr = malloc(f->msg_len);
-						if (!f->msg_curr) {
-							pcep_framer_reset(f);
-							continue;
-						}
-						memcpy(f->msg_curr, &f->hdr_curr,
-							PCEP_MSG_HDR_SIZE);
-						f->msg_pos = PCEP_MSG_HDR_SIZE;
-					}
-					f->state = PCEP_HUNT_MSG;
-				} else {
-					pcep_framer_reset(f);
-				}
+		/* fast path: a whole common header is available */
+		if (f->state == PCEP_HUNT_MSG_VER_FLAGS &&
+			size - i >= PCEP_MSG_HDR_SIZE) {
+			memcpy(&f->hdr_curr, &buf[i], PCEP_MSG_HDR_SIZE);
+
+			/* resync exactly as the byte FSM would do */
+			if (f->hdr_curr.ver != PCEP_MSG_VERSION) {
+				i += 1;
+				continue;
 			}
-			/*
-			 * if the message has no body (e.g. keepalive),
-			 * continue to process the message in PCEP_HUNT_MSG
-			 */
-			if (f->msg_len != PCEP_MSG_HDR_SIZE)
-				break;
-
-		case PCEP_HUNT_MSG:
-			/* message body recording */
-			if (f->msg_pos < f->msg_len) {
-				((char *)(f->msg_curr))[f->msg_pos] = buf[i];
-				f->msg_pos++;
+			if (f->hdr_curr.type <= PCEP_MSG_TYPE_MIN) {
+				i += 2;
+				continue;
 			}
-
-			/* add the recorded message to the message queue */
-			if (f->msg_pos == f->msg_len) {
-				struct pcep_msg_list *msg_entry;
-
-				msg_entry = malloc(sizeof(*msg_entry));
-				if (!msg_entry) {
-					pcep_framer_reset(f);
-					continue;
-				}
-				msg_entry->msg = f->msg_curr;
-				list_add_tail(&msg_entry->list,
-					&f->msg_list.list);
-				f->msg_curr = NULL;
-				f->state = PCEP_HUNT_MSG_VER_FLAGS;
+			i += PCEP_MSG_HDR_SIZE;
+			if (pcep_framer_start(f)) {
+				pcep_framer_reset(f);
+				continue;
 			}
-			break;
+		}
 
-		default:
-			/* should never happen! */
-			pcep_framer_reset(f);
+		/* fast path: copy as much of the message body as available */
+		if (f->state == PCEP_HUNT_MSG) {
+			n = f->msg_len - f->msg_pos;
+			if (n > size - i)
+				n = size - i;
+			memcpy((char *)f->msg_curr + f->msg_pos, &buf[i], n);
+			f->msg_pos += n;
+			i += n;
+			if (f->msg_pos == f->msg_len)
+				pcep_framer_complete(f);
+			continue;
 		}
+
+		/* slow path: header split across chunks */
+		pcep_framer_write_byte(f, buf[i++]);
 	}
+
+	return i;
 }
 
 /*
@@ -169,26 +222,172 @@ void pcep_framer_write(struct pcep_framer *f, char *buf, size_t size)
  */
 extern struct pcep_msg_hdr *pcep_framer_read(struct pcep_framer *f)
 {
-	struct pcep_msg_hdr *m = NULL;
-	struct pcep_msg_list *msg_entry;
-
 	/* remove a message from the message queue */
-	if (!list_empty(&f->msg_list.list)) {
-		msg_entry = list_entry(f->msg_list.list.next,
-			struct pcep_msg_list, list);
-		m = msg_entry->msg;
-		list_del(&msg_entry->list);
-		free(msg_entry);
-	}
+	if (f->queue_head == f->queue_tail)
+		return NULL;
 
-	return m;
+	return f->queue[f->queue_head++ % PCEP_FRAMER_QUEUE_SIZE];
 }
 
 /*
  * pcep_msg_free - Release a PCEP message
+ *
+ * The message goes back to the pool of the framer it was read from, so it
+ * must be released before the framer is deleted.
  */
 extern void pcep_msg_free(struct pcep_msg_hdr *m)
 {
-	if (!m)
-		free(m);
+	pcep_pool_free(m);
+}
+
+/*
+ * pcep_framer_ring_alloc - Switch the framer to the zero-copy mode
+ *
+ * Incoming data is stored straight into a receive ring of the given size
+ * (a power of 2, at least PCEP_FRAMER_RING_SIZE) and messages are framed in
+ * place.
+ */
+int pcep_framer_ring_alloc(struct pcep_framer *f, size_t size)
+{
+	if (size < PCEP_FRAMER_RING_SIZE || (size & (size - 1)))
+		return -1;
+
+	f->ring = malloc(size);
+	if (!f->ring)
+		return -1;
+	f->ring_size = size;
+	f->ring_head = f->ring_parse = f->ring_tail = 0;
+	f->ring_views = 0;
+
+	return 0;
+}
+
+/*
+ * pcep_framer_ring_space - Get the free space of the receive ring
+ *
+ * The free space is returned as up to two segments, to be filled in order
+ * (e.g. by readv()) and then committed with pcep_framer_ring_commit().
+ */
+int pcep_framer_ring_space(struct pcep_framer *f, struct iovec *iov)
+{
+	size_t mask = f->ring_size - 1;
+	size_t room = f->ring_size - (f->ring_tail - f->ring_head);
+	size_t tail = f->ring_tail & mask;
+
+	if (!room)
+		return 0;
+
+	iov[0].iov_base = f->ring + tail;
+	if (tail + room <= f->ring_size) {
+		iov[0].iov_len = room;
+		return 1;
+	}
+	iov[0].iov_len = f->ring_size - tail;
+	iov[1].iov_base = f->ring;
+	iov[1].iov_len = room - iov[0].iov_len;
+
+	return 2;
+}
+
+/*
+ * pcep_framer_ring_commit - Account data stored into the receive ring
+ */
+void pcep_framer_ring_commit(struct pcep_framer *f, size_t count)
+{
+	f->ring_tail += count;
+}
+
+/*
+ * pcep_framer_ring_skip - Discard bytes that can't start a message
+ */
+static void pcep_framer_ring_skip(struct pcep_framer *f, size_t count)
+{
+	f->ring_parse += count;
+	if (!f->ring_views)
+		f->ring_head = f->ring_parse;
+}
+
+/*
+ * pcep_framer_ring_read - Frame the next complete message (if any) in place
+ *
+ * Only messages wrapping the ring end are copied, so that every view is
+ * contiguous.
+ *
+ * Returns 1 with the view of a message, 0 if there is no complete message
+ * yet or -1 if there is no memory to copy it.
+ */
+int pcep_framer_ring_read(struct pcep_framer *f, struct pcep_msg_view *v)
+{
+	size_t mask = f->ring_size - 1;
+	size_t pos, len;
+	struct pcep_msg_hdr hdr;
+	char *h = (char *)&hdr;
+
+	while (f->ring_tail - f->ring_parse >= PCEP_MSG_HDR_SIZE) {
+
+		/* decode the common header (it may wrap as well) */
+		pos = f->ring_parse & mask;
+		if (pos + PCEP_MSG_HDR_SIZE <= f->ring_size) {
+			memcpy(&hdr, f->ring + pos, PCEP_MSG_HDR_SIZE);
+		} else {
+			h[0] = f->ring[pos];
+			h[1] = f->ring[(pos + 1) & mask];
+			h[2] = f->ring[(pos + 2) & mask];
+			h[3] = f->ring[(pos + 3) & mask];
+		}
+
+		/* resync exactly as the copy mode does */
+		if (hdr.ver != PCEP_MSG_VERSION) {
+			pcep_framer_ring_skip(f, 1);
+			continue;
+		}
+		if (hdr.type <= PCEP_MSG_TYPE_MIN) {
+			pcep_framer_ring_skip(f, 2);
+			continue;
+		}
+		len = ntohs(hdr.len);
+		if (len < PCEP_MSG_HDR_SIZE) {
+			pcep_framer_ring_skip(f, PCEP_MSG_HDR_SIZE);
+			continue;
+		}
+
+		/* wait for the whole message */
+		if (f->ring_tail - f->ring_parse < len)
+			return 0;
+
+		if (pos + len <= f->ring_size) {
+			v->msg = (struct pcep_msg_hdr *)(f->ring + pos);
+		} else {
+			/* only one view at a time may use the wrap buffer */
+			if (!f->ring_wrap) {
+				f->ring_wrap = malloc(PCEP_FRAMER_RING_SIZE);
+				if (!f->ring_wrap)
+					return -1;
+			}
+			if (f->ring_views)
+				return 0;
+			memcpy(f->ring_wrap, f->ring + pos, f->ring_size - pos);
+			memcpy(f->ring_wrap + f->ring_size - pos, f->ring,
+				len - (f->ring_size - pos));
+			v->msg = (struct pcep_msg_hdr *)f->ring_wrap;
+		}
+		v->len = len;
+		f->ring_parse += len;
+		v->end = f->ring_parse;
+		f->ring_views++;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * pcep_framer_ring_release - Give the space of a message view back
+ */
+void pcep_framer_ring_release(struct pcep_framer *f, struct pcep_msg_view *v)
+{
+	f->ring_head = v->end;
+	if (!--f->ring_views)
+		f->ring_head = f->ring_parse;
 }
@@ -9,13 +9,10 @@
 #ifndef PCEP_FRAMER_H
 #define PCEP_FRAMER_H
 
-#include "list.h"
-#include "pcep_msg.h"
+#include <sys/uio.h>
 
-struct pcep_msg_list {
-	struct list_head list;
-	struct pcep_msg_hdr *msg;
-};
+#include "pcep_msg.h"
+#include "pcep_pool.h"
 
 enum pcep_hunt_state {
 	PCEP_HUNT_MSG_VER_FLAGS = 0,
@@ -24,6 +21,22 @@ enum pcep_hunt_state {
 	PCEP_HUNT_MSG
 };
 
+/*
+ * A framed message seen in place (zero-copy mode). The view is valid until
+ * it is released, views must be released in the same order they are read.
+ */
+struct pcep_msg_view {
+	struct pcep_msg_hdr *msg;
+	size_t len;
+	size_t end;
+};
+
+/* framed messages waiting to be read (a power of 2) */
+#define PCEP_FRAMER_QUEUE_SIZE 16
+
+/* receive ring size, it always fits the largest PCEP message */
+#define PCEP_FRAMER_RING_SIZE (64 * 1024)
+
 struct pcep_framer {
 	/* current FSM state */
 	enum pcep_hunt_state state;
@@ -35,16 +48,38 @@ struct pcep_framer {
 	unsigned short msg_len;
 	unsigned short msg_len_cnt;
 
-	/* received message list */
-	struct pcep_msg_list msg_list;
+	/* received message queue, positions are free running */
+	struct pcep_msg_hdr *queue[PCEP_FRAMER_QUEUE_SIZE];
+	unsigned int queue_head;
+	unsigned int queue_tail;
+
+	/* message buffers (copy mode) */
+	struct pcep_pool *pool;
+
+	/* receive ring (zero-copy mode), positions are free running */
+	char *ring;
+	size_t ring_size;
+	size_t ring_head;	/* first byte still in use */
+	size_t ring_parse;	/* first byte not framed yet */
+	size_t ring_tail;	/* first free byte */
+	unsigned int ring_views;
+	char *ring_wrap;	/* messages wrapping the ring end */
 };
 
 extern struct pcep_framer *pcep_framer_create(void);
 extern void pcep_framer_delete(struct pcep_framer *f);
 extern void pcep_framer_reset(struct pcep_framer *f);
 
-extern void pcep_framer_write(struct pcep_framer *f, char *buf, size_t size);
+extern size_t pcep_framer_write(struct pcep_framer *f, char *buf, size_t size);
 extern struct pcep_msg_hdr *pcep_framer_read(struct pcep_framer *f);
 extern void pcep_msg_free(struct pcep_msg_hdr *m);
 
+extern int pcep_framer_ring_alloc(struct pcep_framer *f, size_t size);
+extern int pcep_framer_ring_space(struct pcep_framer *f, struct iovec *iov);
+extern void pcep_framer_ring_commit(struct pcep_framer *f, size_t count);
+extern int pcep_framer_ring_read(struct pcep_framer *f,
+	struct pcep_msg_view *v);
+extern void pcep_framer_ring_release(struct pcep_framer *f,
+	struct pcep_msg_view *v);
+
 #endif /* PCEP_FRAMER_H */
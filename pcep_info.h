@@ -149,7 +149,7 @@ struct pcep_session_info {
 	unsigned int num_keep_alive_sent;
 	unsigned int num_keep_alive_rcvd;
 	unsigned int num_unknown_rcvd;
-}
+};
 
 #define PCEP_STATE_IDLE        (0)
 #define PCEP_STATE_TCP_PENDING (1)
@@ -11,6 +11,7 @@
 #include <sys/un.h>
 
 #include "pcep_msg.h"
+#include "pcep_obj.h"
 
 static const char *pcep_msg_type_name[] = {
 	"UNKNOWN     ",
@@ -24,9 +25,51 @@ static const char *pcep_msg_type_name[] = {
 	"UNKNOWN     ",
 };
 
+#define PCEP_MSG_TYPE_NAMES \
+	(sizeof(pcep_msg_type_name) / sizeof(pcep_msg_type_name[0]))
+
 #define itos(x) \
-	(pcep_msg_type_name[(int)(x) < sizeof(pcep_msg_type_name) ? \
-	(int)(x) : (sizeof(pcep_msg_type_name) - 1)])
+	(pcep_msg_type_name[(unsigned int)(x) < PCEP_MSG_TYPE_NAMES ? \
+	(unsigned int)(x) : PCEP_MSG_TYPE_NAMES - 1])
+
+/* version 1, no flags */
+#define PCEP_MSG_VER_FLAGS (PCEP_MSG_VERSION << 5)
+
+#define PCEP_MSG_CLOSE(reason) { \
+	PCEP_MSG_VER_FLAGS, PCEP_MSG_TYPE_CLOSE, 0x00, PCEP_MSG_STATIC_SIZE, \
+	PCEP_OBJ_CLASS_CLOSE, 0x10, 0x00, 0x08, \
+	0x00, 0x00, 0x00, (reason) }
+
+#define PCEP_MSG_ERROR(type, value) { \
+	PCEP_MSG_VER_FLAGS, PCEP_MSG_TYPE_ERROR, 0x00, PCEP_MSG_STATIC_SIZE, \
+	PCEP_OBJ_CLASS_PCEP_ERROR, 0x10, 0x00, 0x08, \
+	0x00, 0x00, (type), (value) }
+
+const unsigned char pcep_msg_keepalive[PCEP_MSG_HDR_SIZE] = {
+	PCEP_MSG_VER_FLAGS, PCEP_MSG_TYPE_KEEPALIVE, 0x00, PCEP_MSG_HDR_SIZE,
+};
+
+const unsigned char
+	pcep_msg_close[PCEP_CLOSE_REASON_MAX][PCEP_MSG_STATIC_SIZE] = {
+	[PCEP_CLOSE_REASON_NONE] = PCEP_MSG_CLOSE(1),
+	[PCEP_CLOSE_REASON_DEAD_TIMER] = PCEP_MSG_CLOSE(2),
+	[PCEP_CLOSE_REASON_MALFORMED] = PCEP_MSG_CLOSE(3),
+	[PCEP_CLOSE_REASON_UNKNOWN_REQS] = PCEP_MSG_CLOSE(4),
+	[PCEP_CLOSE_REASON_UNKNOWN_MSGS] = PCEP_MSG_CLOSE(5),
+};
+
+const unsigned char pcep_msg_error[PCEP_ERR_MAX][PCEP_MSG_STATIC_SIZE] = {
+	[PCEP_ERR_OPEN_INVALID] = PCEP_MSG_ERROR(1, 1),
+	[PCEP_ERR_OPEN_WAIT] = PCEP_MSG_ERROR(1, 2),
+	[PCEP_ERR_OPEN_UNACCEPTABLE] = PCEP_MSG_ERROR(1, 3),
+	[PCEP_ERR_OPEN_SECOND] = PCEP_MSG_ERROR(1, 5),
+	[PCEP_ERR_KEEP_WAIT] = PCEP_MSG_ERROR(1, 7),
+	[PCEP_ERR_CAPABILITY] = PCEP_MSG_ERROR(2, 0),
+	[PCEP_ERR_UNKNOWN_CLASS] = PCEP_MSG_ERROR(3, 1),
+	[PCEP_ERR_UNKNOWN_TYPE] = PCEP_MSG_ERROR(3, 2),
+	[PCEP_ERR_RP_MISSING] = PCEP_MSG_ERROR(6, 1),
+	[PCEP_ERR_END_POINTS_MISSING] = PCEP_MSG_ERROR(6, 3),
+};
 
 int pcep_msg_hdr_dump(struct pcep_msg_hdr *msg, char *buf, int count)
 {
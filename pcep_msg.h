@@ -9,6 +9,8 @@
 #ifndef PCEP_MSG_H
 #define PCEP_MSG_H
 
+#include <endian.h>
+
 /*
  *  PCEP Message Common Header
  *
@@ -54,15 +56,67 @@
 #define PCEP_MSG_TYPE_CLOSE           7
 #define PCEP_MSG_TYPE_MAX             8
 
+/* the header layout matches the wire format, whatever the host endianness */
 struct pcep_msg_hdr {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	unsigned char flags : 5;
+	unsigned char ver : 3;
+#else
 	unsigned char ver : 3;
 	unsigned char flags : 5;
+#endif
 	unsigned char type;
 	unsigned short len;
 } __attribute__ ((packed));
 
 #define PCEP_MSG_HDR_SIZE (sizeof(struct pcep_msg_hdr))
 
+/* Close reasons (RFC 5440) */
+#define PCEP_CLOSE_REASON_NONE          1
+#define PCEP_CLOSE_REASON_DEAD_TIMER    2
+#define PCEP_CLOSE_REASON_MALFORMED     3
+#define PCEP_CLOSE_REASON_UNKNOWN_REQS  4
+#define PCEP_CLOSE_REASON_UNKNOWN_MSGS  5
+#define PCEP_CLOSE_REASON_MAX           6
+
+/* common PCErr (Error-Type, Error-value) pairs (RFC 5440) */
+#define PCEP_ERR_OPEN_INVALID           0	/* 1, 1 */
+#define PCEP_ERR_OPEN_WAIT              1	/* 1, 2 */
+#define PCEP_ERR_OPEN_UNACCEPTABLE      2	/* 1, 3 */
+#define PCEP_ERR_OPEN_SECOND            3	/* 1, 5 */
+#define PCEP_ERR_KEEP_WAIT              4	/* 1, 7 */
+#define PCEP_ERR_CAPABILITY             5	/* 2, 0 */
+#define PCEP_ERR_UNKNOWN_CLASS          6	/* 3, 1 */
+#define PCEP_ERR_UNKNOWN_TYPE           7	/* 3, 2 */
+#define PCEP_ERR_RP_MISSING             8	/* 6, 1 */
+#define PCEP_ERR_END_POINTS_MISSING     9	/* 6, 3 */
+#define PCEP_ERR_MAX                   10
+
+/* the PCErr proposing other session attributes, with an OPEN object */
+#define PCEP_ERR_TYPE_OPEN              1
+#define PCEP_ERR_OPEN_NEGOTIABLE        4
+
+/* Notification-type and Notification-value (RFC 5440) */
+#define PCEP_NTF_TYPE_CANCEL            1	/* pending request cancelled */
+#define PCEP_NTF_CANCEL_BY_PCE          2
+#define PCEP_NTF_TYPE_OVERLOAD          2	/* PCE congestion */
+#define PCEP_NTF_OVERLOADED             1
+#define PCEP_NTF_OVERLOAD_CLEARED       2
+
+/* NOTIFICATION object TLVs (RFC 5440) */
+#define PCEP_NTF_TLV_OVERLOADED_DURATION 2	/* in seconds */
+
+/*
+ * Pre-encoded messages, shared by all the sessions: a Close or a PCErr
+ * message carries a single 8 bytes object.
+ */
+#define PCEP_MSG_STATIC_SIZE 12
+
+extern const unsigned char pcep_msg_keepalive[PCEP_MSG_HDR_SIZE];
+extern const unsigned char
+	pcep_msg_close[PCEP_CLOSE_REASON_MAX][PCEP_MSG_STATIC_SIZE];
+extern const unsigned char pcep_msg_error[PCEP_ERR_MAX][PCEP_MSG_STATIC_SIZE];
+
 extern int pcep_msg_hdr_dump(struct pcep_msg_hdr *msg, char *buf, int count);
 
 #endif /* PCEP_MSG_H */
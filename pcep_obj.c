@@ -45,3 +45,21 @@ int pcep_obj_hdr_dump(struct pcep_obj_hdr *obj, char *buf, int count)
 		(int)(ntohs(obj->len)));
 }
 
+/*
+ * pcep_obj_iter_error - Record why the object list of a message is malformed
+ *
+ * Kept out of line, it is the slow path of pcep_obj_iter_next().
+ */
+int pcep_obj_iter_error(struct pcep_obj_iter *it, size_t len)
+{
+	size_t left = it->end - it->pos;
+
+	if (left < PCEP_OBJ_HDR_SIZE || len > left)
+		it->err = PCEP_OBJ_ERR_TRUNCATED;
+	else if (len < PCEP_OBJ_HDR_SIZE)
+		it->err = PCEP_OBJ_ERR_LENGTH;
+	else
+		it->err = PCEP_OBJ_ERR_ALIGN;
+
+	return it->err;
+}
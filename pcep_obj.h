@@ -9,6 +9,12 @@
 #ifndef PCEP_OBJ_H
 #define PCEP_OBJ_H
 
+#include <endian.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "pcep_msg.h"
+
 /*
  *  PCEP Common Object Header
  *
@@ -76,17 +82,101 @@
 #define PCEP_OBJ_CLASS_LOAD_BALANCING 14
 #define PCEP_OBJ_CLASS_CLOSE          15
 
+/* the header layout matches the wire format, whatever the host endianness */
 struct pcep_obj_hdr {
 	unsigned char o_class;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	unsigned char i_flag : 1;
+	unsigned char p_flag : 1;
+	unsigned char res : 2;
+	unsigned char o_type : 4;
+#else
 	unsigned char o_type : 4;
 	unsigned char res : 2;
 	unsigned char p_flag : 1;
 	unsigned char i_flag : 1;
+#endif
 	unsigned short len;
 } __attribute__ ((packed));
 
 #define PCEP_OBJ_HDR_SIZE (sizeof(struct pcep_obj_hdr))
 
+/* malformed object lists */
+#define PCEP_OBJ_ERR_TRUNCATED  -1	/* object past the end of the message */
+#define PCEP_OBJ_ERR_LENGTH     -2	/* object shorter than its header */
+#define PCEP_OBJ_ERR_ALIGN      -3	/* object length not a multiple of 4 */
+
+/*
+ * An object seen in place inside its message, nothing is copied. The body
+ * is valid as long as the message is.
+ */
+struct pcep_obj {
+	struct pcep_obj_hdr *hdr;
+	unsigned char o_class;
+	unsigned char o_type;
+	unsigned char p_flag;
+	unsigned char i_flag;
+	void *body;
+	size_t body_len;
+};
+
+/* iterator over the objects of a message */
+struct pcep_obj_iter {
+	char *pos;
+	char *end;
+	int err;
+};
+
 extern int pcep_obj_hdr_dump(struct pcep_obj_hdr *obj, char *str, int count);
+extern int pcep_obj_iter_error(struct pcep_obj_iter *it, size_t len);
+
+/*
+ * pcep_obj_iter_init - Start walking the objects of a (framed) message
+ */
+static inline void pcep_obj_iter_init(struct pcep_obj_iter *it,
+	struct pcep_msg_hdr *msg)
+{
+	it->pos = (char *)msg + PCEP_MSG_HDR_SIZE;
+	it->end = (char *)msg + ntohs(msg->len);
+	it->err = 0;
+}
+
+/*
+ * pcep_obj_iter_next - Get the next object of the message
+ *
+ * Returns 1 and fills obj, 0 at the end of the message or a negative
+ * PCEP_OBJ_ERR_* code if the object list is malformed (and on any later
+ * call).
+ */
+static inline int pcep_obj_iter_next(struct pcep_obj_iter *it,
+	struct pcep_obj *obj)
+{
+	size_t left = it->end - it->pos;
+	struct pcep_obj_hdr *hdr;
+	size_t len;
+
+	if (!left || it->err)
+		return it->err;
+	if (left < PCEP_OBJ_HDR_SIZE)
+		return pcep_obj_iter_error(it, left);
+
+	hdr = (struct pcep_obj_hdr *)it->pos;
+	len = ntohs(hdr->len);
+
+	/* a single test on the hot path, the cause is sorted out later */
+	if ((len < PCEP_OBJ_HDR_SIZE) | (len & 3) | (len > left))
+		return pcep_obj_iter_error(it, len);
+
+	obj->hdr = hdr;
+	obj->o_class = hdr->o_class;
+	obj->o_type = hdr->o_type;
+	obj->p_flag = hdr->p_flag;
+	obj->i_flag = hdr->i_flag;
+	obj->body = it->pos + PCEP_OBJ_HDR_SIZE;
+	obj->body_len = len - PCEP_OBJ_HDR_SIZE;
+	it->pos += len;
+
+	return 1;
+}
 
 #endif /* PCEP_OBJ_H */
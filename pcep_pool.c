@@ -0,0 +1,192 @@
+/*
+ * pcep_pool.c - PCEP buffer pool implementation
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcep_pool.h"
+
+/* header in front of every buffer */
+struct pcep_pool_obj {
+	struct pcep_pool_class *cls;	/* NULL: plain malloc() buffer */
+	struct pcep_pool_obj *next;	/* free list link */
+};
+
+/* header in front of every slab, it keeps the buffers aligned */
+struct pcep_pool_slab {
+	struct pcep_pool_slab *next;
+	void *pad;
+};
+
+/*
+ * Size classes, following the PCEP length distribution: keepalives and
+ * opens, requests and small replies, large replies.
+ */
+static const struct {
+	size_t size;
+	int slab;
+	unsigned int max_free;
+} pcep_pool_sizes[PCEP_POOL_CLASSES] = {
+	{ 32,        1, 0 },
+	{ 128,       1, 0 },
+	{ 512,       1, 0 },
+	{ 2048,      1, 0 },
+	{ 8192,      0, 4 },
+	{ 64 * 1024, 0, 1 },
+};
+
+#define pcep_pool_obj_data(o) ((void *)((o) + 1))
+#define pcep_pool_data_obj(d) ((struct pcep_pool_obj *)(d) - 1)
+
+/*
+ * pcep_pool_create - Create a new buffer pool
+ */
+struct pcep_pool *pcep_pool_create(void)
+{
+	struct pcep_pool *p;
+	struct pcep_pool_class *c;
+	int i;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	for (i = 0; i < PCEP_POOL_CLASSES; i++) {
+		c = &p->classes[i];
+		c->size = pcep_pool_sizes[i].size;
+		c->max_free = pcep_pool_sizes[i].max_free;
+		c->slab_objs = 1;
+		if (pcep_pool_sizes[i].slab)
+			c->slab_objs = (PCEP_POOL_SLAB_SIZE -
+				sizeof(struct pcep_pool_slab)) /
+				(sizeof(struct pcep_pool_obj) + c->size);
+	}
+
+	return p;
+}
+
+/*
+ * pcep_pool_delete - Delete the pool, all its buffers must be released
+ */
+void pcep_pool_delete(struct pcep_pool *p)
+{
+	struct pcep_pool_class *c;
+	struct pcep_pool_slab *s;
+	struct pcep_pool_obj *o;
+	int i;
+
+	/* buffers not coming from slabs are on their own */
+	for (i = 0; i < PCEP_POOL_CLASSES; i++) {
+		c = &p->classes[i];
+		if (c->slab_objs > 1)
+			continue;
+		while ((o = c->free)) {
+			c->free = o->next;
+			free(o);
+		}
+	}
+
+	while ((s = p->slabs)) {
+		p->slabs = s->next;
+		free(s);
+	}
+
+	free(p);
+}
+
+/*
+ * pcep_pool_grow - Refill the free list of a size class
+ */
+static int pcep_pool_grow(struct pcep_pool *p, struct pcep_pool_class *c)
+{
+	size_t osize = sizeof(struct pcep_pool_obj) + c->size;
+	struct pcep_pool_slab *s;
+	struct pcep_pool_obj *o;
+	unsigned int i;
+
+	if (c->slab_objs == 1) {
+		o = malloc(osize);
+		if (!o)
+			return -1;
+		o->cls = c;
+		o->next = c->free;
+		c->free = o;
+		c->num_free++;
+		return 0;
+	}
+
+	s = malloc(sizeof(*s) + c->slab_objs * osize);
+	if (!s)
+		return -1;
+	s->next = p->slabs;
+	p->slabs = s;
+
+	for (i = 0; i < c->slab_objs; i++) {
+		o = (struct pcep_pool_obj *)((char *)(s + 1) + i * osize);
+		o->cls = c;
+		o->next = c->free;
+		c->free = o;
+	}
+	c->num_free += c->slab_objs;
+
+	return 0;
+}
+
+/*
+ * pcep_pool_alloc - Get a buffer of (at least) the given size
+ */
+void *pcep_pool_alloc(struct pcep_pool *p, size_t size)
+{
+	struct pcep_pool_class *c;
+	struct pcep_pool_obj *o;
+	int i;
+
+	for (i = 0; i < PCEP_POOL_CLASSES; i++)
+		if (size <= p->classes[i].size)
+			break;
+
+	/* too large for any class */
+	if (i == PCEP_POOL_CLASSES) {
+		o = malloc(sizeof(*o) + size);
+		if (!o)
+			return NULL;
+		o->cls = NULL;
+		return pcep_pool_obj_data(o);
+	}
+
+	c = &p->classes[i];
+	if (!c->free && pcep_pool_grow(p, c))
+		return NULL;
+	o = c->free;
+	c->free = o->next;
+	c->num_free--;
+
+	return pcep_pool_obj_data(o);
+}
+
+/*
+ * pcep_pool_free - Give a buffer back to its pool
+ */
+void pcep_pool_free(void *ptr)
+{
+	struct pcep_pool_obj *o;
+	struct pcep_pool_class *c;
+
+	if (!ptr)
+		return;
+
+	o = pcep_pool_data_obj(ptr);
+	c = o->cls;
+	if (!c || (c->max_free && c->num_free >= c->max_free)) {
+		free(o);
+		return;
+	}
+	o->next = c->free;
+	c->free = o;
+	c->num_free++;
+}
@@ -0,0 +1,47 @@
+/*
+ * pcep_pool.h - PCEP buffer pool interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCEP_POOL_H
+#define PCEP_POOL_H
+
+#include <stddef.h>
+
+/*
+ * A size-classed pool of buffers owned by a single session, so it needs no
+ * locking. Small classes (keepalives, opens, requests) are carved from
+ * slabs and recycled forever, large classes (replies) are allocated one by
+ * one and only a few free ones are cached. Every buffer records its class,
+ * so it can be released without knowing the pool it comes from.
+ */
+
+#define PCEP_POOL_SLAB_SIZE  (16 * 1024)
+#define PCEP_POOL_CLASSES    6
+
+struct pcep_pool_obj;
+struct pcep_pool_slab;
+
+struct pcep_pool_class {
+	size_t size;		/* usable size of the buffers */
+	unsigned int slab_objs;	/* buffers per slab (1: no slab) */
+	unsigned int max_free;	/* free buffers cached (0: no limit) */
+	unsigned int num_free;
+	struct pcep_pool_obj *free;
+};
+
+struct pcep_pool {
+	struct pcep_pool_class classes[PCEP_POOL_CLASSES];
+	struct pcep_pool_slab *slabs;
+};
+
+extern struct pcep_pool *pcep_pool_create(void);
+extern void pcep_pool_delete(struct pcep_pool *p);
+
+extern void *pcep_pool_alloc(struct pcep_pool *p, size_t size);
+extern void pcep_pool_free(void *ptr);
+
+#endif /* PCEP_POOL_H */
@@ -0,0 +1,502 @@
+/*
+ * pcep_req.c - PCEP path computation requests and replies
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "pcep_msg.h"
+#include "pcep_obj.h"
+#include "pcep_encoder.h"
+#include "pcep_req.h"
+#include "pce_cspf.h"
+#include "pce_disjoint.h"
+
+/* ERO IPv4 prefix subobject */
+#define PCEP_ERO_IPV4         1
+#define PCEP_ERO_IPV4_LEN     8
+
+/*
+ * pcep_req_u32 - Get a 32 bits field of an object body
+ */
+static inline uint32_t pcep_req_u32(const void *body, size_t off)
+{
+	uint32_t v;
+
+	memcpy(&v, (const char *)body + off, sizeof(v));
+	return ntohl(v);
+}
+
+/*
+ * pcep_req_float - Get a 32 bits IEEE floating point field
+ */
+static inline float pcep_req_float(const void *body, size_t off)
+{
+	uint32_t v = pcep_req_u32(body, off);
+	float f;
+
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+/*
+ * pcep_req_clock - Current time of the clock of the request deadlines, in
+ * milliseconds, the same for all the threads
+ */
+unsigned long pcep_req_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * pcep_req_svecs - Bind the requests to the (first) SVEC listing them
+ *
+ * If the message is decoded in chunks, the requests of a diverse SVEC
+ * listing requests out of the chunk are marked split: they can't be
+ * computed jointly with the others.
+ */
+static void pcep_req_svecs(struct pcep_req *reqs, int n,
+	const struct pcep_obj *svecs, int num_svecs, int chunked)
+{
+	uint32_t flags, id;
+	size_t off;
+	int i, j, listed, found;
+
+	for (i = 0; i < num_svecs; i++) {
+		flags = pcep_req_u32(svecs[i].body, 0) & 0xffffff;
+		listed = found = 0;
+		for (off = 4; off + 4 <= svecs[i].body_len; off += 4) {
+			id = pcep_req_u32(svecs[i].body, off);
+			listed++;
+			for (j = 0; j < n; j++) {
+				if (reqs[j].req_id != id)
+					continue;
+				found++;
+				if (reqs[j].svec >= 0)
+					continue;
+				reqs[j].svec = i;
+				reqs[j].svec_flags = flags;
+			}
+		}
+		if (!chunked || found >= listed ||
+			!(flags & PCEP_SVEC_DIVERSE))
+			continue;
+		for (j = 0; j < n; j++)
+			if (reqs[j].svec == i)
+				reqs[j].svec_split = 1;
+	}
+}
+
+/*
+ * pcep_req_decode - Decode the requests of a PCReq message, at most max at
+ * a time
+ *
+ * The decoding starts at offset off of the message, 0 for the first
+ * requests, and off is set to where the next requests start, 0 once the
+ * message is done. The SVEC objects of the message apply to every chunk.
+ *
+ * Returns the number of requests or -1 with err set to the PCErr to send
+ * back (or -1 for a malformed message to drop).
+ */
+int pcep_req_decode(struct pcep_msg_hdr *msg, size_t *off,
+	struct pcep_req *reqs, int max, int *err)
+{
+	struct pcep_obj_iter it;
+	struct pcep_obj obj = { 0 };
+	struct pcep_obj svecs[PCEP_SVEC_MAX];
+	struct pcep_req *req = NULL;
+	int n = 0, num_svecs = 0, end_points = 0, rro = 0, ret;
+	int chunked = *off != 0;
+
+	pcep_obj_iter_init(&it, msg);
+
+	/* the SVEC objects were checked with the first chunk */
+	if (*off) {
+		while (pcep_obj_iter_next(&it, &obj) == 1 &&
+			obj.o_class == PCEP_OBJ_CLASS_SVEC)
+			if (num_svecs < PCEP_SVEC_MAX)
+				svecs[num_svecs++] = obj;
+		it.pos = (char *)msg + *off;
+		*off = 0;
+	}
+
+	while ((ret = pcep_obj_iter_next(&it, &obj)) == 1) {
+
+		/* a new request starts with its RP object */
+		if (obj.o_class == PCEP_OBJ_CLASS_RP) {
+			if (req && !end_points)
+				goto no_end_points;
+			if (obj.body_len < 8)
+				goto malformed;
+			if (n == max) {
+				*off = (char *)obj.hdr - (char *)msg;
+				req = NULL;
+				break;
+			}
+			req = &reqs[n++];
+			memset(req, 0, sizeof(*req));
+			req->rp_flags = pcep_req_u32(obj.body, 0);
+			req->req_id = pcep_req_u32(obj.body, 4);
+			req->prio = req->rp_flags & PCEP_RP_FLAG_PRI_MASK;
+			req->svec = -1;
+			req->cspf.metric = PCE_CSPF_METRIC_TE;
+			end_points = rro = 0;
+			continue;
+		}
+
+		/* SVEC objects come before the first request */
+		if (!req) {
+			if (obj.o_class != PCEP_OBJ_CLASS_SVEC) {
+				*err = PCEP_ERR_RP_MISSING;
+				return -1;
+			}
+			if (obj.body_len < 4)
+				goto malformed;
+			if (num_svecs < PCEP_SVEC_MAX)
+				svecs[num_svecs++] = obj;
+			continue;
+		}
+
+		switch (obj.o_class) {
+		case PCEP_OBJ_CLASS_END_POINTS:
+			/* IPv4 end points only */
+			if (obj.o_type != 1 || obj.body_len < 8)
+				goto malformed;
+			req->cspf.src = pcep_req_u32(obj.body, 0);
+			req->cspf.dst = pcep_req_u32(obj.body, 4);
+			end_points = 1;
+			break;
+		case PCEP_OBJ_CLASS_LSPA:
+			if (obj.body_len < 16)
+				goto malformed;
+			req->cspf.exclude_any = pcep_req_u32(obj.body, 0);
+			req->cspf.include_any = pcep_req_u32(obj.body, 4);
+			req->cspf.include_all = pcep_req_u32(obj.body, 8);
+			break;
+		case PCEP_OBJ_CLASS_BANDWIDTH:
+			/* the one after an RRO is the current reservation */
+			if (obj.body_len < 4)
+				goto malformed;
+			if (!rro)
+				req->cspf.bw = pcep_req_float(obj.body, 0);
+			break;
+		case PCEP_OBJ_CLASS_METRIC:
+			/* Reserved (16 bits), Flags, Type, then the value */
+			if (obj.body_len < 8)
+				goto malformed;
+			if (((unsigned char *)obj.body)[2] &
+				PCEP_METRIC_FLAG_B)
+				break;
+			req->cspf.metric = ((unsigned char *)obj.body)[3];
+			req->metric_c = !!(((unsigned char *)obj.body)[2] &
+				PCEP_METRIC_FLAG_C);
+			break;
+		case PCEP_OBJ_CLASS_RRO:
+			rro = 1;
+			break;
+		case PCEP_OBJ_CLASS_LOAD_BALANCING:
+			/* Reserved (16 bits), Flags, Max-LSP, Min-Bandwidth */
+			if (obj.body_len < 8)
+				goto malformed;
+			req->max_lsp = ((unsigned char *)obj.body)[3];
+			req->min_bw = pcep_req_float(obj.body, 4);
+			break;
+		default:
+			break;
+		}
+	}
+	if (ret < 0)
+		goto malformed;
+	if (!req && !n) {
+		*err = PCEP_ERR_RP_MISSING;
+		return -1;
+	}
+	if (req && !end_points)
+		goto no_end_points;
+
+	pcep_req_svecs(reqs, n, svecs, num_svecs, chunked || *off);
+
+	return n;
+
+no_end_points:
+	*err = PCEP_ERR_END_POINTS_MISSING;
+	return -1;
+malformed:
+	*err = -1;
+	return -1;
+}
+
+/*
+ * pcep_req_schedule - Set the deadline of the requests of a message (0:
+ * none) and sort them by priority, the most urgent first
+ *
+ * The requests of a message share their deadline, so the order of
+ * arrival breaks the ties.
+ */
+void pcep_req_schedule(struct pcep_req *reqs, int num_reqs,
+	unsigned long deadline)
+{
+	struct pcep_req tmp;
+	int i, j;
+
+	for (i = 0; i < num_reqs; i++)
+		reqs[i].deadline = deadline;
+
+	/* insertion sort, stable and cheap on the few requests of a message */
+	for (i = 1; i < num_reqs; i++) {
+		if (reqs[i].prio <= reqs[i - 1].prio)
+			continue;
+		tmp = reqs[i];
+		for (j = i; j > 0 && reqs[j - 1].prio < tmp.prio; j--)
+			reqs[j] = reqs[j - 1];
+		reqs[j] = tmp;
+	}
+}
+
+/*
+ * pcep_req_path - Encode a path of the response to a request
+ */
+static void pcep_req_path(struct pcep_encoder *e, const struct pcep_req *req,
+	const struct pce_cspf_path *path)
+{
+	unsigned char *p;
+	uint32_t v, i;
+	float f;
+
+	/* ERO, a strict IPv4 /32 subobject per hop */
+	pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_ERO, 1, 0, 0);
+	p = pcep_encoder_put(e, path->num_hops * PCEP_ERO_IPV4_LEN);
+	for (i = 0; p && i < path->num_hops; i++) {
+		p[0] = PCEP_ERO_IPV4;
+		p[1] = PCEP_ERO_IPV4_LEN;
+		v = htonl(path->hops[i]);
+		memcpy(p + 2, &v, 4);
+		p[6] = 32;
+		p[7] = 0;
+		p += PCEP_ERO_IPV4_LEN;
+	}
+	pcep_encoder_obj_end(e);
+
+	/* BANDWIDTH, the share of a load balanced request */
+	if (req->max_lsp > 1) {
+		pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_BANDWIDTH, 1, 0, 0);
+		p = pcep_encoder_put(e, 4);
+		if (p) {
+			memcpy(&v, &path->bw, 4);
+			v = htonl(v);
+			memcpy(p, &v, 4);
+		}
+		pcep_encoder_obj_end(e);
+	}
+
+	/* METRIC, if the computed cost was asked for */
+	if (req->metric_c) {
+		pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_METRIC, 1, 0, 0);
+		p = pcep_encoder_put(e, 8);
+		if (p) {
+			p[0] = p[1] = p[2] = 0;
+			p[3] = req->cspf.metric;
+			f = path->cost;
+			memcpy(&v, &f, 4);
+			v = htonl(v);
+			memcpy(p + 4, &v, 4);
+		}
+		pcep_encoder_obj_end(e);
+	}
+}
+
+/*
+ * pcep_req_reply - Encode the response to a request in the current PCRep
+ * message, a NO-PATH if no path was found
+ */
+int pcep_req_reply(struct pcep_encoder *e, const struct pcep_req *req,
+	const struct pce_cspf_path *paths, int num_paths)
+{
+	unsigned char *p;
+	uint32_t v;
+	int i;
+
+	/* RP */
+	pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_RP, 1, 1, 0);
+	p = pcep_encoder_put(e, 8);
+	if (p) {
+		v = htonl(req->rp_flags);
+		memcpy(p, &v, 4);
+		v = htonl(req->req_id);
+		memcpy(p + 4, &v, 4);
+	}
+	pcep_encoder_obj_end(e);
+
+	/* NO-PATH */
+	if (!num_paths) {
+		pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_NO_PATH, 1, 0, 0);
+		p = pcep_encoder_put(e, 4);
+		if (p) {
+			p[0] = PCEP_NO_PATH_NOT_FOUND;
+			p[1] = p[2] = p[3] = 0;
+		}
+		return pcep_encoder_obj_end(e);
+	}
+
+	for (i = 0; i < num_paths; i++)
+		pcep_req_path(e, req, &paths[i]);
+
+	return e->err;
+}
+
+/*
+ * pcep_req_cancel - Encode the cancellation of a request in the current
+ * PCNtf message
+ */
+int pcep_req_cancel(struct pcep_encoder *e, const struct pcep_req *req)
+{
+	unsigned char *p;
+	uint32_t v;
+
+	/* RP */
+	pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_RP, 1, 1, 0);
+	p = pcep_encoder_put(e, 8);
+	if (p) {
+		v = htonl(req->rp_flags);
+		memcpy(p, &v, 4);
+		v = htonl(req->req_id);
+		memcpy(p + 4, &v, 4);
+	}
+	pcep_encoder_obj_end(e);
+
+	/* NOTIFICATION, Reserved, Flags, Notification-type and value */
+	pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_NOTIFICATION, 1, 0, 0);
+	p = pcep_encoder_put(e, 4);
+	if (p) {
+		p[0] = p[1] = 0;
+		p[2] = PCEP_NTF_TYPE_CANCEL;
+		p[3] = PCEP_NTF_CANCEL_BY_PCE;
+	}
+	return pcep_encoder_obj_end(e);
+}
+
+/*
+ * pcep_req_expired - Check whether a request is past its deadline
+ */
+static inline int pcep_req_expired(const struct pcep_req *req)
+{
+	return req->deadline && (long)(pcep_req_clock() - req->deadline) >= 0;
+}
+
+/*
+ * pcep_req_group - Collect the requests to compute diverse paths for with
+ * reqs[first]: the ones of its SVEC with the same end points
+ *
+ * Returns the number of requests, 1 if reqs[first] is on its own.
+ */
+static int pcep_req_group(const struct pcep_req *reqs, int num_reqs,
+	int first, const unsigned char *handled, int *group)
+{
+	const struct pcep_req *r = &reqs[first];
+	int i, n = 0;
+
+	group[n++] = first;
+	if (r->svec < 0 || !(r->svec_flags & PCEP_SVEC_DIVERSE) ||
+		r->max_lsp > 1)
+		return n;
+
+	for (i = first + 1; i < num_reqs && n < PCE_DISJOINT_MAX; i++)
+		if (!handled[i] && reqs[i].svec == r->svec &&
+			reqs[i].max_lsp <= 1 &&
+			reqs[i].cspf.src == r->cspf.src &&
+			reqs[i].cspf.dst == r->cspf.dst)
+			group[n++] = i;
+
+	return n;
+}
+
+/*
+ * pcep_req_compute - Compute the paths of the requests of a message
+ *
+ * The requests make a single batch for the engine: they share its scratch
+ * memory and are all computed on the same topology generation. The
+ * requests of an SVEC asking for diverse paths get link or node disjoint
+ * paths, computed jointly, if they share their end points. The load
+ * balancing requests get up to Max-LSP paths carrying the bandwidth
+ * together. The others are computed one by one. SRLGs are not known, SRLG
+ * diversity is approximated by node diversity. The requests past their
+ * deadline are not computed at all, nor are the diverse ones whose SVEC
+ * was split across chunks (they get a NO-PATH). done is called with every
+ * result, the paths are valid until the next computation of the engine.
+ *
+ * Returns -1 if done stopped the computation.
+ */
+int pcep_req_compute(struct pce_cspf *cspf, const struct pcep_req *reqs,
+	int num_reqs, pcep_req_done_t done, void *arg)
+{
+	struct pce_cspf_req creqs[PCE_DISJOINT_MAX];
+	struct pce_cspf_path paths[PCEP_REQ_PATHS_MAX];
+	unsigned char handled[PCEP_REQ_MAX] = { 0 };
+	int group[PCE_DISJOINT_MAX];
+	int i, j, n, found, mode, err = -1;
+
+	pce_cspf_batch_begin(cspf);
+	for (i = 0; i < num_reqs; i++) {
+		if (handled[i])
+			continue;
+
+		if (pcep_req_expired(&reqs[i])) {
+			handled[i] = 1;
+			if (done(arg, &reqs[i], NULL, -1, -1))
+				goto out;
+			continue;
+		}
+
+		if (reqs[i].svec_split) {
+			handled[i] = 1;
+			if (done(arg, &reqs[i], paths, 0, -1))
+				goto out;
+			continue;
+		}
+
+		if (reqs[i].max_lsp > 1) {
+			handled[i] = 1;
+			found = pce_ksp_compute(cspf, &reqs[i].cspf,
+				reqs[i].max_lsp, reqs[i].min_bw, paths);
+			if (done(arg, &reqs[i], paths, found, -1))
+				goto out;
+			continue;
+		}
+
+		n = pcep_req_group(reqs, num_reqs, i, handled, group);
+		if (n == 1) {
+			handled[i] = 1;
+			found = !pce_cspf_compute(cspf, &reqs[i].cspf,
+				&paths[0]);
+			if (done(arg, &reqs[i], paths, found, paths[0].cached))
+				goto out;
+			continue;
+		}
+
+		for (j = 0; j < n; j++)
+			creqs[j] = reqs[group[j]].cspf;
+		mode = reqs[i].svec_flags &
+			(PCEP_SVEC_FLAG_N | PCEP_SVEC_FLAG_S) ?
+			PCE_DISJOINT_NODE : PCE_DISJOINT_LINK;
+		found = pce_disjoint_compute(cspf, creqs, n, mode, paths);
+		for (j = 0; j < n; j++) {
+			handled[group[j]] = 1;
+			if (done(arg, &reqs[group[j]], &paths[j], j < found,
+				-1))
+				goto out;
+		}
+	}
+	err = 0;
+
+out:
+	pce_cspf_batch_end(cspf);
+	return err;
+}
@@ -0,0 +1,108 @@
+/*
+ * pcep_req.h - PCEP path computation request interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCEP_REQ_H
+#define PCEP_REQ_H
+
+#include <stdint.h>
+
+#include "pcep_msg.h"
+#include "pcep_encoder.h"
+#include "pce_cspf.h"
+#include "pce_ksp.h"
+
+/*
+ *  <PCReq Message> ::= <Common Header>
+ *                      [<svec-list>]
+ *                      <request-list>
+ *
+ *  <request> ::= <RP>
+ *                <END-POINTS>
+ *                [<LSPA>]
+ *                [<BANDWIDTH>]
+ *                [<metric-list>]
+ *                [<RRO>[<BANDWIDTH>]]
+ *                [<IRO>]
+ *                [<LOAD-BALANCING>]
+ *
+ *  <PCNtf Message> ::= <Common Header>
+ *                      <notify-list>
+ *
+ *  <notify> ::= [<request-id-list>]
+ *               <notification-list>
+ *
+ *  <PCRep Message> ::= <Common Header>
+ *                      <response-list>
+ *
+ *  <response> ::= <RP>
+ *                 [<NO-PATH>]
+ *                 [<attribute-list>]
+ *                 [<path-list>]
+ *
+ *  <path> ::= <ERO><attribute-list>
+ */
+
+/* requests decoded from a PCReq message at a time, and SVEC objects */
+#define PCEP_REQ_MAX  64
+#define PCEP_SVEC_MAX 16
+
+/* paths in the response to a request */
+#define PCEP_REQ_PATHS_MAX PCE_KSP_MAX
+
+/* RP object flags */
+#define PCEP_RP_FLAG_PRI_MASK  0x07
+
+/* SVEC object flags */
+#define PCEP_SVEC_FLAG_L       0x01	/* link diverse */
+#define PCEP_SVEC_FLAG_N       0x02	/* node diverse */
+#define PCEP_SVEC_FLAG_S       0x04	/* SRLG diverse */
+#define PCEP_SVEC_DIVERSE \
+	(PCEP_SVEC_FLAG_L | PCEP_SVEC_FLAG_N | PCEP_SVEC_FLAG_S)
+
+/* METRIC object flags */
+#define PCEP_METRIC_FLAG_B     0x01	/* bound */
+#define PCEP_METRIC_FLAG_C     0x02	/* computed metric requested */
+
+/* NO-PATH nature of issue */
+#define PCEP_NO_PATH_NOT_FOUND 0
+
+struct pcep_req {
+	uint32_t rp_flags;
+	uint32_t req_id;
+	int prio;
+	int metric_c;		/* report the computed metric */
+	int svec;		/* SVEC of the request, -1 if none */
+	uint32_t svec_flags;
+	int svec_split;		/* others of the SVEC in another chunk */
+	int max_lsp;		/* LOAD-BALANCING paths, 0 if none */
+	float min_bw;		/* and bandwidth of each */
+	unsigned long deadline;	/* request clock, 0 if none */
+	struct pce_cspf_req cspf;
+};
+
+/*
+ * Called with the paths of every request, none if there is no path or -1
+ * if the request expired before its computation, and cached -1 if the
+ * result could not come from the cache at all. A non-zero return stops
+ * the computation.
+ */
+typedef int (*pcep_req_done_t)(void *arg, const struct pcep_req *req,
+	const struct pce_cspf_path *paths, int num_paths, int cached);
+
+extern unsigned long pcep_req_clock(void);
+extern int pcep_req_decode(struct pcep_msg_hdr *msg, size_t *off,
+	struct pcep_req *reqs, int max, int *err);
+extern void pcep_req_schedule(struct pcep_req *reqs, int num_reqs,
+	unsigned long deadline);
+extern int pcep_req_reply(struct pcep_encoder *e, const struct pcep_req *req,
+	const struct pce_cspf_path *paths, int num_paths);
+extern int pcep_req_cancel(struct pcep_encoder *e, const struct pcep_req *req);
+extern int pcep_req_compute(struct pce_cspf *cspf, const struct pcep_req *reqs,
+	int num_reqs, pcep_req_done_t done, void *arg);
+
+#endif /* PCEP_REQ_H */
@@ -7,238 +7,1652 @@
  */
 
 #include <errno.h>
-#include <getopt.h>
-#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <syslog.h>
 #include <unistd.h>
-#include <netdb.h>
-#include <sys/socket.h>
-#include <sys/wait.h>
-#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
 
 #include "pce_log.h"
-#include "pce_pidfile.h"
+#include "pce_loop.h"
+#include "pce_timer.h"
 #include "pcep_msg.h"
+#include "pcep_obj.h"
 #include "pcep_info.h"
 #include "pcep_framer.h"
+#include "pcep_encoder.h"
+#include "pcep_req.h"
+#include "pce_cspf.h"
+#include "pce_worker.h"
+#include "pcep_session.h"
 
-static int pcep_msg_handler(struct pce_session *ses,
+/* FSM events: a message received (by message type) or a timer expiry */
+#define PCEP_EVENT_OPEN_WAIT  (PCEP_MSG_TYPE_MAX + 0)
+#define PCEP_EVENT_KEEP_WAIT  (PCEP_MSG_TYPE_MAX + 1)
+#define PCEP_EVENT_KEEP_ALIVE (PCEP_MSG_TYPE_MAX + 2)
+#define PCEP_EVENT_DEAD       (PCEP_MSG_TYPE_MAX + 3)
+#define PCEP_EVENTS           (PCEP_MSG_TYPE_MAX + 4)
+
+#define PCEP_STATES           (PCEP_STATE_SESSION_UP + 1)
+
+/* account an event both in the session and in the owner's statistics */
+#define pcep_session_count(ses, field) \
+	do { \
+		(ses)->field++; \
+		if ((ses)->stats) \
+			PCEP_STATS_ADD((ses)->stats->field, 1); \
+	} while (0)
+
+/* a computation answered by the path cache or not (< 0: not cacheable) */
+#define pcep_session_count_cache(ses, cached) \
+	do { \
+		if ((cached) > 0) \
+			pcep_session_count(ses, num_path_cache_hits); \
+		else if (!(cached)) \
+			pcep_session_count(ses, num_path_cache_misses); \
+	} while (0)
+
+/* smallest output queue allocation */
+#define PCEP_SESSION_OUT_MIN 256
+
+/* largest PCEP message */
+#define PCEP_SESSION_MSG_MAX 0xffff
+
+/* output queued past which the session goes down, in high-water marks */
+#define PCEP_SESSION_OUT_LIMIT 8
+
+/* the load is checked this often while the peer is told it's too high */
+#define PCEP_SESSION_LOAD_CHECK 1000	/* in milliseconds */
+
+/* requests with this priority or more are admitted past the high mark */
+#define PCEP_SESSION_LOAD_URGENT 4
+
+/* unknown messages are limited per minute (RFC 5440) */
+#define PCEP_SESSION_UNKNOWN_WINDOW 60000	/* in milliseconds */
+
+static void pcep_session_close(struct pcep_session *ses);
+static int pcep_session_output(struct pcep_session *ses);
+static void pcep_session_unhold(struct pcep_session *ses);
+
+/*
+ * pcep_session_queued - Return the output not written yet
+ */
+static inline size_t pcep_session_queued(struct pcep_session *ses)
+{
+	return ses->out_tail - ses->out_head + ses->busy_len;
+}
+
+/*
+ * pcep_session_watch - Update the events of interest of the connection
+ *
+ * Reading stops when the output queue reaches the high-water mark and
+ * resumes once half of it has been written, so that a peer not reading
+ * its replies can't make the queue grow. Writability is only watched
+ * while there is queued output, unless the loop writes it.
+ */
+static void pcep_session_watch(struct pcep_session *ses)
+{
+	size_t queued = pcep_session_queued(ses);
+	size_t hwm = ses->cfg->send_hwm;
+	unsigned int events = 0;
+
+	if (queued < hwm && ((ses->events & PCE_LOOP_IN) || queued <= hwm / 2))
+		events |= PCE_LOOP_IN;
+	if (queued && !ses->loop_sends)
+		events |= PCE_LOOP_OUT;
+
+	if (events != ses->events) {
+		pce_loop_mod(ses->loop, &ses->sock, events);
+		ses->events = events;
+	}
+}
+
+static int pcep_session_flush(struct pcep_session *ses);
+
+/*
+ * pcep_session_send - Queue a message for the peer
+ *
+ * Messages queued while handling incoming data are coalesced and written
+ * at once when done. The others are written right away if nothing is
+ * queued, so a keepalive costs a single system call (or is handed to the
+ * loop, with the next batch of requests it submits).
+ */
+static int pcep_session_send(struct pcep_session *ses, const void *buf,
+	size_t len)
+{
+	const char *data = buf;
+	size_t queued = pcep_session_queued(ses);
+	size_t size;
+	ssize_t count;
+	char *out;
+
+	if (!ses->batching && !queued && !ses->loop_sends) {
+		do {
+			count = write(ses->sock.fd, data, len);
+		} while (count == -1 && errno == EINTR);
+		if (count == (ssize_t)len)
+			return 0;
+		if (count == -1 && errno != EAGAIN)
+			goto err;
+
+		/* queue the rest */
+		if (count > 0) {
+			data += count;
+			len -= count;
+		}
+	}
+
+	/*
+	 * the peer doesn't read at all: reading stops at the high-water mark
+	 * and past it the requests are no longer computed, so only the
+	 * responses of the jobs in flight can make the queue grow further
+	 */
+	if (queued + len > (size_t)ses->cfg->send_hwm * PCEP_SESSION_OUT_LIMIT)
+		goto err;
+
+	if (ses->out_tail + len > ses->out_size) {
+		/* make room at the end of the queue, growing it if needed */
+		queued = ses->out_tail - ses->out_head;
+		if (queued)
+			memmove(ses->out, ses->out + ses->out_head, queued);
+		ses->out_head = 0;
+		ses->out_tail = queued;
+
+		if (queued + len > ses->out_size) {
+			size = ses->out_size ? ses->out_size : PCEP_SESSION_OUT_MIN;
+			while (size < queued + len)
+				size *= 2;
+			out = realloc(ses->out, size);
+			if (!out)
+				goto err;
+			ses->out = out;
+			ses->out_size = size;
+		}
+	}
+	memcpy(ses->out + ses->out_tail, data, len);
+	ses->out_tail += len;
+
+	if (!ses->batching) {
+		if (ses->loop_sends && pcep_session_flush(ses))
+			return -1;
+		pcep_session_watch(ses);
+	}
+
+	return 0;
+
+err:
+	ses->out_err = 1;
+	return -1;
+}
+
+/*
+ * pcep_session_post - Hand the output queue to the loop, if it isn't
+ * sending yet: the queue buffer goes with it and a new one is started
+ */
+static int pcep_session_post(struct pcep_session *ses)
+{
+	if (ses->busy || ses->out_head == ses->out_tail)
+		return 0;
+
+	if (pce_loop_send(ses->loop, &ses->sock, ses->out, ses->out_head,
+		ses->out_tail - ses->out_head)) {
+		ses->out_err = 1;
+		return -1;
+	}
+	ses->busy = ses->out;
+	ses->busy_size = ses->out_size;
+	ses->busy_off = ses->out_head;
+	ses->busy_len = ses->out_tail - ses->out_head;
+	ses->out = NULL;
+	ses->out_size = 0;
+	ses->out_head = ses->out_tail = 0;
+
+	return 0;
+}
+
+/*
+ * pcep_session_sent - Handle output written by a completion based loop
+ *
+ * The rest of a short write is sent again, then the buffer is kept for the
+ * output queued meanwhile, which is handed to the loop in turn.
+ */
+static void pcep_session_sent(struct pce_loop_event *ev, char *buf,
+	ssize_t count)
+{
+	struct pcep_session *ses = container_of(ev, struct pcep_session, sock);
+
+	if (count <= 0)
+		goto err;
+
+	ses->busy_off += count;
+	ses->busy_len -= (size_t)count < ses->busy_len ?
+		(size_t)count : ses->busy_len;
+	if (ses->busy_len) {
+		if (pce_loop_send(ses->loop, &ses->sock, ses->busy,
+			ses->busy_off, ses->busy_len))
+			goto err;
+		return;
+	}
+
+	if (!ses->out) {
+		ses->out = ses->busy;
+		ses->out_size = ses->busy_size;
+	} else {
+		free(ses->busy);
+	}
+	ses->busy = NULL;
+
+	ses->batching = 1;
+	if (ses->in_len)
+		pcep_session_unhold(ses);
+	if (pcep_session_output(ses))
+		pcep_session_close(ses);
+	return;
+
+err:
+	/* the buffer is ours again, the session goes down */
+	free(ses->busy);
+	ses->busy = NULL;
+	ses->busy_len = 0;
+	pcep_session_close(ses);
+}
+
+/*
+ * pcep_session_flush - Write as much of the output queue as possible
+ */
+static int pcep_session_flush(struct pcep_session *ses)
+{
+	ssize_t count;
+
+	if (ses->out_err)
+		return -1;
+	if (ses->loop_sends)
+		return pcep_session_post(ses);
+
+	while (ses->out_head != ses->out_tail) {
+		do {
+			count = write(ses->sock.fd, ses->out + ses->out_head,
+				ses->out_tail - ses->out_head);
+		} while (count == -1 && errno == EINTR);
+
+		/* the socket buffer is full, wait for writability */
+		if (count == -1 && errno == EAGAIN)
+			break;
+		if (count <= 0)
+			return -1;
+		ses->out_head += count;
+	}
+	if (ses->out_head == ses->out_tail)
+		ses->out_head = ses->out_tail = 0;
+
+	return 0;
+}
+
+/*
+ * pcep_session_keepalive - Send a keepalive message
+ */
+static int pcep_session_keepalive(struct pcep_session *ses)
+{
+	if (pcep_session_send(ses, pcep_msg_keepalive,
+		sizeof(pcep_msg_keepalive)))
+		return -1;
+	pcep_session_count(ses, num_keep_alive_sent);
+
+	return 0;
+}
+
+/*
+ * pcep_session_error - Send one of the common PCErr messages
+ */
+static int pcep_session_error(struct pcep_session *ses, int err)
+{
+	if (pcep_session_send(ses, pcep_msg_error[err],
+		sizeof(pcep_msg_error[err])))
+		return -1;
+	pcep_session_count(ses, num_pc_err_sent);
+
+	return 0;
+}
+
+/*
+ * pcep_session_bye - Send a Close message
+ */
+static int pcep_session_bye(struct pcep_session *ses, int reason)
+{
+	return pcep_session_send(ses, pcep_msg_close[reason],
+		sizeof(pcep_msg_close[reason]));
+}
+
+/*
+ * pcep_session_open_obj - Encode an OPEN object with the given session
+ * attributes
+ */
+static void pcep_session_open_obj(struct pcep_encoder *e,
+	unsigned int keep_alive, unsigned int dead, unsigned int sid)
+{
+	unsigned char *p;
+
+	/* Ver (3 bits) and Flags (5 bits), then Keepalive, DeadTimer, SID */
+	pcep_encoder_obj_begin(e, PCEP_OBJ_CLASS_OPEN, 1, 0, 0);
+	p = pcep_encoder_put(e, 4);
+	if (p) {
+		p[0] = PCEP_MSG_VERSION << 5;
+		p[1] = keep_alive;
+		p[2] = dead;
+		p[3] = sid;
+	}
+	pcep_encoder_obj_end(e);
+}
+
+/*
+ * pcep_session_open - Send our Open message, with the session attributes
+ * of the configuration
+ */
+static int pcep_session_open(struct pcep_session *ses)
+{
+	struct pcep_encoder e;
+	char buf[16];
+
+	pcep_encoder_init(&e, buf, sizeof(buf));
+	pcep_encoder_msg_begin(&e, PCEP_MSG_TYPE_OPEN);
+	pcep_session_open_obj(&e, ses->cfg->keep_alive_timer,
+		ses->cfg->dead_timer, ses->local_id);
+	pcep_encoder_msg_end(&e);
+
+	return pcep_session_send(ses, buf, e.pos);
+}
+
+/*
+ * pcep_session_negotiate - Send the PCErr turning down an Open, with the
+ * attributes we would accept: the peer's Keepalive and a DeadTimer four
+ * times as long (RFC 5440)
+ */
+static int pcep_session_negotiate(struct pcep_session *ses,
+	unsigned int keep_alive)
+{
+	struct pcep_encoder e;
+	char buf[32];
+	unsigned char *p;
+	unsigned int dead = 4 * keep_alive;
+
+	pcep_encoder_init(&e, buf, sizeof(buf));
+	pcep_encoder_msg_begin(&e, PCEP_MSG_TYPE_ERROR);
+
+	/* PCEP-ERROR, Reserved, Flags, Error-Type and Error-value */
+	pcep_encoder_obj_begin(&e, PCEP_OBJ_CLASS_PCEP_ERROR, 1, 0, 0);
+	p = pcep_encoder_put(&e, 4);
+	if (p) {
+		p[0] = p[1] = 0;
+		p[2] = PCEP_ERR_TYPE_OPEN;
+		p[3] = PCEP_ERR_OPEN_NEGOTIABLE;
+	}
+	pcep_encoder_obj_end(&e);
+	pcep_session_open_obj(&e, keep_alive, dead > 255 ? 255 : dead,
+		ses->local_id);
+	pcep_encoder_msg_end(&e);
+	if (pcep_session_send(ses, buf, e.pos))
+		return -1;
+	pcep_session_count(ses, num_pc_err_sent);
+
+	return 0;
+}
+
+/*
+ * pcep_msg_open_check - Check that an open message carries one OPEN object
+ * and get it
+ */
+static int pcep_msg_open_check(struct pcep_msg_hdr *msg, struct pcep_obj *obj)
+{
+	struct pcep_obj_iter it;
+	struct pcep_obj tmp = { 0 };
+	unsigned char *body;
+
+	pcep_obj_iter_init(&it, msg);
+	if (pcep_obj_iter_next(&it, obj) != 1 ||
+		obj->o_class != PCEP_OBJ_CLASS_OPEN || obj->o_type != 1 ||
+		obj->body_len < 4)
+		return 0;
+
+	/* Ver (3 bits) and Flags (5 bits), then Keepalive, DeadTimer, SID */
+	body = obj->body;
+	if ((body[0] >> 5) != PCEP_MSG_VERSION)
+		return 0;
+
+	return pcep_obj_iter_next(&it, &tmp) == 0;
+}
+
+/*
+ * pcep_session_dead_left - Return the milliseconds left before the peer
+ * is declared dead
+ */
+static unsigned long pcep_session_dead_left(struct pcep_session *ses,
+	unsigned long now)
+{
+	unsigned long deadline;
+
+	deadline = ses->last_rx + ses->peer_dead_timer * 1000UL;
+	return deadline > now ? deadline - now : 0;
+}
+
+/*
+ * Session FSM actions, msg is NULL for timer events. A non zero return
+ * value tears the session down when the event is a timer expiry.
+ */
+typedef int (*pcep_fsm_action)(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg);
+
+/*
+ * pcep_fsm_ignore - Event not relevant in the current state
+ */
+static int pcep_fsm_ignore(struct pcep_session *ses, struct pcep_msg_hdr *msg)
+{
+	return 0;
+}
+
+/*
+ * pcep_fsm_invalid - Event that can't happen in the current state (e.g.
+ * a message received while the connection isn't established yet)
+ */
+static int pcep_fsm_invalid(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	return -1;
+}
+
+/*
+ * pcep_fsm_open_invalid - Anything but a valid Open while waiting for it
+ */
+static int pcep_fsm_open_invalid(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	pcep_session_error(ses, PCEP_ERR_OPEN_INVALID);
+	return -1;
+}
+
+/*
+ * pcep_fsm_open - Open received in OPEN_WAIT
+ */
+static int pcep_fsm_open(struct pcep_session *ses, struct pcep_msg_hdr *msg)
+{
+	struct pcep_obj obj = { 0 };
+	unsigned char *body;
+
+	if (!pcep_msg_open_check(msg, &obj))
+		return pcep_fsm_open_invalid(ses, msg);
+
+	/*
+	 * check session attributes: the peer sends something at least every
+	 * Keepalive seconds and is declared dead when nothing is received
+	 * for DeadTimer seconds (zero disables both). The peer gets a
+	 * second chance to send acceptable ones, with our proposal and a
+	 * new OpenWait, then the session goes down. The OpenWait timer only
+	 * goes once the Open is accepted.
+	 */
+	body = obj.body;
+	if (body[2] && body[1] > body[2]) {
+		if (ses->open_retried) {
+			pcep_session_error(ses, PCEP_ERR_OPEN_SECOND);
+			return -1;
+		}
+		ses->open_retried = 1;
+		pce_timer_add(ses->loop, &ses->open_wait,
+			ses->cfg->open_wait_timer * 1000);
+		return pcep_session_negotiate(ses, body[1]);
+	}
+	pce_timer_del(&ses->open_wait);
+
+	/* ours were sent with our Open */
+	ses->peer_keep_alive_timer = body[1];
+	ses->peer_dead_timer = body[2];
+	ses->peer_id = body[3];
+
+	/* send a keepalive message */
+	if (pcep_session_keepalive(ses))
+		return -1;
+
+	/* start keepalive and dead timers */
+	if (ses->keep_alive_timer)
+		pce_timer_add(ses->loop, &ses->keep_alive,
+			ses->keep_alive_timer * 1000);
+	if (ses->peer_dead_timer)
+		pce_timer_add(ses->loop, &ses->dead,
+			ses->peer_dead_timer * 1000);
+	ses->remote_ok = 1;
+
+	if (ses->local_ok == 0) {
+		pce_timer_add(ses->loop, &ses->keep_wait,
+			ses->cfg->keep_wait_timer * 1000);
+		ses->state = PCEP_STATE_KEEP_WAIT;
+	} else {
+		ses->state = PCEP_STATE_SESSION_UP;
+	}
+
+	return 0;
+}
+
+/*
+ * pcep_fsm_open_acked - Keepalive received in OPEN_WAIT: the peer accepted
+ * our Open before sending its own
+ */
+static int pcep_fsm_open_acked(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	ses->local_ok = 1;
+
+	return 0;
+}
+
+/*
+ * pcep_fsm_open_refused - PCErr received before the session is up: the
+ * peer turned down our Open, whose attributes are not negotiable
+ */
+static int pcep_fsm_open_refused(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	pce_log(LOG_DEBUG, "PCEP peer refused our Open\n");
+	return -1;
+}
+
+/*
+ * pcep_fsm_keep_wait_done - Keepalive received in KEEP_WAIT
+ */
+static int pcep_fsm_keep_wait_done(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	pce_timer_del(&ses->keep_wait);
+	ses->local_ok = 1;
+	ses->state = PCEP_STATE_SESSION_UP;
+
+	return 0;
+}
+
+/*
+ * pcep_fsm_open_wait_expired - No Open message received in time
+ */
+static int pcep_fsm_open_wait_expired(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	pcep_session_error(ses, PCEP_ERR_OPEN_WAIT);
+	return -1;
+}
+
+/*
+ * pcep_fsm_keep_wait_expired - No keepalive message received in time
+ */
+static int pcep_fsm_keep_wait_expired(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	pcep_session_error(ses, PCEP_ERR_KEEP_WAIT);
+	return -1;
+}
+
+/*
+ * pcep_fsm_dead - Nothing received from the peer for too long (maybe)
+ *
+ * Received messages don't touch the dead timer, they just record the
+ * time: on expiry the timer is pushed back to the actual deadline if
+ * anything came in meanwhile.
+ */
+static int pcep_fsm_dead(struct pcep_session *ses, struct pcep_msg_hdr *msg)
+{
+	unsigned long left;
+
+	left = pcep_session_dead_left(ses, pce_timer_now(ses->loop));
+	if (left) {
+		pce_timer_add(ses->loop, &ses->dead, left);
+		return 0;
+	}
+
+	pcep_session_bye(ses, PCEP_CLOSE_REASON_DEAD_TIMER);
+	return -1;
+}
+
+/*
+ * pcep_fsm_close - Close received, the peer is going away
+ */
+static int pcep_fsm_close(struct pcep_session *ses, struct pcep_msg_hdr *msg)
+{
+	return -1;
+}
+
+/*
+ * pcep_fsm_keep_alive - Time to tell the peer we're still there
+ */
+static int pcep_fsm_keep_alive(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	int err;
+
+	err = pcep_session_keepalive(ses);
+	pce_timer_add(ses->loop, &ses->keep_alive,
+		ses->keep_alive_timer * 1000);
+
+	return err;
+}
+
+/*
+ * The responses to the requests of a message are packed into as few
+ * messages as the PCEP message size allows: the paths (or NO-PATHs) into
+ * PCRep messages, the cancellations into PCNtf messages. A message is
+ * sent once full, or once the type of the responses changes.
+ */
+struct pcep_session_batch {
+	struct pcep_session *ses;
+	struct pcep_encoder e;
+	int type;		/* message being built, 0 if none */
+	int num;		/* responses in it */
+	char buf[PCEP_SESSION_MSG_MAX];
+};
+
+static void pcep_session_batch_init(struct pcep_session_batch *b,
+	struct pcep_session *ses)
+{
+	b->ses = ses;
+	b->type = 0;
+	b->num = 0;
+}
+
+/*
+ * pcep_session_batch_flush - Send the message being built, if any
+ *
+ * The answers to a message may be much larger than the message: they are
+ * written as soon as they fill the output queue up to the high-water
+ * mark, rather than only when all of them are queued.
+ */
+static int pcep_session_batch_flush(struct pcep_session_batch *b)
+{
+	struct pcep_session *ses = b->ses;
+	int type = b->type;
+
+	if (!type)
+		return 0;
+	b->type = 0;
+
+	pcep_encoder_msg_end(&b->e);
+	if (pcep_session_send(ses, b->buf, b->e.pos))
+		return -1;
+	if (type == PCEP_MSG_TYPE_PC_REPLY)
+		pcep_session_count(ses, num_pc_rep_sent);
+	else
+		pcep_session_count(ses, num_pc_ntf_sent);
+
+	if (pcep_session_queued(ses) >= ses->cfg->send_hwm)
+		return pcep_session_flush(ses);
+
+	return 0;
+}
+
+/*
+ * pcep_session_batch_begin - Get a message of the given type to encode a
+ * response in, and mark where the response starts
+ */
+static int pcep_session_batch_begin(struct pcep_session_batch *b, int type,
+	struct pcep_encoder_mark *m)
+{
+	if (b->type != type) {
+		if (pcep_session_batch_flush(b))
+			return -1;
+		pcep_encoder_init(&b->e, b->buf, sizeof(b->buf));
+		pcep_encoder_msg_begin(&b->e, type);
+		b->type = type;
+		b->num = 0;
+	}
+	pcep_encoder_mark(&b->e, m);
+
+	return 0;
+}
+
+/*
+ * pcep_session_batch_next - Move the response being encoded to a new
+ * message, the current one being full
+ */
+static int pcep_session_batch_next(struct pcep_session_batch *b,
+	struct pcep_encoder_mark *m)
+{
+	int type = b->type;
+
+	pcep_encoder_rewind(&b->e, m);
+	if (pcep_session_batch_flush(b))
+		return -1;
+
+	return pcep_session_batch_begin(b, type, m);
+}
+
+/*
+ * pcep_session_reply - Add the PCRep of a request, with no paths if none
+ * was found
+ */
+static int pcep_session_reply(struct pcep_session_batch *b,
+	const struct pcep_req *req, const struct pce_cspf_path *paths,
+	int num_paths)
+{
+	struct pcep_encoder_mark m;
+
+	if (pcep_session_batch_begin(b, PCEP_MSG_TYPE_PC_REPLY, &m))
+		return -1;
+	if (pcep_req_reply(&b->e, req, paths, num_paths) && b->num) {
+		if (pcep_session_batch_next(b, &m))
+			return -1;
+		pcep_req_reply(&b->e, req, paths, num_paths);
+	}
+
+	/* paths too long for a message are no path */
+	if (b->e.err) {
+		pcep_encoder_rewind(&b->e, &m);
+		pcep_req_reply(&b->e, req, NULL, 0);
+	}
+	b->num++;
+
+	return 0;
+}
+
+/*
+ * pcep_session_cancel - Add the PCNtf cancelling a request before its
+ * computation
+ */
+static int pcep_session_cancel(struct pcep_session_batch *b,
+	const struct pcep_req *req)
+{
+	struct pcep_encoder_mark m;
+
+	if (pcep_session_batch_begin(b, PCEP_MSG_TYPE_NOTIFICATION, &m))
+		return -1;
+	if (pcep_req_cancel(&b->e, req)) {
+		if (pcep_session_batch_next(b, &m))
+			return -1;
+		pcep_req_cancel(&b->e, req);
+	}
+	b->num++;
+
+	return 0;
+}
+
+/*
+ * pcep_session_overload - Send the PCNtf telling the peer that the PCE is
+ * overloaded, or that it is no longer
+ *
+ * The overload is expected to last no more than the request timer: by
+ * then every request pending is either answered or cancelled.
+ */
+static int pcep_session_overload(struct pcep_session *ses, int overloaded)
+{
+	struct pcep_encoder e;
+	char buf[32];
+	unsigned char *p;
+	uint32_t v;
+
+	pcep_encoder_init(&e, buf, sizeof(buf));
+	pcep_encoder_msg_begin(&e, PCEP_MSG_TYPE_NOTIFICATION);
+
+	/* NOTIFICATION, Reserved, Flags, Notification-type and value */
+	pcep_encoder_obj_begin(&e, PCEP_OBJ_CLASS_NOTIFICATION, 1, 0, 0);
+	p = pcep_encoder_put(&e, 4);
+	if (p) {
+		p[0] = p[1] = 0;
+		p[2] = PCEP_NTF_TYPE_OVERLOAD;
+		p[3] = overloaded ? PCEP_NTF_OVERLOADED :
+			PCEP_NTF_OVERLOAD_CLEARED;
+	}
+
+	/* OVERLOADED-DURATION TLV, the expected relief interval */
+	if (overloaded && ses->cfg->request_timer) {
+		p = pcep_encoder_put(&e, 8);
+		if (p) {
+			p[0] = 0;
+			p[1] = PCEP_NTF_TLV_OVERLOADED_DURATION;
+			p[2] = 0;
+			p[3] = 4;
+			v = htonl(ses->cfg->request_timer);
+			memcpy(p + 4, &v, 4);
+		}
+	}
+	pcep_encoder_obj_end(&e);
+	pcep_encoder_msg_end(&e);
+	if (pcep_session_send(ses, buf, e.pos))
+		return -1;
+	pcep_session_count(ses, num_pc_ntf_sent);
+
+	return 0;
+}
+
+/*
+ * pcep_load_add - Account requests submitted (n > 0) or completed (n < 0)
+ * and update the overload state
+ *
+ * The event loops race on the state: it only changes by compare-and-swap,
+ * so exactly one of them announces each transition. The count is read
+ * again after a change, as the others may have moved it meanwhile.
+ */
+static void pcep_load_add(struct pcep_load *load, long n)
+{
+	unsigned long pending;
+	int cur, want;
+
+	pending = __atomic_add_fetch(&load->pending, n, __ATOMIC_RELAXED);
+	for (;;) {
+		if (pending >= load->high)
+			want = 1;
+		else if (pending <= load->low)
+			want = 0;
+		else
+			return;
+
+		cur = __atomic_load_n(&load->overloaded, __ATOMIC_RELAXED);
+		if (cur == want)
+			return;
+		if (!__atomic_compare_exchange_n(&load->overloaded, &cur, want,
+				0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			continue;
+
+		pce_log(LOG_NOTICE, want ?
+			"PCE overloaded, %lu requests pending\n" :
+			"PCE no longer overloaded, %lu requests pending\n",
+			pending);
+		pending = __atomic_load_n(&load->pending, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * pcep_session_load_check - Tell the peer whether the PCE is overloaded,
+ * if that changed since it was last told
+ *
+ * Only the peers sending requests are told. Once told that the PCE is
+ * overloaded, a peer may stop sending: the load is then checked
+ * periodically until it is told that the overload is over.
+ */
+static int pcep_session_load_check(struct pcep_session *ses)
+{
+	int overloaded;
+
+	if (!ses->load || ses->state != PCEP_STATE_SESSION_UP)
+		return 0;
+
+	overloaded = __atomic_load_n(&ses->load->overloaded, __ATOMIC_RELAXED);
+	if (overloaded != ses->overload_sent) {
+		if (pcep_session_overload(ses, overloaded))
+			return -1;
+		ses->overload_sent = overloaded;
+	}
+	if (ses->overload_sent && !pce_timer_pending(&ses->load_check))
+		pce_timer_add(ses->loop, &ses->load_check,
+			PCEP_SESSION_LOAD_CHECK);
+
+	return 0;
+}
+
+/*
+ * pcep_session_admit - Count the requests of a message, the most urgent
+ * first, that may be queued for computation
+ *
+ * A session has no more than max_req_per_session requests pending. Past
+ * the high watermark only the urgent requests are still admitted, up to
+ * twice as many requests pending: under a request storm the bulk requests
+ * are turned down right away, instead of expiring in the queues.
+ */
+static int pcep_session_admit(struct pcep_session *ses,
+	const struct pcep_req *reqs, int n)
+{
+	unsigned int max = ses->cfg->max_req_per_session;
+	unsigned long pending = 0, high = 0, limit;
+	int i;
+
+	if (ses->load) {
+		pending = __atomic_load_n(&ses->load->pending,
+			__ATOMIC_RELAXED);
+		high = ses->load->high;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (max && ses->pending + i >= max)
+			break;
+		limit = reqs[i].prio >= PCEP_SESSION_LOAD_URGENT ?
+			2 * high : high;
+		if (ses->load && pending + i >= limit)
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * pcep_session_answer - Answer a request: its paths, a NO-PATH or, past
+ * its deadline, a cancellation
+ *
+ * Also called by the engine of the event loop with every result.
+ */
+static int pcep_session_answer(void *arg, const struct pcep_req *req,
+	const struct pce_cspf_path *paths, int num_paths, int cached)
+{
+	struct pcep_session_batch *b = arg;
+	struct pcep_session *ses = b->ses;
+
+	if (num_paths < 0) {
+		pcep_session_count(ses, num_pc_req_expired);
+		return pcep_session_cancel(b, req);
+	}
+
+	pcep_session_count_cache(ses, cached);
+	return pcep_session_reply(b, req, paths, num_paths);
+}
+
+/*
+ * Requests of a PCReq message computed by a worker. The paths found are
+ * copied out of the worker engine into the job.
+ */
+struct pcep_session_path {
+	uint32_t hop;		/* first hop in the job hops */
+	uint32_t num_hops;
+	uint64_t cost;
+	float bw;
+};
+
+struct pcep_session_result {
+	int num_paths;		/* -1 if expired */
+	int cached;
+	struct pcep_session_path paths[PCEP_REQ_PATHS_MAX];
+};
+
+struct pcep_session_job {
+	struct pce_job job;
+	struct pcep_session *ses;
+	int num_reqs;
+	struct pcep_req *reqs;
+	struct pcep_session_result *res;
+	uint32_t *hops;
+	uint32_t num_hops;
+	uint32_t max_hops;
+};
+
+/*
+ * pcep_session_job_result - Copy the result of a request out of the
+ * worker engine
+ */
+static int pcep_session_job_result(void *arg, const struct pcep_req *req,
+	const struct pce_cspf_path *paths, int num_paths, int cached)
+{
+	struct pcep_session_job *sj = arg;
+	struct pcep_session_result *res = &sj->res[req - sj->reqs];
+	struct pcep_session_path *p;
+	uint32_t *hops, size, n = 0;
+	int i;
+
+	res->num_paths = num_paths < 0 ? num_paths : 0;
+	res->cached = cached;
+	for (i = 0; i < num_paths; i++)
+		n += paths[i].num_hops;
+	if (!n)
+		return 0;
+
+	if (sj->num_hops + n > sj->max_hops) {
+		size = sj->max_hops ? sj->max_hops : 64;
+		while (size < sj->num_hops + n)
+			size *= 2;
+		hops = realloc(sj->hops, size * sizeof(*hops));
+		if (!hops)
+			return 0;
+		sj->hops = hops;
+		sj->max_hops = size;
+	}
+	for (i = 0; i < num_paths; i++) {
+		p = &res->paths[i];
+		memcpy(sj->hops + sj->num_hops, paths[i].hops,
+			paths[i].num_hops * sizeof(*paths[i].hops));
+		p->hop = sj->num_hops;
+		p->num_hops = paths[i].num_hops;
+		p->cost = paths[i].cost;
+		p->bw = paths[i].bw;
+		sj->num_hops += paths[i].num_hops;
+	}
+	res->num_paths = num_paths;
+
+	return 0;
+}
+
+/*
+ * pcep_session_job_run - Compute the paths of a job, on a worker
+ */
+static void pcep_session_job_run(struct pce_job *job, struct pce_cspf *cspf)
+{
+	struct pcep_session_job *sj =
+		container_of(job, struct pcep_session_job, job);
+
+	pcep_req_compute(cspf, sj->reqs, sj->num_reqs,
+		pcep_session_job_result, sj);
+}
+
+static void pcep_session_job_free(struct pcep_session_job *sj)
+{
+	free(sj->hops);
+	free(sj);
+}
+
+/*
+ * pcep_session_job_done - Send the replies of a job, on the session loop
+ *
+ * A session closed meanwhile was kept around for its jobs only. The
+ * replies to the requests of the job share their messages.
+ */
+static void pcep_session_job_done(struct pce_job *job)
+{
+	struct pcep_session_job *sj =
+		container_of(job, struct pcep_session_job, job);
+	struct pcep_session *ses = sj->ses;
+	struct pcep_session_result *res;
+	struct pcep_session_batch b;
+	struct pce_cspf_path paths[PCEP_REQ_PATHS_MAX];
+	int i, j, err = 0;
+
+	/* the requests are no longer pending, answered or not */
+	ses->jobs--;
+	ses->pending -= sj->num_reqs;
+	if (ses->load)
+		pcep_load_add(ses->load, -(long)sj->num_reqs);
+	if (ses->closed) {
+		if (!ses->jobs)
+			free(ses);
+		pcep_session_job_free(sj);
+		return;
+	}
+
+	ses->batching = 1;
+	pcep_session_batch_init(&b, ses);
+	for (i = 0; i < sj->num_reqs && !err; i++) {
+		res = &sj->res[i];
+		for (j = 0; j < res->num_paths; j++) {
+			paths[j].hops = sj->hops + res->paths[j].hop;
+			paths[j].num_hops = res->paths[j].num_hops;
+			paths[j].cost = res->paths[j].cost;
+			paths[j].bw = res->paths[j].bw;
+		}
+		err = pcep_session_answer(&b, &sj->reqs[i], paths,
+			res->num_paths, res->cached);
+	}
+	pcep_session_job_free(sj);
+	if (!err)
+		err = pcep_session_batch_flush(&b);
+	if (!err)
+		err = pcep_session_load_check(ses);
+
+	if (err || pcep_session_output(ses))
+		pcep_session_close(ses);
+}
+
+/*
+ * pcep_session_submit - Hand the requests of a message to the workers
+ */
+static int pcep_session_submit(struct pcep_session *ses,
+	struct pcep_req *reqs, int n)
+{
+	struct pcep_session_job *sj;
+
+	sj = malloc(sizeof(*sj) + n * (sizeof(*sj->reqs) + sizeof(*sj->res)));
+	if (!sj)
+		return -1;
+	sj->job.run = pcep_session_job_run;
+	sj->job.done = pcep_session_job_done;
+	sj->job.prio = reqs[0].prio;
+	sj->ses = ses;
+	sj->num_reqs = n;
+	sj->reqs = (struct pcep_req *)(sj + 1);
+	sj->res = (struct pcep_session_result *)(sj->reqs + n);
+	sj->hops = NULL;
+	sj->num_hops = 0;
+	sj->max_hops = 0;
+	memcpy(sj->reqs, reqs, n * sizeof(*reqs));
+
+	if (pce_worker_submit(ses->port, &sj->job)) {
+		free(sj);
+		return -1;
+	}
+	ses->jobs++;
+	ses->pending += n;
+	if (ses->load)
+		pcep_load_add(ses->load, n);
+
+	return 0;
+}
+
+/*
+ * pcep_session_requests - Handle a chunk of the requests of a PCReq message
+ *
+ * The requests of a chunk make a single batch: they are handed together
+ * to a worker if there is a pool, queued by priority, otherwise they are
+ * computed right away by the engine of the event loop, the most urgent
+ * first. Every request gets a response, a NO-PATH if there is no engine
+ * or the workers are too busy, or a cancellation if the request timer ran
+ * out before its computation, if the PCE is too loaded to queue it or if
+ * the peer doesn't read the responses it already has.
+ */
+static int pcep_session_requests(struct pcep_session *ses,
+	struct pcep_session_batch *b, struct pcep_req *reqs, int n)
+{
+	int i, m;
+
+	/* a cancellation is much smaller than the paths it would get */
+	if (pcep_session_queued(ses) >= ses->cfg->send_hwm)
+		m = 0;
+	else if (ses->port)
+		m = pcep_session_admit(ses, reqs, n);
+	else
+		m = n;
+	for (i = m; i < n; i++) {
+		pcep_session_count(ses, num_pc_req_refused);
+		if (pcep_session_cancel(b, &reqs[i]))
+			return -1;
+	}
+	n = m;
+	if (!n)
+		return 0;
+
+	if (ses->port) {
+		if (!pcep_session_submit(ses, reqs, n))
+			return 0;
+	} else if (ses->cspf) {
+		return pcep_req_compute(ses->cspf, reqs, n,
+			pcep_session_answer, b);
+	}
+
+	for (i = 0; i < n; i++)
+		if (pcep_session_reply(b, &reqs[i], NULL, 0))
+			return -1;
+
+	return 0;
+}
+
+/*
+ * pcep_fsm_request - Path computation request received in SESSION_UP
+ *
+ * The requests of the message are decoded and handled PCEP_REQ_MAX at a
+ * time, so that none is left unanswered however many the message
+ * carries. The responses share as few messages as possible.
+ */
+static int pcep_fsm_request(struct pcep_session *ses,
 	struct pcep_msg_hdr *msg)
 {
-	int err = 0;
+	struct pcep_req reqs[PCEP_REQ_MAX];
+	struct pcep_session_batch b;
+	unsigned long deadline = 0;
+	size_t off = 0;
+	int n, err;
 
-	switch (ses->state) {
-	case PCEP_STATE_IDLE:
-	case PCEP_STATE_TCP_PENDING:
-		/*
-		 * no message could be received in those states since the
-		 * connection isn't established yet
-		 */
-		err = -1;
-		break;
-	case PCEP_STATE_OPEN_WAIT:
-		/* check for an open message */
-		if (msg->type == PCEP_MSG_TYPE_OPEN &&
-			msg->len == 12) {
-			/* check session attributes */
-			// keepalive frequency =
-			// deadtimer =
-
-			/* send a keepalive message */
-			/* start keepalive timer */
-			/* remote_ok = 1 */
-
-			if (local_ok == 0) {
-				ses->state = PCEP_STATE_KEEP_WAIT;
-			} else {
-				ses->state = PCEP_STATE_SESSION_UP;
-			}
-		} else {
-			/* send a notification */
-			// err type = 1 value = 1
-			err = -1;
+	if (ses->cfg->request_timer)
+		deadline = pcep_req_clock() + ses->cfg->request_timer * 1000UL;
+	pcep_session_batch_init(&b, ses);
+
+	do {
+		n = pcep_req_decode(msg, &off, reqs, PCEP_REQ_MAX, &err);
+		if (n < 0) {
+			/* after the responses to the chunks before, if any */
+			if (pcep_session_batch_flush(&b))
+				return -1;
+			if (err >= 0)
+				pcep_session_error(ses, err);
+			return 0;
 		}
-		break;
-	case PCEP_STATE_KEEP_WAIT:
-		/* check for a keepalive message */
-		break;
-	case PCEP_STATE_SESSION_UP:
-		break;
-	default:
-		/* invalid state - it should never happen! */
-		err = -1;
-		break;
+		pcep_req_schedule(reqs, n, deadline);
+		if (pcep_session_requests(ses, &b, reqs, n))
+			return -1;
+	} while (off);
+
+	if (pcep_session_batch_flush(&b))
+		return -1;
+
+	return pcep_session_load_check(ses);
+}
+
+/* every state starts from a default action for all the events */
+#define PCEP_FSM_ALL(action) [0 ... PCEP_EVENTS - 1] = (action)
+
+/*
+ * The RFC 5440 session FSM, indexed by state and event. Messages of
+ * unknown type never reach the FSM (see pcep_msg_handler()).
+ *
+ * Every row starts from a default for all the events and then overrides
+ * some of them, on purpose.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+static const pcep_fsm_action pcep_fsm[PCEP_STATES][PCEP_EVENTS] = {
+	[PCEP_STATE_IDLE] = {
+		PCEP_FSM_ALL(pcep_fsm_ignore),
+		[PCEP_MSG_TYPE_MIN + 1 ... PCEP_MSG_TYPE_MAX - 1] =
+			pcep_fsm_invalid,
+	},
+	[PCEP_STATE_TCP_PENDING] = {
+		PCEP_FSM_ALL(pcep_fsm_ignore),
+		[PCEP_MSG_TYPE_MIN + 1 ... PCEP_MSG_TYPE_MAX - 1] =
+			pcep_fsm_invalid,
+	},
+	[PCEP_STATE_OPEN_WAIT] = {
+		PCEP_FSM_ALL(pcep_fsm_ignore),
+		[PCEP_MSG_TYPE_MIN + 1 ... PCEP_MSG_TYPE_MAX - 1] =
+			pcep_fsm_open_invalid,
+		[PCEP_MSG_TYPE_OPEN] = pcep_fsm_open,
+		[PCEP_MSG_TYPE_KEEPALIVE] = pcep_fsm_open_acked,
+		[PCEP_MSG_TYPE_ERROR] = pcep_fsm_open_refused,
+		[PCEP_MSG_TYPE_CLOSE] = pcep_fsm_close,
+		[PCEP_EVENT_OPEN_WAIT] = pcep_fsm_open_wait_expired,
+	},
+	[PCEP_STATE_KEEP_WAIT] = {
+		PCEP_FSM_ALL(pcep_fsm_ignore),
+		[PCEP_MSG_TYPE_KEEPALIVE] = pcep_fsm_keep_wait_done,
+		[PCEP_MSG_TYPE_ERROR] = pcep_fsm_open_refused,
+		[PCEP_MSG_TYPE_CLOSE] = pcep_fsm_close,
+		[PCEP_EVENT_KEEP_WAIT] = pcep_fsm_keep_wait_expired,
+		[PCEP_EVENT_KEEP_ALIVE] = pcep_fsm_keep_alive,
+		[PCEP_EVENT_DEAD] = pcep_fsm_dead,
+	},
+	[PCEP_STATE_SESSION_UP] = {
+		PCEP_FSM_ALL(pcep_fsm_ignore),
+		[PCEP_MSG_TYPE_PC_REQUEST] = pcep_fsm_request,
+		[PCEP_MSG_TYPE_CLOSE] = pcep_fsm_close,
+		[PCEP_EVENT_KEEP_ALIVE] = pcep_fsm_keep_alive,
+		[PCEP_EVENT_DEAD] = pcep_fsm_dead,
+	},
+};
+#pragma GCC diagnostic pop
+
+/*
+ * pcep_session_fsm_check - Check that the FSM handles every state and
+ * every event
+ */
+int pcep_session_fsm_check(void)
+{
+	int state, event;
+
+	for (state = 0; state < PCEP_STATES; state++)
+		for (event = 0; event < PCEP_EVENTS; event++)
+			if (!pcep_fsm[state][event])
+				return -1;
+
+	return 0;
+}
+
+/*
+ * pcep_session_unknown - Answer a message of unknown type
+ *
+ * The peer gets a PCErr, and a Close past max_unknown_msgs of them in a
+ * minute.
+ */
+static int pcep_session_unknown(struct pcep_session *ses)
+{
+	unsigned long now = pce_timer_now(ses->loop);
+	unsigned int max = ses->cfg->max_unknown_msgs;
+
+	if (!ses->num_unknown ||
+		now - ses->unknown_since >= PCEP_SESSION_UNKNOWN_WINDOW) {
+		ses->unknown_since = now;
+		ses->num_unknown = 0;
+	}
+	if (++ses->num_unknown > max && max) {
+		pcep_session_bye(ses, PCEP_CLOSE_REASON_UNKNOWN_MSGS);
+		return -1;
+	}
+
+	return pcep_session_error(ses, PCEP_ERR_CAPABILITY);
+}
+
+static int pcep_msg_handler(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	/* any message from the peer restarts the dead timer */
+	ses->last_rx = pce_timer_now(ses->loop);
+
+	if (msg->type >= PCEP_MSG_TYPE_MAX)
+		return pcep_session_unknown(ses);
+
+	return pcep_fsm[ses->state][msg->type](ses, msg);
+}
+
+static int pcep_timer_handler(struct pcep_session *ses, int event)
+{
+	int err;
+
+	/* going down once the output is sent */
+	if (ses->closing)
+		return 0;
+
+	err = pcep_fsm[ses->state][event](ses, NULL);
+	if (err) {
+		ses->closing = 1;
+		if (pcep_session_output(ses))
+			pcep_session_close(ses);
 	}
 
 	return err;
 }
 
-static void pcep_timer_handler(struct pce_session *ses,
-	int elaps)
+static void pcep_session_open_wait(struct pce_timer *t)
+{
+	pcep_timer_handler(container_of(t, struct pcep_session, open_wait),
+		PCEP_EVENT_OPEN_WAIT);
+}
+
+static void pcep_session_keep_wait(struct pce_timer *t)
+{
+	pcep_timer_handler(container_of(t, struct pcep_session, keep_wait),
+		PCEP_EVENT_KEEP_WAIT);
+}
+
+static void pcep_session_keep_alive(struct pce_timer *t)
+{
+	pcep_timer_handler(container_of(t, struct pcep_session, keep_alive),
+		PCEP_EVENT_KEEP_ALIVE);
+}
+
+static void pcep_session_dead(struct pce_timer *t)
 {
-	int err = 0;
+	pcep_timer_handler(container_of(t, struct pcep_session, dead),
+		PCEP_EVENT_DEAD);
+}
+
+static void pcep_session_load_timer(struct pce_timer *t)
+{
+	struct pcep_session *ses =
+		container_of(t, struct pcep_session, load_check);
+
+	if (pcep_session_load_check(ses))
+		pcep_session_close(ses);
+}
 
-	switch (ses->state) {
-	case PCEP_STATE_IDLE:
+/*
+ * pcep_session_stats - Account a received PCEP message
+ */
+static void pcep_session_stats(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	switch (msg->type) {
+	case PCEP_MSG_TYPE_KEEPALIVE:
+		pcep_session_count(ses, num_keep_alive_rcvd);
+		break;
+	case PCEP_MSG_TYPE_PC_REQUEST:
+		pcep_session_count(ses, num_pc_req_rcvd);
 		break;
-	case PCEP_STATE_TCP_PENDING:
+	case PCEP_MSG_TYPE_PC_REPLY:
+		pcep_session_count(ses, num_pc_rep_rcvd);
 		break;
-	case PCEP_STATE_OPEN_WAIT:
+	case PCEP_MSG_TYPE_NOTIFICATION:
+		pcep_session_count(ses, num_pc_ntf_rcvd);
 		break;
-	case PCEP_STATE_KEEP_WAIT:
+	case PCEP_MSG_TYPE_ERROR:
+		pcep_session_count(ses, num_pc_err_rcvd);
 		break;
-	case PCEP_STATE_SESSION_UP:
+	case PCEP_MSG_TYPE_OPEN:
+	case PCEP_MSG_TYPE_CLOSE:
 		break;
 	default:
-		/* invalid state - it should never happen! */
-		err = -1;
+		pcep_session_count(ses, num_unknown_rcvd);
 		break;
 	}
+}
 
-	return err;
+/*
+ * pcep_session_close - Tear down a session whose connection went away
+ */
+static void pcep_session_close(struct pcep_session *ses)
+{
+	pce_log(LOG_DEBUG, "closing PCEP session ...\n");
+
+	/* let the owner unlink and release the session */
+	if (ses->close)
+		ses->close(ses);
+	else
+		pcep_session_delete(ses);
 }
 
-#define PCEP_FD_SOCKET 0
-#define PCEP_FD_TIMER 1
-#define PCEP_FD_TOT 2
+/*
+ * pcep_session_dispatch - Handle a framed PCEP message
+ *
+ * A message the FSM fails on (e.g. answered with a PCErr, or a Close)
+ * takes the session down once what was queued for the peer is written:
+ * nothing else is read meanwhile.
+ */
+static void pcep_session_dispatch(struct pcep_session *ses,
+	struct pcep_msg_hdr *msg)
+{
+	char dump[80];
+
+	pcep_msg_hdr_dump(msg, dump, sizeof(dump));
+	pce_log(LOG_DEBUG, "%s\n", dump);
+
+	/* handle the message */
+	pcep_session_stats(ses, msg);
+	if (pcep_msg_handler(ses, msg))
+		ses->closing = 1;
+}
 
-#define PCEP_MSG_CHUNK 9
-void pcep_session_handler(struct pcep_session *ses)
+/*
+ * pcep_session_input - Frame and handle a chunk of the incoming stream
+ *
+ * Return the count of bytes handled: none past the high-water mark of the
+ * output queue.
+ */
+static size_t pcep_session_input(struct pcep_session *ses, char *buf,
+	size_t count)
 {
-	char buf[PCEP_MSG_CHUNK];
-	ssize_t count;
-	uint64_t elaps;
 	struct pcep_msg_hdr *msg;
-	struct pollfd fds[PCEP_FD_TOT];
+	size_t n, left = count;
 
-	/* specify events of interest */
-	fds[PCEP_FD_SOCKET].fd = ses->cfd;
-	fds[PCEP_FD_SOCKET].events = POLLIN;
-	fcntl(ses->cfd, F_SETFL, fcntl(ses->cfd, F_GETFL) | O_NONBLOCK);
-	fds[PCEP_FD_TIMER].fd = ses->tfd;
-	fds[PCEP_FD_TIMER].events = POLLIN;
-	fcntl(ses->tfd, F_SETFL, fcntl(ses->tfd, F_GETFL) | O_NONBLOCK);
+	while (count && !ses->closing &&
+		pcep_session_queued(ses) < ses->cfg->send_hwm) {
 
-	while (1) {
+		/* feed the framer with (what fits of) the message chunk */
+		n = pcep_framer_write(ses->frm, buf, count);
+		buf += n;
+		count -= n;
 
-		/* block on interested events */
-		if (poll(fds, PCEP_FD_TOT, -1) < 0)
-			break;
+		/* handle PCEP messages (if any) */
+		while (!ses->closing && (msg = pcep_framer_read(ses->frm))) {
+			pcep_session_dispatch(ses, msg);
+
+			/* release the message memory */
+			pcep_msg_free(msg);
+		}
+	}
+
+	return left - count;
+}
+
+/*
+ * pcep_session_hold - Keep the input that can't be handled yet
+ */
+static int pcep_session_hold(struct pcep_session *ses, char *buf,
+	size_t count)
+{
+	size_t size;
+	char *in;
+
+	if (ses->in_len + count > ses->in_size) {
+		if (ses->in_off) {
+			memmove(ses->in, ses->in + ses->in_off,
+				ses->in_len - ses->in_off);
+			ses->in_len -= ses->in_off;
+			ses->in_off = 0;
+		}
+		if (ses->in_len + count > ses->in_size) {
+			size = ses->in_size ? ses->in_size : PCEP_SESSION_OUT_MIN;
+			while (size < ses->in_len + count)
+				size *= 2;
+			in = realloc(ses->in, size);
+			if (!in) {
+				pce_log(LOG_ERR, "failed to get memory\n");
+				return -1;
+			}
+			ses->in = in;
+			ses->in_size = size;
+		}
+	}
+	memcpy(ses->in + ses->in_len, buf, count);
+	ses->in_len += count;
+
+	return 0;
+}
 
-		/* socket data available */
-		if (fds[PCEP_FD_SOCKET].revents & POLLIN) {
+/*
+ * pcep_session_unhold - Handle the input kept, as much as the output queue
+ * now allows
+ */
+static void pcep_session_unhold(struct pcep_session *ses)
+{
+	ses->in_off += pcep_session_input(ses, ses->in + ses->in_off,
+		ses->in_len - ses->in_off);
+	if (ses->in_off == ses->in_len)
+		ses->in_off = ses->in_len = 0;
+}
 
-			/* read a message chunk from the incoming stream */
-			do {
-				count = read(ses->cfd, buf, PCEP_MSG_CHUNK);
-			} while (count == -1 && errno == EINTR);
+/*
+ * pcep_session_read - Read and handle the incoming stream
+ *
+ * The socket is drained until EAGAIN, but no more than the read budget is
+ * read per wakeup: the loop reports the session again on the next round,
+ * so a chatty peer can't starve the others. Reading also stops as soon as
+ * the output queue reaches the high-water mark.
+ */
+static int pcep_session_read(struct pcep_session *ses)
+{
+	struct pcep_framer *frm = ses->frm;
+	struct pcep_msg_view view;
+	struct iovec iov[2];
+	size_t budget = ses->cfg->read_budget;
+	ssize_t count;
+	int n, ret;
 
-			/* check for any (fatal) error */
-			if (count == -1)
-				break;
-			/* check if the peer socket hunged-up */
-			if (count == 0)
-				break;
+	/*
+	 * readiness based loops read straight into the framer receive ring
+	 * and messages are handled in place (zero-copy mode)
+	 */
+	if (!frm->ring && pcep_framer_ring_alloc(frm, ses->cfg->recv_buf_size)) {
+		pce_log(LOG_ERR, "failed to get memory\n");
+		return -1;
+	}
 
-			/* feed the framer with the message chunk */
-			pcep_framer_write(frm, buf, count);
+	while (budget && !ses->closing &&
+		pcep_session_queued(ses) < ses->cfg->send_hwm) {
+		n = pcep_framer_ring_space(frm, iov);
+		if (!n)
+			break;
 
-			/* handle PCEP messages (if any) */
-			while (msg = pcep_framer_read(frm)) {
+		/* read as much of the incoming stream as the ring can hold */
+		do {
+			count = readv(ses->sock.fd, iov, n);
+		} while (count == -1 && errno == EINTR);
 
-				char dump[80];
+		/* socket drained */
+		if (count == -1 && errno == EAGAIN)
+			break;
 
-				pcep_msg_hdr_dump(msg, dump, sizeof(dump));
-				pce_log(LOG_DEBUG, "%s\n", dump);
+		/* check for any (fatal) error or if the peer socket hunged-up */
+		if (count <= 0)
+			return -1;
 
-				/* handle the message */
-				pcep_msg_handler(ses, msg);
+		/* handle PCEP messages (if any) */
+		pcep_framer_ring_commit(frm, count);
+		ret = 0;
+		while (!ses->closing &&
+			(ret = pcep_framer_ring_read(frm, &view)) > 0) {
+			pcep_session_dispatch(ses, view.msg);
+			pcep_framer_ring_release(frm, &view);
+		}
 
-				/* release the message memory */
-				pcep_msg_free(msg);
-			}
+		/* the message wrapping the ring end can't be copied */
+		if (ret < 0) {
+			pce_log(LOG_ERR, "failed to get memory\n");
+			return -1;
 		}
 
-		/* timer expired */
-		if (fds[PCEP_FD_TIMER].revents & POLLIN) {
+		budget -= (size_t)count < budget ? (size_t)count : budget;
+	}
 
-			/* read the expiration time */
-			do {
-				count = read(ses->tfd, &elaps, sizeof(elaps));
-			} while (count == -1 && errno == EINTR);
+	return 0;
+}
 
-			/* any error? */
-			if (count != sizeof(elaps))
-				break;
+/*
+ * pcep_session_output - Write the queued output and update the events of
+ * interest
+ *
+ * A session that sent a Close goes down once it is written (if it can be),
+ * or once the loop is done sending it.
+ */
+static int pcep_session_output(struct pcep_session *ses)
+{
+	ses->batching = 0;
+	if (pcep_session_flush(ses))
+		return -1;
+	if (ses->closing)
+		return ses->busy ? 0 : -1;
+	pcep_session_watch(ses);
 
-			pce_log(LOG_DEBUG, "timer exipred, elapsed %d\n", elaps);
+	return 0;
+}
 
-			/* handle the timer expiration */
-			pcep_timer_handler(ses, elaps);
-		}
+/*
+ * pcep_session_handler - Handle a readiness notification of the connection
+ */
+static void pcep_session_handler(struct pce_loop_event *ev,
+	unsigned int events)
+{
+	struct pcep_session *ses = container_of(ev, struct pcep_session, sock);
+
+	/* replies to the messages read are coalesced */
+	ses->batching = 1;
+	if (events & PCE_LOOP_IN) {
+		if (pcep_session_read(ses))
+			goto err;
+	} else if (events & (PCE_LOOP_ERR | PCE_LOOP_HUP)) {
+		/* the peer went away while we were not reading */
+		goto err;
 	}
 
+	if (pcep_session_output(ses))
+		goto err;
+
 	return;
+
+err:
+	pcep_session_close(ses);
 }
 
+/*
+ * pcep_session_recv - Handle data received by a completion based loop
+ *
+ * Data lands in buffers picked by the loop, so it goes through the framer
+ * copy mode. Pausing the reception takes effect some buffers later: what
+ * arrives past the high-water mark is kept till the output is sent.
+ */
+static void pcep_session_recv(struct pce_loop_event *ev, char *buf,
+	ssize_t count)
+{
+	struct pcep_session *ses = container_of(ev, struct pcep_session, sock);
+	size_t n;
+
+	/* check for any (fatal) error or if the peer socket hunged-up */
+	if (count <= 0) {
+		pcep_session_close(ses);
+		return;
+	}
+
+	ses->batching = 1;
+	n = ses->in_len ? 0 : pcep_session_input(ses, buf, count);
+	if (n < (size_t)count && !ses->closing &&
+		pcep_session_hold(ses, buf + n, count - n))
+		goto err;
+	if (pcep_session_output(ses))
+		goto err;
+
+	return;
 
+err:
+	pcep_session_close(ses);
+}
 
-struct pcep_session_config {
-	unsigned int open_wait_timer;
-	unsigned int keep_wait_timer;
-	unsigned int keep_alive_timer;
-	unsigned int dead_timer;
-	unsigned int sync_timer;
-	unsigned int request_timer;
-	unsigned int init_backoff_timer;
-	unsigned int max_backoff_timer;
-	unsigned int max_req_per_session;
-	unsigned int max_unknown_reqs;
-	unsigned int max_unknown_msgs
-}
-
-struct pcep_session {
-
-	/* session objects */
-	int cfd;
-	int tfd;
-	struct itimerspec tval;
-	struct pcep_framer *frm;
-	
-	/* session status */
-	int state;
-	int local_id;
-	int peer_id;
-	
-	/* session attributes */
-	unsigned int state_last_change;
-	unsigned int keep_alive_timer;
-	unsigned int peer_keep_alive_timer;
-	unsigned int dead_timer;
-	unsigned int peer_dead_timer;
-	unsigned int keep_alive_hold_time_rem;
-	
-	/* statistics */
-	unsigned int num_pc_req_sent;
-	unsigned int num_pc_req_rcvd;
-	unsigned int num_pc_rep_sent;
-	unsigned int num_pc_rep_rcvd;
-	unsigned int num_pc_err_sent;
-	unsigned int num_pc_err_rcvd;
-	unsigned int num_pc_ntf_sent;
-	unsigned int num_pc_ntf_rcvd;
-	unsigned int num_keep_alive_sent;
-	unsigned int num_keep_alive_rcvd;
-	unsigned int num_unknown_rcvd;
-}
-
-struct pcep_session *pcep_session_create(int cfd,
-	struct pcep_session_config *cfg)
+/*
+ * pcep_session_create - Create a PCEP session on an accepted connection
+ */
+struct pcep_session *pcep_session_create(struct pce_loop *loop,
+	int cfd, struct pcep_session_config *cfg)
 {
 	struct pcep_session *ses;
 
@@ -247,6 +1661,10 @@ struct pcep_session *pcep_session_create(int cfd,
 		pce_log(LOG_ERR, "failed to get memory\n");
 		goto out;
 	}
+	ses->loop = loop;
+	ses->cfg = cfg;
+	ses->state = PCEP_STATE_OPEN_WAIT;
+	INIT_LIST_HEAD(&ses->list);
 
 	/* create a PCEP message framer */
 	ses->frm = pcep_framer_create();
@@ -255,23 +1673,48 @@ struct pcep_session *pcep_session_create(int cfd,
 		goto out1;
 	}
 
-	/* create a periodic one second timer */
-	ses->tfd = timerfd_create(CLOCK_MONOTONIC, 0);
-	if (!ses->tfd) {
-		pce_log(LOG_ERR, "failed to create PCEP timer\n");
+	/* session timers are driven by the event loop timer wheel */
+	pce_timer_init(&ses->open_wait, pcep_session_open_wait);
+	pce_timer_init(&ses->keep_wait, pcep_session_keep_wait);
+	pce_timer_init(&ses->keep_alive, pcep_session_keep_alive);
+	pce_timer_init(&ses->dead, pcep_session_dead);
+	pce_timer_init(&ses->load_check, pcep_session_load_timer);
+
+	/* register the session with the event loop */
+	ses->events = PCE_LOOP_IN;
+	ses->sock.fd = cfd;
+	ses->sock.handler = pcep_session_handler;
+	ses->sock.recv = pcep_session_recv;
+	ses->sock.sent = pcep_session_sent;
+	ses->loop_sends = pce_loop_sends(loop);
+	fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+	if (pce_loop_add_stream(loop, &ses->sock) < 0) {
+		pce_log(LOG_ERR, "failed to watch PCEP socket\n");
 		goto out2;
 	}
-	ses->tval.it_interval.tv_sec = 1,
-	ses->tval.it_value.tv_sec = 1,
-	if (timerfd_settime(ses->tfd, 0, &ses->tval, NULL) != 0) {
-		pce_log(LOG_ERR, "failed to configure PCEP timer\n");
+
+	/*
+	 * send our Open, with the attributes of the configuration: the peer
+	 * accepts them with a Keepalive
+	 */
+	ses->keep_alive_timer = cfg->keep_alive_timer;
+	ses->dead_timer = cfg->dead_timer;
+	ses->local_id = __atomic_fetch_add(&cfg->session_id, 1,
+		__ATOMIC_RELAXED) & 0xff;
+	if (pcep_session_open(ses)) {
+		pce_log(LOG_ERR, "failed to send PCEP Open\n");
 		goto out3;
 	}
 
+	/* wait for the peer open message */
+	ses->last_rx = pce_timer_now(loop);
+	pce_timer_add(loop, &ses->open_wait, cfg->open_wait_timer * 1000);
+
 	return ses;
 
 out3:
-	close(ses->tfd);
+	pce_loop_del(loop, &ses->sock);
+	free(ses->out);
 out2:
 	pcep_framer_delete(ses->frm);
 out1:
@@ -280,9 +1723,61 @@ out:
 	return NULL;
 }
 
+/*
+ * pcep_session_delete - Release a PCEP session and close its connection
+ */
 void pcep_session_delete(struct pcep_session *ses)
 {
-	close(ses->tfd);
+	pce_timer_del(&ses->open_wait);
+	pce_timer_del(&ses->keep_wait);
+	pce_timer_del(&ses->keep_alive);
+	pce_timer_del(&ses->dead);
+	pce_timer_del(&ses->load_check);
+	pce_loop_del(ses->loop, &ses->sock);
+	close(ses->sock.fd);
 	pcep_framer_delete(ses->frm);
-	free(ses);
+	free(ses->out);
+	free(ses->in);
+
+	/* the last job to complete releases the session */
+	if (ses->jobs)
+		ses->closed = 1;
+	else
+		free(ses);
+}
+
+/*
+ * pcep_session_get_info - Get the session attributes and statistics
+ *
+ * The keepalive hold time left is computed on demand, in milliseconds.
+ */
+void pcep_session_get_info(struct pcep_session *ses,
+	struct pcep_session_info *info)
+{
+	if (pce_timer_pending(&ses->dead))
+		ses->keep_alive_hold_time_rem = pcep_session_dead_left(ses,
+			pce_timer_now(ses->loop));
+	else
+		ses->keep_alive_hold_time_rem = 0;
+
+	info->state_last_change = ses->state_last_change;
+	info->state = ses->state;
+	info->local_id = ses->local_id;
+	info->peer_id = ses->peer_id;
+	info->keep_alive_timer = ses->keep_alive_timer;
+	info->peer_keep_alive_timer = ses->peer_keep_alive_timer;
+	info->dead_timer = ses->dead_timer;
+	info->peer_dead_timer = ses->peer_dead_timer;
+	info->keep_alive_hold_time_rem = ses->keep_alive_hold_time_rem;
+	info->num_pc_req_sent = ses->num_pc_req_sent;
+	info->num_pc_req_rcvd = ses->num_pc_req_rcvd;
+	info->num_pc_rep_sent = ses->num_pc_rep_sent;
+	info->num_pc_rep_rcvd = ses->num_pc_rep_rcvd;
+	info->num_pc_err_sent = ses->num_pc_err_sent;
+	info->num_pc_err_rcvd = ses->num_pc_err_rcvd;
+	info->num_pc_ntf_sent = ses->num_pc_ntf_sent;
+	info->num_pc_ntf_rcvd = ses->num_pc_ntf_rcvd;
+	info->num_keep_alive_sent = ses->num_keep_alive_sent;
+	info->num_keep_alive_rcvd = ses->num_keep_alive_rcvd;
+	info->num_unknown_rcvd = ses->num_unknown_rcvd;
 }
@@ -0,0 +1,197 @@
+/*
+ * pcep_session.h - PCEP session interface
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#ifndef PCEP_SESSION_H
+#define PCEP_SESSION_H
+
+#include "list.h"
+#include "pce_loop.h"
+#include "pce_timer.h"
+#include "pce_cspf.h"
+#include "pce_worker.h"
+#include "pcep_framer.h"
+#include "pcep_info.h"
+
+/* default session attributes (RFC 5440), in seconds */
+#define PCEP_DEFAULT_OPEN_WAIT_TIMER     60
+#define PCEP_DEFAULT_KEEP_WAIT_TIMER     60
+#define PCEP_DEFAULT_KEEP_ALIVE_TIMER    30
+#define PCEP_DEFAULT_DEAD_TIMER         120
+#define PCEP_DEFAULT_SYNC_TIMER          60
+#define PCEP_DEFAULT_REQUEST_TIMER       30
+#define PCEP_DEFAULT_INIT_BACKOFF_TIMER  60
+#define PCEP_DEFAULT_MAX_BACKOFF_TIMER  3600
+#define PCEP_DEFAULT_MAX_SESSIONS          0	/* any */
+#define PCEP_DEFAULT_MAX_REQ_PER_SESSION 256
+#define PCEP_DEFAULT_MAX_UNKNOWN_REQS     5
+#define PCEP_DEFAULT_MAX_UNKNOWN_MSGS     5
+
+/* default receive path settings, in bytes */
+#define PCEP_DEFAULT_RECV_BUF_SIZE   (64 * 1024)
+#define PCEP_DEFAULT_READ_BUDGET    (256 * 1024)
+#define PCEP_DEFAULT_SEND_HWM        (64 * 1024)
+
+/* default overload high watermark, in requests pending computation */
+#define PCEP_DEFAULT_LOAD_HIGH       4096
+
+struct pcep_session_config {
+	unsigned int open_wait_timer;
+	unsigned int keep_wait_timer;
+	unsigned int keep_alive_timer;
+	unsigned int dead_timer;
+	unsigned int sync_timer;
+	unsigned int request_timer;
+	unsigned int init_backoff_timer;
+	unsigned int max_backoff_timer;
+	unsigned int max_sessions;
+	unsigned int max_req_per_session;
+	unsigned int max_unknown_reqs;
+	unsigned int max_unknown_msgs;
+	unsigned int recv_buf_size;	/* receive ring, a power of 2 */
+	unsigned int read_budget;	/* max bytes read per wakeup */
+	unsigned int send_hwm;		/* output queued before reads stop */
+	unsigned int session_id;	/* SID of the next session */
+};
+
+/*
+ * Message counters aggregated over all the sessions of an event loop. They
+ * are written by the owning loop only and may be read by any thread.
+ */
+struct pcep_stats {
+	unsigned long num_pc_req_sent;
+	unsigned long num_pc_req_rcvd;
+	unsigned long num_pc_rep_sent;
+	unsigned long num_pc_rep_rcvd;
+	unsigned long num_pc_err_sent;
+	unsigned long num_pc_err_rcvd;
+	unsigned long num_pc_ntf_sent;
+	unsigned long num_pc_ntf_rcvd;
+	unsigned long num_keep_alive_sent;
+	unsigned long num_keep_alive_rcvd;
+	unsigned long num_unknown_rcvd;
+	unsigned long num_path_cache_hits;
+	unsigned long num_path_cache_misses;
+	unsigned long num_pc_req_expired;
+	unsigned long num_pc_req_refused;
+};
+
+/* single writer update, no locked instruction on the hot path */
+#define PCEP_STATS_ADD(var, n) \
+	__atomic_store_n(&(var), (var) + (n), __ATOMIC_RELAXED)
+#define PCEP_STATS_READ(var) \
+	__atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+/*
+ * Requests pending computation over all the sessions sharing the workers,
+ * updated by all their event loops. The PCE is overloaded from the high
+ * watermark until the pending requests go down to the low one, and the
+ * peers are told so.
+ */
+struct pcep_load {
+	unsigned long pending;
+	unsigned long high;
+	unsigned long low;
+	int overloaded;
+};
+
+struct pcep_session {
+
+	/* session objects */
+	struct pce_loop *loop;
+	struct pce_loop_event sock;
+	unsigned int events;
+	struct pcep_framer *frm;
+	struct pcep_session_config *cfg;
+
+	/* session owner */
+	struct list_head list;
+	void (*close)(struct pcep_session *ses);
+	void *owner;
+	struct pcep_stats *stats;
+	struct pce_cspf *cspf;		/* path computation engine */
+	struct pce_worker_port *port;	/* or workers computing paths */
+	unsigned int jobs;		/* submitted to the workers */
+	int closed;
+	struct pcep_load *load;		/* shared by the sessions, or NULL */
+	unsigned int pending;		/* requests submitted */
+	int overload_sent;		/* the peer was told we're overloaded */
+
+	/* output queue, the queued data is out[out_head, out_tail) */
+	char *out;
+	size_t out_size;
+	size_t out_head;
+	size_t out_tail;
+	int out_err;
+	int batching;
+
+	/* or handed to the loop, busy[busy_off, busy_off + busy_len) */
+	int loop_sends;
+	char *busy;
+	size_t busy_size;
+	size_t busy_off;
+	size_t busy_len;
+
+	/* input received past the high-water mark, in[in_off, in_len) */
+	char *in;
+	size_t in_size;
+	size_t in_off;
+	size_t in_len;
+
+	/* session timers */
+	struct pce_timer open_wait;
+	struct pce_timer keep_wait;
+	struct pce_timer keep_alive;
+	struct pce_timer dead;
+	struct pce_timer load_check;
+
+	/* session status */
+	int state;
+	int local_id;
+	int peer_id;
+	int local_ok;
+	int remote_ok;
+	int open_retried;	/* the peer was asked for another Open */
+	int closing;		/* down once the output is written */
+	unsigned long last_rx;	/* loop clock, in milliseconds */
+	unsigned long unknown_since;	/* first unknown message of a minute */
+	unsigned int num_unknown;	/* unknown messages since then */
+
+	/* session attributes (timers in seconds) */
+	unsigned int state_last_change;
+	unsigned int keep_alive_timer;
+	unsigned int peer_keep_alive_timer;
+	unsigned int dead_timer;
+	unsigned int peer_dead_timer;
+	unsigned int keep_alive_hold_time_rem;	/* in milliseconds */
+
+	/* statistics */
+	unsigned int num_pc_req_sent;
+	unsigned int num_pc_req_rcvd;
+	unsigned int num_pc_rep_sent;
+	unsigned int num_pc_rep_rcvd;
+	unsigned int num_pc_err_sent;
+	unsigned int num_pc_err_rcvd;
+	unsigned int num_pc_ntf_sent;
+	unsigned int num_pc_ntf_rcvd;
+	unsigned int num_keep_alive_sent;
+	unsigned int num_keep_alive_rcvd;
+	unsigned int num_unknown_rcvd;
+	unsigned int num_path_cache_hits;
+	unsigned int num_path_cache_misses;
+	unsigned int num_pc_req_expired;
+	unsigned int num_pc_req_refused;
+};
+
+extern struct pcep_session *pcep_session_create(struct pce_loop *loop,
+	int cfd, struct pcep_session_config *cfg);
+extern void pcep_session_delete(struct pcep_session *ses);
+extern void pcep_session_get_info(struct pcep_session *ses,
+	struct pcep_session_info *info);
+extern int pcep_session_fsm_check(void);
+
+#endif /* PCEP_SESSION_H */
@@ -0,0 +1,190 @@
+/*
+ * pcep_session_test.c - PCEP session FSM test
+ *
+ * Copyright (C) 2013 Paolo Rovelli
+ *
+ * Author: Paolo Rovelli <paolorovelli@yahoo.it>
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pce_loop.h"
+#include "pce_timer.h"
+#include "pcep_msg.h"
+#include "pcep_info.h"
+#include "pcep_session.h"
+
+/* how long the loop runs for each step, in milliseconds */
+#define TEST_STEP 50
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #cond); \
+			exit(EXIT_FAILURE); \
+		} \
+	} while (0)
+
+/* PCEP messages sent by the peer */
+static const unsigned char test_msg_open[] = {
+	0x20, 0x01, 0x00, 0x0c,		/* Open */
+	0x01, 0x10, 0x00, 0x08,		/* OPEN object */
+	0x20, 30, 120, 0x01		/* keepalive 30s, dead 120s, SID 1 */
+};
+static const unsigned char test_msg_keepalive[] = {
+	0x20, 0x02, 0x00, 0x04		/* Keepalive */
+};
+static const unsigned char test_msg_close[] = {
+	0x20, 0x07, 0x00, 0x0c,		/* Close */
+	0x0f, 0x10, 0x00, 0x08,		/* CLOSE object */
+	0x00, 0x00, 0x00, 0x01		/* no explanation provided */
+};
+static const unsigned char test_msg_unknown[] = {
+	0x20, 0xc8, 0x00, 0x04		/* message type 200 */
+};
+
+static struct pce_loop *loop;
+static struct pce_timer test_timer;
+static int test_closed;
+
+static void test_stop(struct pce_timer *t)
+{
+	pce_loop_stop(loop);
+}
+
+/*
+ * test_run - Let the session handle what the peer sent
+ */
+static void test_run(void)
+{
+	pce_timer_add(loop, &test_timer, TEST_STEP);
+	pce_loop_run(loop);
+}
+
+static void test_close(struct pcep_session *ses)
+{
+	test_closed = 1;
+	pcep_session_delete(ses);
+}
+
+/*
+ * test_session - Create a session connected to the peer socket
+ */
+static struct pcep_session *test_session(struct pcep_session_config *cfg,
+	int *peer)
+{
+	struct pcep_session *ses;
+	int sv[2];
+
+	TEST_CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	ses = pcep_session_create(loop, sv[0], cfg);
+	TEST_CHECK(ses);
+	ses->close = test_close;
+	test_closed = 0;
+	*peer = sv[1];
+
+	return ses;
+}
+
+static void test_send(int peer, const void *msg, size_t len)
+{
+	TEST_CHECK(write(peer, msg, len) == (ssize_t)len);
+	test_run();
+}
+
+/*
+ * test_recv - Return the type of the next message sent by the session,
+ * 0 if there is none or -1 once the connection is closed
+ */
+static int test_recv(int peer)
+{
+	struct pollfd pfd = { .fd = peer, .events = POLLIN };
+	unsigned char hdr[4], body[0xffff];
+	size_t len;
+
+	if (poll(&pfd, 1, 0) <= 0)
+		return 0;
+	if (read(peer, hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+	len = (hdr[2] << 8 | hdr[3]) - sizeof(hdr);
+	TEST_CHECK(read(peer, body, len) == (ssize_t)len);
+
+	return hdr[1];
+}
+
+/*
+ * test_closing - Check that the session went down on a Close
+ */
+static void test_closing(int peer)
+{
+	test_send(peer, test_msg_close, sizeof(test_msg_close));
+	TEST_CHECK(test_closed);
+	TEST_CHECK(test_recv(peer) == -1);
+	close(peer);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pcep_session_config cfg = {
+		.open_wait_timer = PCEP_DEFAULT_OPEN_WAIT_TIMER,
+		.keep_wait_timer = PCEP_DEFAULT_KEEP_WAIT_TIMER,
+		.keep_alive_timer = PCEP_DEFAULT_KEEP_ALIVE_TIMER,
+		.dead_timer = PCEP_DEFAULT_DEAD_TIMER,
+		.max_req_per_session = PCEP_DEFAULT_MAX_REQ_PER_SESSION,
+		.max_unknown_reqs = PCEP_DEFAULT_MAX_UNKNOWN_REQS,
+		.max_unknown_msgs = PCEP_DEFAULT_MAX_UNKNOWN_MSGS,
+		.recv_buf_size = PCEP_DEFAULT_RECV_BUF_SIZE,
+		.read_budget = PCEP_DEFAULT_READ_BUDGET,
+		.send_hwm = PCEP_DEFAULT_SEND_HWM,
+	};
+	struct pcep_session *ses;
+	int peer;
+
+	/* every state handles every event */
+	TEST_CHECK(!pcep_session_fsm_check());
+
+	loop = pce_loop_create();
+	TEST_CHECK(loop);
+	pce_timer_init(&test_timer, test_stop);
+
+	/* Close in OPEN_WAIT */
+	ses = test_session(&cfg, &peer);
+	test_run();
+	TEST_CHECK(test_recv(peer) == PCEP_MSG_TYPE_OPEN);
+	TEST_CHECK(ses->state == PCEP_STATE_OPEN_WAIT);
+	test_closing(peer);
+
+	/* Open in OPEN_WAIT, then Close in KEEP_WAIT */
+	ses = test_session(&cfg, &peer);
+	test_run();
+	TEST_CHECK(test_recv(peer) == PCEP_MSG_TYPE_OPEN);
+	test_send(peer, test_msg_open, sizeof(test_msg_open));
+	TEST_CHECK(test_recv(peer) == PCEP_MSG_TYPE_KEEPALIVE);
+	TEST_CHECK(ses->state == PCEP_STATE_KEEP_WAIT);
+	test_closing(peer);
+
+	/*
+	 * Keepalive in KEEP_WAIT, unknown message in SESSION_UP, then Close
+	 * in SESSION_UP
+	 */
+	ses = test_session(&cfg, &peer);
+	test_run();
+	TEST_CHECK(test_recv(peer) == PCEP_MSG_TYPE_OPEN);
+	test_send(peer, test_msg_open, sizeof(test_msg_open));
+	TEST_CHECK(test_recv(peer) == PCEP_MSG_TYPE_KEEPALIVE);
+	test_send(peer, test_msg_keepalive, sizeof(test_msg_keepalive));
+	TEST_CHECK(ses->state == PCEP_STATE_SESSION_UP);
+	test_send(peer, test_msg_unknown, sizeof(test_msg_unknown));
+	TEST_CHECK(test_recv(peer) == PCEP_MSG_TYPE_ERROR);
+	TEST_CHECK(!test_closed && ses->state == PCEP_STATE_SESSION_UP);
+	test_closing(peer);
+
+	pce_loop_delete(loop);
+
+	return EXIT_SUCCESS;
+}